@@ -0,0 +1,345 @@
+//
+//  bench.c - Compile-time benchmark for the Tiny C Compiler for Sanos
+//
+//  Compiles a fixed corpus a number of times with -bench=json and reports
+//  lines/s, bytes/s, peak heap and output size for each case. The results
+//  are compared against a stored baseline, and the program fails if any
+//  case regressed by more than the tolerance or has no baseline entry.
+//  Use -u to record a new baseline.
+//
+//  usage: bench [-c compiler] [-n runs] [-t tolerance] [-b baseline] [-u]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define MAX_RUNS 32
+
+#define WORKDIR   "bench/out"
+#define JSONFILE  WORKDIR "/bench.json"
+
+// Compiler sources, used both one at a time and as a complete build
+#define CC_SOURCES \
+  "cc/asm386.c cc/asm.c cc/cache.c cc/cc.c cc/codegen386.c cc/codegen.c cc/compiler.c " \
+  "cc/elf.c cc/pe.c cc/preproc.c cc/profile.c cc/stats.c cc/symbol.c cc/type.c cc/util.c"
+
+struct bench_case {
+  const char *name;
+  const char *sources;
+  const char *options;
+  const char *output;
+  void (*generate)(FILE *f);
+};
+
+struct bench_result {
+  const char *name;
+  double lines_per_sec;
+  double bytes_per_sec;
+  long peak_memory;
+  long output_size;
+};
+
+static void gen_functions(FILE *f);
+static void gen_strings(FILE *f);
+static void gen_declarations(FILE *f);
+
+static struct bench_case cases[] = {
+  { "asm386.c", "cc/asm386.c", "-c", "asm386.o", NULL },
+  { "asm.c", "cc/asm.c", "-c", "asm.o", NULL },
+  { "cache.c", "cc/cache.c", "-c", "cache.o", NULL },
+  { "cc.c", "cc/cc.c", "-c", "cc.o", NULL },
+  { "codegen386.c", "cc/codegen386.c", "-c", "codegen386.o", NULL },
+  { "codegen.c", "cc/codegen.c", "-c", "codegen.o", NULL },
+  { "compiler.c", "cc/compiler.c", "-c", "compiler.o", NULL },
+  { "elf.c", "cc/elf.c", "-c", "elf.o", NULL },
+  { "pe.c", "cc/pe.c", "-c", "pe.o", NULL },
+  { "preproc.c", "cc/preproc.c", "-c", "preproc.o", NULL },
+  { "profile.c", "cc/profile.c", "-c", "profile.o", NULL },
+  { "stats.c", "cc/stats.c", "-c", "stats.o", NULL },
+  { "symbol.c", "cc/symbol.c", "-c", "symbol.o", NULL },
+  { "type.c", "cc/type.c", "-c", "type.o", NULL },
+  { "util.c", "cc/util.c", "-c", "util.o", NULL },
+  { "cc.exe", CC_SOURCES, "-DUSE_LOCAL_HEAP -noshare", "cc.exe", NULL },
+  { "os.h", "bench/os.c", "-c", "os.o", NULL },
+  { "win32.h", "bench/win32.c", "-c", "win32.o", NULL },
+  { "jni.h", "bench/jni.c", "-c", "jni.o", NULL },
+  { "functions", WORKDIR "/functions.c", "-c", "functions.o", gen_functions },
+  { "strings", WORKDIR "/strings.c", "-c", "strings.o", gen_strings },
+  { "declarations", WORKDIR "/declarations.c", "-c", "declarations.o", gen_declarations },
+  { NULL }
+};
+
+static const char *compiler = "cc";
+static const char *baseline = "bench/baseline.txt";
+static int runs = 5;
+static double tolerance = 10.0;
+static int update = 0;
+
+static void usage(void) {
+  fprintf(stderr, "usage: bench [-c compiler] [-n runs] [-t tolerance] [-b baseline] [-u]\n");
+  exit(1);
+}
+
+static void fatal(const char *msg, const char *arg) {
+  fprintf(stderr, "bench: %s %s\n", msg, arg ? arg : "");
+  exit(1);
+}
+
+//
+// Synthetic sources
+//
+
+// Many small functions with loops, arithmetic and calls
+static void gen_functions(FILE *f) {
+  int i;
+
+  for (i = 0; i < 4000; i++) {
+    fprintf(f, "int f%d(int a, int b) {\n", i);
+    fprintf(f, "  int i, s = %d;\n", i);
+    fprintf(f, "  for (i = 0; i < a; i++) {\n");
+    fprintf(f, "    if ((i & %d) == 0) s += i * b; else s -= (a >> 1) + %d;\n", i & 7, i);
+    fprintf(f, "  }\n");
+    if (i > 0) fprintf(f, "  if (s < 0) s = f%d(s & 15, b - 1);\n", i - 1);
+    fprintf(f, "  return s ^ (b << 2);\n");
+    fprintf(f, "}\n\n");
+  }
+}
+
+// Log-message style code with many repeated and overlapping literals
+static void gen_strings(FILE *f) {
+  int i;
+
+  fprintf(f, "int printf(const char *fmt, ...);\n\n");
+  for (i = 0; i < 2000; i++) {
+    fprintf(f, "void log%d(int n, const char *s) {\n", i);
+    fprintf(f, "  printf(\"%%s: error %%d while reading block\\n\", s, n);\n");
+    fprintf(f, "  printf(\"while reading block\\n\");\n");
+    fprintf(f, "  printf(\"message %d from log%d: %%d\\n\", n);\n", i % 50, i);
+    fprintf(f, "}\n\n");
+  }
+}
+
+// Large amount of declarations, macros and types
+static void gen_declarations(FILE *f) {
+  int i;
+
+  for (i = 0; i < 3000; i++) {
+    fprintf(f, "#define CONST%d (%d + CONST_BASE)\n", i, i);
+    fprintf(f, "typedef struct s%d { int a; char b[%d]; struct s%d *next; } s%d_t;\n", i, i % 32 + 1, i, i);
+    fprintf(f, "extern int var%d;\n", i);
+    fprintf(f, "int proto%d(s%d_t *p, int n);\n", i, i);
+  }
+  fprintf(f, "#define CONST_BASE 1\n");
+  fprintf(f, "int total(void) {\n  return 0");
+  for (i = 0; i < 3000; i += 10) fprintf(f, " + CONST%d", i);
+  fprintf(f, ";\n}\n");
+}
+
+static void generate(struct bench_case *bc) {
+  FILE *f;
+
+  f = fopen(bc->sources, "w");
+  if (!f) fatal("cannot create", bc->sources);
+  bc->generate(f);
+  fclose(f);
+}
+
+//
+// Running the compiler
+//
+
+// Return the numeric value of a member in the JSON output from -bench=json
+static double json_value(const char *json, const char *name) {
+  char key[64];
+  const char *p;
+
+  snprintf(key, sizeof(key), "\"%s\":", name);
+  p = strstr(json, key);
+  if (!p) return 0.0;
+  return strtod(p + strlen(key), NULL);
+}
+
+static char *read_file(const char *filename) {
+  FILE *f;
+  char *buf;
+  long size;
+
+  f = fopen(filename, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(size + 1);
+  if (!buf) fatal("out of memory", NULL);
+  size = fread(buf, 1, size, f);
+  buf[size] = 0;
+  fclose(f);
+  return buf;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void run_case(struct bench_case *bc, struct bench_result *r) {
+  char cmd[1024], outfile[256];
+  double lps[MAX_RUNS], bps[MAX_RUNS];
+  struct stat st;
+  char *json;
+  long peak;
+  int i;
+
+  if (bc->generate) generate(bc);
+  snprintf(outfile, sizeof(outfile), WORKDIR "/%s", bc->output);
+  snprintf(cmd, sizeof(cmd), "%s -bench=json -Iinclude %s -o %s %s > %s",
+           compiler, bc->options, outfile, bc->sources, JSONFILE);
+
+  memset(r, 0, sizeof(struct bench_result));
+  r->name = bc->name;
+  for (i = 0; i < runs; i++) {
+    if (system(cmd) != 0) fatal("compilation failed:", cmd);
+    json = read_file(JSONFILE);
+    if (!json) fatal("no benchmark output from", compiler);
+    lps[i] = json_value(json, "lines_per_sec");
+    bps[i] = json_value(json, "bytes_per_sec");
+    peak = (long) json_value(json, "peak");
+    if (peak > r->peak_memory) r->peak_memory = peak;
+    free(json);
+  }
+
+  // Use the median of the runs for the throughput numbers
+  qsort(lps, runs, sizeof(double), cmp_double);
+  qsort(bps, runs, sizeof(double), cmp_double);
+  r->lines_per_sec = lps[runs / 2];
+  r->bytes_per_sec = bps[runs / 2];
+  if (stat(outfile, &st) == 0) r->output_size = st.st_size;
+}
+
+//
+// Baseline handling
+//
+
+static int find_baseline(const char *name, struct bench_result *b) {
+  FILE *f;
+  char line[256], case_name[64];
+
+  f = fopen(baseline, "r");
+  if (!f) return 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "%63s %lf %lf %ld %ld", case_name,
+               &b->lines_per_sec, &b->bytes_per_sec, &b->peak_memory, &b->output_size) != 5) {
+      continue;
+    }
+    if (!strcmp(case_name, name)) {
+      fclose(f);
+      return 1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+static void write_baseline(struct bench_result *results, int n) {
+  FILE *f;
+  int i;
+
+  f = fopen(baseline, "w");
+  if (!f) fatal("cannot write", baseline);
+  fprintf(f, "# Compile-time benchmark baseline, written by 'make bench-baseline'\n");
+  fprintf(f, "# case lines/s bytes/s peak-memory output-size\n");
+  for (i = 0; i < n; i++) {
+    fprintf(f, "%s %.0f %.0f %ld %ld\n", results[i].name,
+            results[i].lines_per_sec, results[i].bytes_per_sec,
+            results[i].peak_memory, results[i].output_size);
+  }
+  fclose(f);
+}
+
+// Return percentage change from baseline value 'b' to 'v'
+static double change(double v, double b) {
+  if (b == 0.0) return 0.0;
+  return (v - b) * 100.0 / b;
+}
+
+static void print_result(struct bench_result *r, const char *note) {
+  printf("%-14s %10.0f %12.0f %10ld %9ld   %s\n", r->name,
+         r->lines_per_sec, r->bytes_per_sec, r->peak_memory, r->output_size, note);
+}
+
+static int compare(struct bench_result *r) {
+  struct bench_result b;
+  double dl, db, dm, ds;
+  int failed;
+
+  if (!find_baseline(r->name, &b)) {
+    print_result(r, "NO BASELINE");
+    return 1;
+  }
+
+  dl = change(r->lines_per_sec, b.lines_per_sec);
+  db = change(r->bytes_per_sec, b.bytes_per_sec);
+  dm = change((double) r->peak_memory, (double) b.peak_memory);
+  ds = change((double) r->output_size, (double) b.output_size);
+
+  // Throughput must not drop, memory and output size must not grow
+  failed = dl < -tolerance || db < -tolerance || dm > tolerance || ds > tolerance;
+  printf("%-14s %10.0f %12.0f %10ld %9ld   %+6.1f%% %+6.1f%% %+6.1f%% %+6.1f%%%s\n", r->name,
+         r->lines_per_sec, r->bytes_per_sec, r->peak_memory, r->output_size,
+         dl, db, dm, ds, failed ? "  REGRESSION" : "");
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  struct bench_result results[sizeof(cases) / sizeof(cases[0])];
+  int i, n, failures;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      compiler = argv[++i];
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (!strcmp(argv[i], "-u")) {
+      update = 1;
+    } else {
+      usage();
+    }
+  }
+  if (runs < 1) runs = 1;
+  if (runs > MAX_RUNS) runs = MAX_RUNS;
+  mkdir(WORKDIR, 0755);
+
+  printf("%-14s %10s %12s %10s %9s   (%d runs, %.1f%% tolerance)\n",
+         "case", "lines/s", "bytes/s", "peak", "size", runs, tolerance);
+  failures = 0;
+  for (n = 0; cases[n].name; n++) {
+    run_case(&cases[n], &results[n]);
+    if (update) {
+      print_result(&results[n], "");
+    } else {
+      failures += compare(&results[n]);
+    }
+  }
+
+  if (update) {
+    write_baseline(results, n);
+    printf("baseline written to %s\n", baseline);
+    return 0;
+  }
+
+  if (failures) {
+    printf("%d benchmark regressions or missing baseline entries\n", failures);
+    return 1;
+  }
+  return 0;
+}
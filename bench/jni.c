@@ -0,0 +1,7 @@
+// Benchmark translation unit: Java native interface
+
+#include <java/jni.h>
+
+jint bench_jni(JNIEnv *env) {
+  return (*env)->GetVersion(env);
+}
@@ -0,0 +1,288 @@
+//
+//  kbench.c - Generated-code benchmark for the Tiny C Compiler for Sanos
+//
+//  Compiles the kernels in bench/kernels.c with the compiler under test
+//  and runs them. For each kernel the code size taken from the symbol
+//  table of the object file and the checksum are compared against a stored
+//  baseline. The program fails if any kernel got bigger by more than the
+//  tolerance, computes a different result, or has no baseline entry.
+//  Cycle counts depend on the machine and are only reported.
+//
+//  usage: kbench [-c compiler] [-f flags] [-n runs] [-t tolerance] [-b baseline] [-u]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../cc/elf.h"
+
+#define MAX_KERNELS 32
+
+#define WORKDIR   "bench/out"
+#define KERNELS   "bench/kernels.c"
+#define OBJFILE   WORKDIR "/kernels.o"
+#define EXEFILE   WORKDIR "/kernels.exe"
+#define RESULTS   WORKDIR "/kernels.txt"
+
+struct kernel_result {
+  char name[32];
+  double cycles;
+  long code_size;
+  unsigned int checksum;
+};
+
+static const char *compiler = "cc";
+static const char *flags = "";
+static const char *baseline = "bench/kbaseline.txt";
+static int runs = 3;
+static double tolerance = 10.0;
+static int update = 0;
+
+static void usage(void) {
+  fprintf(stderr, "usage: kbench [-c compiler] [-f flags] [-n runs] [-t tolerance] [-b baseline] [-u]\n");
+  exit(1);
+}
+
+static void fatal(const char *msg, const char *arg) {
+  fprintf(stderr, "kbench: %s %s\n", msg, arg ? arg : "");
+  exit(1);
+}
+
+static void run(const char *cmd) {
+  if (system(cmd) != 0) fatal("command failed:", cmd);
+}
+
+static char *read_file(const char *filename, long *size) {
+  FILE *f;
+  char *buf;
+
+  f = fopen(filename, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(*size + 1);
+  if (!buf) fatal("out of memory", NULL);
+  *size = fread(buf, 1, *size, f);
+  buf[*size] = 0;
+  fclose(f);
+  return buf;
+}
+
+//
+// Code size
+//
+
+// Return the code size of kernel 'name', which is the size of the function
+// k_name and its helper functions k_name_*
+static long code_size(char *obj, long size, const char *name) {
+  Elf32_Ehdr *ehdr;
+  Elf32_Shdr *shdr, *symtab;
+  Elf32_Sym *sym, *end;
+  const char *strtab, *symname;
+  char prefix[40];
+  long total;
+  int i, len;
+
+  ehdr = (Elf32_Ehdr *) obj;
+  if (size < sizeof(Elf32_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
+    fatal("not an ELF object file:", OBJFILE);
+  }
+  shdr = (Elf32_Shdr *) (obj + ehdr->e_shoff);
+  symtab = NULL;
+  for (i = 0; i < ehdr->e_shnum; i++) {
+    if (shdr[i].sh_type == SHT_SYMTAB) symtab = &shdr[i];
+  }
+  if (!symtab) fatal("no symbol table in", OBJFILE);
+  strtab = obj + shdr[symtab->sh_link].sh_offset;
+
+  snprintf(prefix, sizeof(prefix), "k_%s", name);
+  len = strlen(prefix);
+  total = 0;
+  sym = (Elf32_Sym *) (obj + symtab->sh_offset);
+  end = (Elf32_Sym *) (obj + symtab->sh_offset + symtab->sh_size);
+  for (; sym < end; sym++) {
+    if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC) continue;
+    symname = strtab + sym->st_name;
+    if (strncmp(symname, prefix, len) != 0) continue;
+    if (symname[len] == 0 || symname[len] == '_') total += sym->st_size;
+  }
+  return total;
+}
+
+//
+// Running the kernels
+//
+
+static int run_kernels(struct kernel_result *results) {
+  char cmd[1024], line[256], name[32];
+  struct kernel_result *r;
+  char *obj;
+  long size;
+  double cycles;
+  unsigned int checksum;
+  FILE *f;
+  int i, n;
+
+  snprintf(cmd, sizeof(cmd), "%s %s -Iinclude -c -o %s %s", compiler, flags, OBJFILE, KERNELS);
+  run(cmd);
+  snprintf(cmd, sizeof(cmd), "%s %s -Iinclude -o %s %s", compiler, flags, EXEFILE, KERNELS);
+  run(cmd);
+
+  // Keep the fastest time for each kernel over all runs
+  n = 0;
+  snprintf(cmd, sizeof(cmd), "%s > %s", EXEFILE, RESULTS);
+  for (i = 0; i < runs; i++) {
+    run(cmd);
+    f = fopen(RESULTS, "r");
+    if (!f) fatal("no output from", EXEFILE);
+    while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "%31s %lf %u", name, &cycles, &checksum) != 3) continue;
+      for (r = results; r < results + n; r++) {
+        if (!strcmp(r->name, name)) break;
+      }
+      if (r == results + n) {
+        if (n == MAX_KERNELS) continue;
+        n++;
+        memset(r, 0, sizeof(struct kernel_result));
+        strcpy(r->name, name);
+        r->cycles = cycles;
+      }
+      if (cycles < r->cycles) r->cycles = cycles;
+      r->checksum = checksum;
+    }
+    fclose(f);
+  }
+
+  obj = read_file(OBJFILE, &size);
+  if (!obj) fatal("cannot read", OBJFILE);
+  for (i = 0; i < n; i++) results[i].code_size = code_size(obj, size, results[i].name);
+  free(obj);
+  return n;
+}
+
+//
+// Baseline handling
+//
+
+static int find_baseline(const char *name, struct kernel_result *b) {
+  FILE *f;
+  char line[256];
+
+  f = fopen(baseline, "r");
+  if (!f) return 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "%31s %lf %ld %u", b->name, &b->cycles, &b->code_size, &b->checksum) != 4) continue;
+    if (!strcmp(b->name, name)) {
+      fclose(f);
+      return 1;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+static void write_baseline(struct kernel_result *results, int n) {
+  FILE *f;
+  int i;
+
+  f = fopen(baseline, "w");
+  if (!f) fatal("cannot write", baseline);
+  fprintf(f, "# Generated-code benchmark baseline, written by 'make kbench-baseline'\n");
+  fprintf(f, "# kernel cycles/iteration code-size checksum\n");
+  for (i = 0; i < n; i++) {
+    fprintf(f, "%s %.2f %ld %u\n", results[i].name,
+            results[i].cycles, results[i].code_size, results[i].checksum);
+  }
+  fclose(f);
+}
+
+// Return percentage change from baseline value 'b' to 'v'
+static double change(double v, double b) {
+  if (b == 0.0) return 0.0;
+  return (v - b) * 100.0 / b;
+}
+
+static void print_result(struct kernel_result *r, const char *note) {
+  printf("%-12s %12.2f %9ld %11u   %s\n", r->name, r->cycles, r->code_size, r->checksum, note);
+}
+
+static int compare(struct kernel_result *r) {
+  struct kernel_result b;
+  double dc, ds;
+  const char *note;
+
+  if (!find_baseline(r->name, &b)) {
+    print_result(r, "NO BASELINE");
+    return 1;
+  }
+
+  // Kernels must compute the same result and not get bigger. The change in
+  // cycles is shown for information only.
+  dc = change(r->cycles, b.cycles);
+  ds = change((double) r->code_size, (double) b.code_size);
+  note = "";
+  if (r->checksum != b.checksum) {
+    note = "  WRONG RESULT";
+  } else if (ds > tolerance) {
+    note = "  REGRESSION";
+  }
+  printf("%-12s %12.2f %9ld %11u   %+6.1f%% %+6.1f%%%s\n", r->name,
+         r->cycles, r->code_size, r->checksum, dc, ds, note);
+  return *note != 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct kernel_result results[MAX_KERNELS];
+  int i, n, failures;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      compiler = argv[++i];
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      flags = argv[++i];
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      runs = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (!strcmp(argv[i], "-u")) {
+      update = 1;
+    } else {
+      usage();
+    }
+  }
+  if (runs < 1) runs = 1;
+  mkdir(WORKDIR, 0755);
+
+  n = run_kernels(results);
+  if (n == 0) fatal("no results from", EXEFILE);
+
+  printf("%-12s %12s %9s %11s   (%d runs, %.1f%% tolerance)\n",
+         "kernel", "cycles/iter", "size", "checksum", runs, tolerance);
+  failures = 0;
+  for (i = 0; i < n; i++) {
+    if (update) {
+      print_result(&results[i], "");
+    } else {
+      failures += compare(&results[i]);
+    }
+  }
+
+  if (update) {
+    write_baseline(results, n);
+    printf("baseline written to %s\n", baseline);
+    return 0;
+  }
+
+  if (failures) {
+    printf("%d kernel regressions\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,278 @@
+//
+//  kernels.c - Generated-code benchmark kernels
+//
+//  Compiled by the compiler under test and run by kbench. Every kernel
+//  is run a number of times and the fastest run is reported as cycles per
+//  iteration together with a checksum of the result:
+//
+//    name cycles checksum
+//
+//  The code of kernel 'x' is the function k_x and its helpers k_x_*, so
+//  kbench can find the code size of each kernel in the symbol table.
+//
+//  The driver only uses write(), so it also runs as a statically linked
+//  Linux executable with the runtime built into the compiler.
+//
+//  usage: kernels [kernel]
+//
+
+#include <string.h>
+#include <unistd.h>
+
+#define TRIALS 7
+
+static unsigned long long rdtsc(void) {
+  unsigned long long t;
+  __asm__ __volatile__("rdtsc" : "=A" (t));
+  return t;
+}
+
+//
+// Integer hashing
+//
+
+unsigned int k_hash(int n) {
+  unsigned int h = 2166136261u;
+  unsigned int x;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    x = i * 0x9e3779b1;
+    x ^= x >> 15;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    h = (h ^ x) * 16777619;
+  }
+  return h;
+}
+
+//
+// Struct passing and copying
+//
+
+struct k_struct_record {
+  int key;
+  int value[15];
+};
+
+static struct k_struct_record k_struct_update(struct k_struct_record r, int k) {
+  r.key += k;
+  r.value[k & 7] ^= r.key;
+  r.value[14] += r.value[k & 7];
+  return r;
+}
+
+unsigned int k_struct(int n) {
+  struct k_struct_record r, table[8];
+  int i;
+
+  memset(&r, 0, sizeof(r));
+  memset(table, 0, sizeof(table));
+  for (i = 0; i < n; i++) {
+    r = k_struct_update(r, i);
+    table[i & 7] = r;
+  }
+  return table[3].key + table[5].value[2] + table[7].value[14];
+}
+
+//
+// Switch dispatch in a byte code interpreter
+//
+
+static const unsigned char k_switch_program[16] = {
+  0, 3, 1, 4, 2, 7, 5, 9, 6, 8, 1, 0, 3, 2, 9, 4
+};
+
+unsigned int k_switch(int n) {
+  unsigned int acc = 1;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    switch (k_switch_program[i & 15]) {
+      case 0: acc += i; break;
+      case 1: acc ^= i; break;
+      case 2: acc -= 3; break;
+      case 3: acc <<= 1; break;
+      case 4: acc >>= 1; break;
+      case 5: acc *= 5; break;
+      case 6: acc |= 0x100; break;
+      case 7: acc &= 0xffffff; break;
+      case 8: acc = ~acc; break;
+      case 9: acc += acc >> 7; break;
+    }
+  }
+  return acc;
+}
+
+//
+// Floating point loops
+//
+
+static double k_float_x[256], k_float_y[256];
+
+unsigned int k_float(int n) {
+  double sum = 0.0;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    k_float_x[i] = i * 0.25;
+    k_float_y[i] = 1.0 / (i + 1);
+  }
+  for (i = 0; i < n; i++) {
+    j = i & 255;
+    sum += k_float_x[j] * k_float_y[j];
+    k_float_y[j] = k_float_y[j] * 0.5 + 0.001;
+  }
+  return (unsigned int) sum;
+}
+
+//
+// 64-bit arithmetic
+//
+
+unsigned int k_int64(int n) {
+  unsigned long long a = 0x123456789abcdefULL;
+  unsigned long long s = 0;
+  long long d = -1;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    a = a * 6364136223846793005ULL + 1442695040888963407ULL;
+    s += a >> 33;
+    s ^= a / ((i & 255) + 1);
+    d = d * 3 - (long long) (a % 1000);
+    d >>= 1;
+  }
+  return (unsigned int) (s ^ (s >> 32)) + (unsigned int) d;
+}
+
+//
+// String scanning
+//
+
+static const char k_string_text[] =
+  "The quick brown fox jumps over the lazy dog. Pack my box with five dozen "
+  "liquor jugs! How vexingly quick daft zebras jump; sphinx of black quartz, "
+  "judge my vow.\tThe five boxing wizards jump quickly.\n";
+
+unsigned int k_string(int n) {
+  const char *p;
+  unsigned int words, upper, sum;
+  int i, inword;
+
+  words = upper = sum = 0;
+  for (i = 0; i < n; i++) {
+    inword = 0;
+    for (p = k_string_text; *p; p++) {
+      if (*p == ' ' || *p == '\t' || *p == '\n') {
+        inword = 0;
+      } else {
+        if (!inword) words++;
+        inword = 1;
+        if (*p >= 'A' && *p <= 'Z') upper++;
+        sum = sum * 31 + *p;
+      }
+    }
+  }
+  return words + upper + sum;
+}
+
+//
+// Recursion
+//
+
+static int k_recursion_fib(int n) {
+  return n < 2 ? n : k_recursion_fib(n - 1) + k_recursion_fib(n - 2);
+}
+
+unsigned int k_recursion(int n) {
+  unsigned int sum = 0;
+  int i;
+
+  for (i = 0; i < n; i++) sum += k_recursion_fib(15 + (i & 1));
+  return sum;
+}
+
+//
+// Driver
+//
+
+struct kernel {
+  const char *name;
+  unsigned int (*func)(int n);
+  int iterations;
+};
+
+static struct kernel kernels[] = {
+  { "hash", k_hash, 1000000 },
+  { "struct", k_struct, 100000 },
+  { "switch", k_switch, 1000000 },
+  { "float", k_float, 1000000 },
+  { "int64", k_int64, 200000 },
+  { "string", k_string, 10000 },
+  { "recursion", k_recursion, 1000 },
+  { NULL }
+};
+
+static int same(const char *a, const char *b) {
+  while (*a && *a == *b) a++, b++;
+  return *a == *b;
+}
+
+static char *put_str(char *p, const char *s) {
+  while (*s) *p++ = *s++;
+  return p;
+}
+
+static char *put_num(char *p, unsigned long long n, int digits) {
+  char buf[24];
+  int i = 0;
+
+  do {
+    buf[i++] = '0' + (int) (n % 10);
+    n /= 10;
+  } while (n || i < digits);
+  while (i > 0) *p++ = buf[--i];
+  return p;
+}
+
+// Print "name cycles checksum" with the cycles per iteration rounded to
+// two decimals
+static void report(const char *name, unsigned long long cycles, int iterations, unsigned int checksum) {
+  char line[128], *p;
+  unsigned long long hundredths;
+
+  hundredths = (cycles * 100 + iterations / 2) / iterations;
+  p = put_str(line, name);
+  *p++ = ' ';
+  p = put_num(p, hundredths / 100, 1);
+  *p++ = '.';
+  p = put_num(p, hundredths % 100, 2);
+  *p++ = ' ';
+  p = put_num(p, checksum, 1);
+  *p++ = '\n';
+  write(1, line, p - line);
+}
+
+int main(int argc, char *argv[]) {
+  struct kernel *k;
+  unsigned long long start, cycles, best;
+  unsigned int checksum;
+  int i;
+
+  for (k = kernels; k->name; k++) {
+    if (argc > 1 && !same(argv[1], k->name)) continue;
+
+    // The first run warms up the caches and is not counted
+    checksum = k->func(k->iterations);
+    best = 0;
+    for (i = 0; i < TRIALS; i++) {
+      start = rdtsc();
+      k->func(k->iterations);
+      cycles = rdtsc() - start;
+      if (best == 0 || cycles < best) best = cycles;
+    }
+    report(k->name, best, k->iterations, checksum);
+  }
+  return 0;
+}
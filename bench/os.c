@@ -0,0 +1,8 @@
+// Benchmark translation unit: Sanos kernel API header
+
+#include <os.h>
+
+int bench_os(void) {
+  struct tib *tib = gettib();
+  return tib->tid;
+}
@@ -0,0 +1,8 @@
+// Benchmark translation unit: Win32 definitions
+
+#include <os.h>
+#include <win32.h>
+
+DWORD bench_win32(DWORD a, DWORD b) {
+  return a + b;
+}
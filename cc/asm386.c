@@ -536,7 +536,7 @@ static void parse_masm_operand(TCCState *s1, Operand *op) {
 
 void gen_expr32(ExprValue *pe) {
   if (pe->sym) {
-    greloc(pe->sym, pe->v, 0);
+    greloc(pe->sym, pe->v, R_386_32);
   } else {
     gen_le32(pe->v);
   }
@@ -547,10 +547,10 @@ void gen_disp32(ExprValue *pe) {
 
   sym = pe->sym;
   if (sym) {
-    greloc(sym, pe->v - 4, 1);
+    greloc(sym, pe->v - 4, R_386_PC32);
   } else {
     // put an empty relocation
-    greloc(NULL, pe->v - 4, 1);
+    greloc(NULL, pe->v - 4, R_386_PC32);
   }
 }
 
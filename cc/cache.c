@@ -0,0 +1,277 @@
+//
+//  cache.c - Tiny C Compiler for Sanos
+//
+//  Copyright (c) 2011-2012 Michael Ringgaard
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "cc.h"
+#include <sys/stat.h>
+
+// Object file cache (-fcache-dir=dir).
+//
+// A translation unit is identified by a 128-bit hash of its preprocessed
+// token stream and the options that affect the generated code. On a hit
+// the cached object file is loaded instead of compiling the file. On a
+// miss the object file written by the driver is copied into the cache.
+// Warnings from the compilation are kept in a .msg file next to the object
+// file and printed again on a hit. Entries are written to a temporary file
+// and renamed into place, so a concurrent compiler never sees a partial
+// object file.
+
+typedef struct CacheHash {
+  unsigned long long h1;
+  unsigned long long h2;
+} CacheHash;
+
+static void hash_bytes(CacheHash *h, const void *data, int size) {
+  const unsigned char *p = data;
+
+  while (size-- > 0) {
+    h->h1 = (h->h1 ^ *p) * 0x100000001b3ULL;
+    h->h2 = (h->h2 + *p) * 0x9e3779b97f4a7c15ULL;
+    h->h2 ^= h->h2 >> 29;
+    p++;
+  }
+}
+
+static void hash_int(CacheHash *h, int value) {
+  hash_bytes(h, &value, sizeof(int));
+}
+
+static void hash_str(CacheHash *h, const char *str) {
+  hash_bytes(h, str, strlen(str) + 1);
+}
+
+static void hash_file(CacheHash *h, const char *filename) {
+  char buf[1024];
+  FILE *f;
+  int n;
+
+  hash_str(h, filename);
+  f = fopen(filename, "rb");
+  if (!f) return;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) hash_bytes(h, buf, n);
+  fclose(f);
+}
+
+// Hash the compiler version and the options that change the object file
+// or the warnings for the same token stream
+static void hash_options(TCCState *s1, CacheHash *h) {
+  char buf[1024];
+
+  hash_str(h, "cc " TCC_VERSION " " __DATE__ " " __TIME__);
+  hash_int(h, do_debug);
+  hash_int(h, s1->nofll);
+  hash_int(h, s1->nocommon);
+  hash_int(h, s1->char_is_unsigned);
+  hash_int(h, s1->leading_underscore);
+  hash_int(h, s1->auto_regparm);
+  hash_int(h, s1->align_functions);
+  hash_int(h, s1->align_loops);
+  hash_int(h, s1->merge_strings);
+  hash_int(h, s1->profile_generate);
+  hash_int(h, s1->instrument_functions);
+  hash_int(h, s1->profile_mcount);
+  if (s1->profile_use) hash_file(h, s1->profile_use);
+  hash_int(h, s1->warn_write_strings);
+  hash_int(h, s1->warn_unsupported);
+  hash_int(h, s1->warn_error);
+  hash_int(h, s1->warn_none);
+  hash_int(h, s1->warn_implicit_function_declaration);
+
+  // Debug information has the working directory
+  if (do_debug && getcwd(buf, sizeof(buf))) hash_str(h, buf);
+}
+
+// Hash the preprocessed token stream of the current file
+static int hash_tokens(TCCState *s1, CacheHash *h) {
+  Sym *define_start;
+  const char *str;
+  char *filename;
+  int pack;
+
+  preprocess_init(s1);
+  define_start = define_stack;
+  if (setjmp(s1->error_jmp_buf) == 0) {
+    s1->nb_errors = 0;
+    s1->error_set_jmp_enabled = 1;
+
+    ch = file->buf_ptr[0];
+    tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
+    parse_flags = PARSE_FLAG_PREPROCESS;
+    pack = 0;
+    filename = "";
+    next();
+    while (tok != TOK_EOF) {
+      // #pragma pack is consumed by the preprocessor
+      if (*s1->pack_stack_ptr != pack) {
+        pack = *s1->pack_stack_ptr;
+        hash_str(h, "#pragma pack");
+        hash_int(h, pack);
+      }
+
+      // Line numbers only matter for debug information
+      if (do_debug) {
+        if (strcmp(file->filename, filename) != 0) {
+          filename = file->filename;
+          hash_str(h, filename);
+        }
+        hash_int(h, file->line_num);
+      }
+
+      str = get_tok_str(tok, &tokc);
+      hash_str(h, str);
+      next();
+    }
+  }
+  s1->error_set_jmp_enabled = 0;
+  free_defines(define_start);
+  return s1->nb_errors != 0 ? -1 : 0;
+}
+
+// Name of the file with the diagnostics for cache entry 'entry'
+static void diag_path(char *buf, int size, const char *entry) {
+  pstrcpy(buf, size, entry);
+  *tcc_fileextension(buf) = 0;
+  pstrcat(buf, size, ".msg");
+}
+
+// Print diagnostics kept as a sequence of null-terminated messages
+static void print_diagnostics(TCCState *s1, const char *msgs, int size) {
+  const char *p, *end;
+
+  end = msgs + size;
+  for (p = msgs; p < end; p += strlen(p) + 1) print_diagnostic(s1, p);
+}
+
+// Print the diagnostics from the compilation that made cache entry 'entry'
+static void replay_diagnostics(TCCState *s1, const char *entry) {
+  char name[1024];
+  char *msgs;
+  FILE *f;
+  int size;
+
+  diag_path(name, sizeof(name), entry);
+  f = fopen(name, "rb");
+  if (!f) return;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  msgs = tcc_malloc(size + 1);
+  size = fread(msgs, 1, size, f);
+  msgs[size] = 0;
+  fclose(f);
+  print_diagnostics(s1, msgs, size);
+  tcc_free(msgs);
+}
+
+// Compile the current file or load its object file from the cache
+int cache_compile(TCCState *s1, const char *filename) {
+  CacheHash h;
+  char path[1024];
+  int fd, ret, phase, lines;
+
+  phase = bench_phase(BENCH_PREPROCESS);
+  lines = total_lines;
+  h.h1 = 0xcbf29ce484222325ULL;
+  h.h2 = 0;
+  hash_options(s1, &h);
+
+  // Preprocessor warnings are printed by the compilation or replayed from
+  // the cache, so they are only collected while hashing
+  cstr_reset(&s1->cache_diag);
+  s1->cache_log = CACHE_LOG_QUIET;
+  ret = hash_tokens(s1, &h);
+  s1->cache_log = 0;
+  bench_phase(phase);
+  if (ret < 0) {
+    print_diagnostics(s1, s1->cache_diag.data, s1->cache_diag.size);
+    return ret;
+  }
+
+  snprintf(path, sizeof(path), "%s/%08x%08x%08x%08x.o", s1->cache_dir,
+           (unsigned int) (h.h1 >> 32), (unsigned int) h.h1,
+           (unsigned int) (h.h2 >> 32), (unsigned int) h.h2);
+  fd = open(path, O_RDONLY | O_BINARY);
+  if (fd >= 0) {
+    bench_phase(BENCH_LOAD);
+    ret = tcc_load_object_file(s1, fd, 0);
+    close(fd);
+    if (ret == 0) replay_diagnostics(s1, path);
+    bench_phase(phase);
+    return ret;
+  }
+
+  // Compile the file from the start and keep its diagnostics for the
+  // cache entry. Its lines are only counted once.
+  tcc_close(file);
+  total_lines = lines;
+  file = tcc_open(s1, filename);
+  if (!file) error("file '%s' not found", filename);
+  cstr_reset(&s1->cache_diag);
+  s1->cache_log = CACHE_LOG;
+  ret = tcc_compile(s1);
+  s1->cache_log = 0;
+  if (ret == 0) s1->cache_entry = tcc_strdup(path);
+  return ret;
+}
+
+// Write cache file 'name' from file 'in' or from 'size' bytes at 'data'.
+// The file is written to a temporary file and renamed into place.
+static int store_file(const char *name, FILE *in, const void *data, int size) {
+  char tmpname[1024], buf[4096];
+  FILE *out;
+  int n, ok;
+
+  snprintf(tmpname, sizeof(tmpname), "%s.%d", name, getpid());
+  out = fopen(tmpname, "wb");
+  if (!out) return -1;
+  ok = 1;
+  if (in) {
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+      if (fwrite(buf, 1, n, out) != n) ok = 0;
+    }
+    if (ferror(in)) ok = 0;
+  } else if (fwrite(data, 1, size, out) != size) {
+    ok = 0;
+  }
+  if (fclose(out) != 0) ok = 0;
+  if (!ok || rename(tmpname, name) != 0) {
+    unlink(tmpname);
+    return -1;
+  }
+  return 0;
+}
+
+// Copy the object file for a cache miss into the cache together with the
+// diagnostics from compiling it. The diagnostics are stored first, so a
+// cache hit always finds them.
+void cache_store(TCCState *s1, const char *objfile) {
+  char name[1024];
+  FILE *in;
+
+  if (!s1->cache_entry) return;
+  mkdir(s1->cache_dir, 0777);
+  if (s1->cache_diag.size > 0) {
+    diag_path(name, sizeof(name), s1->cache_entry);
+    if (store_file(name, NULL, s1->cache_diag.data, s1->cache_diag.size) < 0) return;
+  }
+  in = fopen(objfile, "rb");
+  if (!in) return;
+  store_file(s1->cache_entry, in, NULL, 0);
+  fclose(in);
+}
@@ -36,11 +36,12 @@ int tok_ident;
 // Path to the C runtime libraries
 const char *tcc_lib_path = CONFIG_TCCDIR;
 
-// Display benchmark infos
-static int do_bench = 0;
+// Display benchmark infos (1 = text, 2 = JSON)
+int do_bench = 0;
 
 #define WD_ALL            0x0001  // Warning is activated when using -Wall
 #define FD_INVERT         0x0002  // Invert value before storing
+#define FD_ALIGN          0x0004  // Flag is an alignment given as -fflag=n
 
 typedef struct FlagDef {
   uint16_t offset;
@@ -60,6 +61,12 @@ static const FlagDef flag_defs[] = {
   { offsetof(TCCState, char_is_unsigned), FD_INVERT, "signed-char" },
   { offsetof(TCCState, nocommon), FD_INVERT, "common" },
   { offsetof(TCCState, leading_underscore), 0, "leading-underscore" },
+  { offsetof(TCCState, merge_strings), 0, "merge-strings" },
+  { offsetof(TCCState, auto_regparm), 0, "auto-regparm" },
+  { offsetof(TCCState, align_functions), FD_ALIGN, "align-functions" },
+  { offsetof(TCCState, align_loops), FD_ALIGN, "align-loops" },
+  { offsetof(TCCState, profile_generate), 0, "profile-generate" },
+  { offsetof(TCCState, instrument_functions), 0, "instrument-functions" },
 };
 
 #define TCC_OPTION_HAS_ARG 0x0001
@@ -89,6 +96,7 @@ enum {
   TCC_OPTION_fixed,
   TCC_OPTION_filealign,
   TCC_OPTION_stub,
+  TCC_OPTION_threads,
   TCC_OPTION_def,
   TCC_OPTION_o,
   TCC_OPTION_r,
@@ -97,11 +105,16 @@ enum {
   TCC_OPTION_m,
   TCC_OPTION_f,
   TCC_OPTION_nofll,
+  TCC_OPTION_pg,
+  TCC_OPTION_icf,
+  TCC_OPTION_incremental,
+  TCC_OPTION_symbol_ordering_file,
   TCC_OPTION_noshare,
   TCC_OPTION_nostdinc,
   TCC_OPTION_nostdlib,
   TCC_OPTION_print_search_dirs,
   TCC_OPTION_rdynamic,
+  TCC_OPTION_run,
   TCC_OPTION_v,
   TCC_OPTION_w,
   TCC_OPTION_E,
@@ -116,7 +129,7 @@ static const TCCOption tcc_options[] = {
   { "L", TCC_OPTION_L, TCC_OPTION_HAS_ARG },
   { "B", TCC_OPTION_B, TCC_OPTION_HAS_ARG },
   { "l", TCC_OPTION_l, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
-  { "bench", TCC_OPTION_bench, 0 },
+  { "bench", TCC_OPTION_bench, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
   { "g", TCC_OPTION_g, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
   { "c", TCC_OPTION_c, 0 },
   { "static", TCC_OPTION_static, 0 },
@@ -126,15 +139,21 @@ static const TCCOption tcc_options[] = {
   { "fixed", TCC_OPTION_fixed, TCC_OPTION_HAS_ARG },
   { "filealign", TCC_OPTION_filealign, TCC_OPTION_HAS_ARG },
   { "stub", TCC_OPTION_stub, TCC_OPTION_HAS_ARG },
+  { "threads", TCC_OPTION_threads, TCC_OPTION_HAS_ARG },
   { "def", TCC_OPTION_def, TCC_OPTION_HAS_ARG },
   { "o", TCC_OPTION_o, TCC_OPTION_HAS_ARG },
   { "rdynamic", TCC_OPTION_rdynamic, 0 },
+  { "run", TCC_OPTION_run, 0 },
   { "r", TCC_OPTION_r, 0 },
   { "Wl,", TCC_OPTION_Wl, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
   { "W", TCC_OPTION_W, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
   { "m", TCC_OPTION_m, TCC_OPTION_HAS_ARG },
   { "f", TCC_OPTION_f, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP },
   { "nofll", TCC_OPTION_nofll, 0 },
+  { "pg", TCC_OPTION_pg, 0 },
+  { "-icf", TCC_OPTION_icf, 0 },
+  { "-incremental", TCC_OPTION_incremental, 0 },
+  { "-symbol-ordering-file", TCC_OPTION_symbol_ordering_file, TCC_OPTION_HAS_ARG },
   { "noshare", TCC_OPTION_noshare, 0 },
   { "nostdinc", TCC_OPTION_nostdinc, 0 },
   { "nostdlib", TCC_OPTION_nostdlib, 0 },
@@ -154,7 +173,7 @@ static int reloc_output;
 static const char *outfile;
 
 static int set_flag(TCCState *s, const FlagDef *flags, int nb_flags, const char *name, int value) {
-  int i;
+  int i, n;
   const FlagDef *p;
   const char *r;
 
@@ -164,10 +183,20 @@ static int set_flag(TCCState *s, const FlagDef *flags, int nb_flags, const char
     value = !value;
   }
   for (i = 0, p = flags; i < nb_flags; i++, p++) {
-    if (!strcmp(r, p->name)) goto found;
+    n = strlen(p->name);
+    if (strncmp(r, p->name, n)) continue;
+    if (r[n] == '\0') goto found;
+    if (r[n] == '=' && (p->flags & FD_ALIGN) && value) goto found;
   }
   return -1;
  found:
+  if ((p->flags & FD_ALIGN) && value) {
+    // Align to 16 bytes if no value is given
+    value = r[n] == '=' ? atoi(r + n + 1) : 16;
+    if (value <= 0 || (value & (value - 1)) != 0 || value > ALIGN_LIMIT) {
+      error("invalid alignment in '-f%s'", name);
+    }
+  }
   if (p->flags & FD_INVERT) value = !value;
   *(int *)((uint8_t *) s + p->offset) = value;
   return 0;
@@ -194,7 +223,7 @@ int tcc_set_flag(TCCState *s, const char *flag_name, int value) {
   return set_flag(s, flag_defs, countof(flag_defs), flag_name, value);
 }
 
-static int64_t getclock_us(void) {	// dcm: intriguing - could have put gettimeofday() into sow.c & got rid of this platform-specific code
+int64_t getclock_us(void) {	// dcm: intriguing - could have put gettimeofday() into sow.c & got rid of this platform-specific code
 #ifdef _WIN32
   struct _timeb tb;
   _ftime(&tb);
@@ -206,22 +235,125 @@ static int64_t getclock_us(void) {	// dcm: intriguing - could have put gettimeof
 #endif
 }
 
+// Time spent in each phase of the compilation. Phases switch very often
+// (every token), so the time stamp counter is used where available and
+// converted to seconds using the wall clock time for the whole run.
+static const char *bench_names[BENCH_PHASES] = {
+  "other", "preprocess", "parse", "gcode", "load", "gc", "link", "relocate", "write"
+};
+
+static int64_t bench_ticks[BENCH_PHASES];
+static int64_t bench_start_ticks;
+static int64_t bench_last_ticks;
+static int64_t bench_start_time;
+static int bench_cur_phase;
+
+static int64_t bench_clock(void) {
+#ifdef __i386__
+  int64_t t;
+  __asm__ __volatile__ ("rdtsc" : "=A" (t));
+  return t;
+#else
+  return getclock_us();
+#endif
+}
+
+static void bench_start(void) {
+  bench_start_time = getclock_us();
+  bench_start_ticks = bench_last_ticks = bench_clock();
+  bench_cur_phase = BENCH_OTHER;
+}
+
+// Switch to a new phase and return the previous one
+int bench_phase(int phase) {
+  int64_t now;
+  int prev;
+
+  prev = bench_cur_phase;
+  if (!do_bench || phase == prev) return prev;
+  now = bench_clock();
+  bench_ticks[prev] += now - bench_last_ticks;
+  bench_last_ticks = now;
+  bench_cur_phase = phase;
+  return prev;
+}
+
+static void bench_report(TCCState *s) {
+  double total_time, ticks_per_sec, t;
+  int64_t total_ticks;
+  int i, nb_syms;
+
+  bench_phase(BENCH_OTHER);
+  total_time = (double) (getclock_us() - bench_start_time) / 1000000.0;
+  if (total_time < 0.001) total_time = 0.001;
+  total_ticks = bench_last_ticks - bench_start_ticks;
+  ticks_per_sec = total_ticks > 0 ? total_ticks / total_time : 1.0;
+  if (total_bytes < 1) total_bytes = 1;	// dcm: total_bytes updated by preproc.c
+  nb_syms = symtab_section->data_offset / sizeof(Elf32_Sym);
+
+  if (do_bench == 2) {
+    printf("{\n");
+    printf("  \"idents\": %d,\n", tok_ident - TOK_IDENT);
+    printf("  \"lines\": %d,\n", total_lines);
+    printf("  \"bytes\": %d,\n", total_bytes);
+    printf("  \"time\": %0.6f,\n", total_time);
+    printf("  \"lines_per_sec\": %d,\n", (int) (total_lines / total_time));
+    printf("  \"bytes_per_sec\": %d,\n", (int) (total_bytes / total_time));
+    printf("  \"phases\": {\n");
+    for (i = 0; i < BENCH_PHASES; i++) {
+      printf("    \"%s\": %0.6f%s\n", bench_names[i], bench_ticks[i] / ticks_per_sec, 
+             i < BENCH_PHASES - 1 ? "," : "");
+    }
+    printf("  },\n");
+    printf("  \"memory\": {\n");
+    printf("    \"current\": %d,\n", mem_cur_size);
+    printf("    \"peak\": %d,\n", mem_max_size);
+    printf("    \"allocs\": %d,\n", mem_allocs);
+    printf("    \"frees\": %d\n", mem_frees);
+    printf("  },\n");
+    printf("  \"symbols\": %d,\n", nb_syms);
+    printf("  \"sections\": %d\n", s->nb_sections - 1);
+    printf("}\n");
+  } else {
+    printf("%d idents, %d lines, %d bytes, %0.3f s, %d lines/s, %0.1f MB/s\n", 
+           tok_ident - TOK_IDENT, total_lines, total_bytes,
+           total_time, (int)(total_lines / total_time), 
+           total_bytes / total_time / 1000000.0); 
+    for (i = 0; i < BENCH_PHASES; i++) {
+      t = bench_ticks[i] / ticks_per_sec;
+      printf("  %-12s %8.3f s %5.1f%%\n", bench_names[i], t, t * 100.0 / total_time);
+    }
+    printf("memory: %d bytes, max = %d bytes, %d allocs, %d frees\n", 
+           mem_cur_size, mem_max_size, mem_allocs, mem_frees);
+    printf("%d symbols, %d sections\n", nb_syms, s->nb_sections - 1);
+  }
+}
+
 void help(void) {
   printf("tcc version " TCC_VERSION " - Tiny C Compiler - Copyright (C) 2001-2006 Fabrice Bellard\n"
       "usage: cc [-v] [-c] [-o outfile] [-Bdir] [-bench] [-Idir] [-Dsym[=val]] [-Usym]\n"
       "          [-Wwarn] [-g] [-Ldir] [-llib] [-shared] [-soname name]\n"
-      "          [-static] [infile1 infile2...]\n"
+      "          [-static] [infile1 infile2...] [-run infile args...]\n"
       "\n"
       "General options:\n"
       "  -v           display current version, increase verbosity\n"
       "  -c           compile only - generate an object file\n"
+      "  -run         compile and run infile in memory with the arguments that follow\n"
       "  -o outfile   set output filename\n"
       "  -B dir       set tcc internal library path\n"
       "  -bench       output compilation statistics\n"
+      "  -bench=json  output compilation statistics in JSON format\n"
       "  -fflag       set or reset (with 'no-' prefix) 'flag' (see man page)\n"
       "  -Wwarning    set or reset (with 'no-' prefix) 'warning' (see man page)\n"
       "  -w           disable all warnings\n"
-      "  -g           generate runtime debug info\n"
+      "  -g           generate runtime debug info with compact line tables\n"
+      "  -gstabs      generate runtime debug info with a stab for each line\n"
+      "  -fprofile-generate[=file]  instrument code to write an execution profile\n"
+      "  -fprofile-use=file  use execution profile to lay out code and functions\n"
+      "  -finstrument-functions  call __cyg_profile_func_enter/exit on function entry and exit\n"
+      "  -pg          call mcount on function entry\n"
+      "  -fcache-dir=dir  reuse object files for identical preprocessed sources\n"
+      "  -fstats[=json]  report code size and optimization statistics per function\n"
       "Preprocessor options:\n"
       "  -E           preprocess only\n"
       "  -Idir        add include path 'dir'\n"
@@ -236,11 +368,16 @@ void help(void) {
       "  -fixed addr  set base address (and do not generate relocation info)\n"
       "  -filealign n alignment for sections in PE file\n"
       "  -stub file   set DOS stub for PE file\n"
+      "  -threads n   use n threads for applying relocations\n"
       "  -def file    generate import definition file for shared library\n"
       "  -static      static linking\n"
       "  -rdynamic    export all global symbols to dynamic linker\n"
       "  -r           generate (relocatable) object file\n"
-      "  -m mapfile   generate linker map file\n"
+      "  -m mapfile   generate linker map file with the origin of every byte\n"
+      "  --icf        fold identical functions\n"
+      "  --incremental  relink by patching only the changed parts of the image\n"
+      "  --symbol-ordering-file file  place the listed functions first in .text\n"
+      "  -Wl,--oformat,elf32-i386  generate a statically linked Linux executable\n"
       );
 }
 
@@ -330,10 +467,16 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
           nb_libraries++;
           break;
         case TCC_OPTION_bench:
-          do_bench = 1;
+          if (!*oarg) {
+            do_bench = 1;
+          } else if (!strcmp(oarg, "=json")) {
+            do_bench = 2;
+          } else {
+            error("invalid benchmark format '%s'", oarg);
+          }
           break;
         case TCC_OPTION_g:
-          do_debug = 1;
+          do_debug = strcmp(oarg, "stabs") == 0 ? DEBUG_STABS : DEBUG_LINES;
           break;
         case TCC_OPTION_c:			// dcm:  compile only; generate an object file
           multiple_files = 1;
@@ -342,6 +485,18 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
         case TCC_OPTION_nofll:		// dcm:  undocumented.
           s->nofll = 1;
           break;
+        case TCC_OPTION_pg:
+          s->profile_mcount = 1;
+          break;
+        case TCC_OPTION_icf:
+          s->icf = 1;
+          break;
+        case TCC_OPTION_incremental:
+          s->incremental = 1;
+          break;
+        case TCC_OPTION_symbol_ordering_file:
+          s->symbol_ordering_file = oarg;
+          break;
         case TCC_OPTION_static:
           s->static_link = 1;
           break;
@@ -363,6 +518,10 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
         case TCC_OPTION_stub:
           s->stub = oarg; 
           break;
+        case TCC_OPTION_threads:
+          s->link_threads = strtoul(oarg, NULL, 0);
+          if (s->link_threads < 1) s->link_threads = 1;
+          break;
         case TCC_OPTION_def:
           s->def_file = oarg; 
           break;
@@ -395,9 +554,24 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
             if (verbose++ == 0)  printf("tcc version %s\n", TCC_VERSION);
           } while (*oarg++ == 'v');
           break;
-        case TCC_OPTION_f:
-          if (tcc_set_flag(s, oarg, 1) < 0 && s->warn_unsupported) goto unsupported_option;
+        case TCC_OPTION_f: {
+          const char *p;
+          if (strstart(oarg, "profile-use=", &p)) {
+            s->profile_use = p;
+          } else if (strstart(oarg, "profile-generate=", &p)) {
+            s->profile_generate = 1;
+            s->profile_file = p;
+          } else if (strstart(oarg, "cache-dir=", &p)) {
+            s->cache_dir = p;
+          } else if (!strcmp(oarg, "stats")) {
+            s->stats = 1;
+          } else if (!strcmp(oarg, "stats=json")) {
+            s->stats = 2;
+          } else if (tcc_set_flag(s, oarg, 1) < 0 && s->warn_unsupported) {
+            goto unsupported_option;
+          }
           break;
+        }
         case TCC_OPTION_W:
           if (tcc_set_warning(s, oarg, 1) < 0 && s->warn_unsupported) goto unsupported_option;
           break;
@@ -407,6 +581,11 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
         case TCC_OPTION_rdynamic:
           s->rdynamic = 1;
           break;
+        case TCC_OPTION_run:
+          // The first file is run and the remaining arguments are passed to it
+          multiple_files = 0;
+          output_type = TCC_OUTPUT_MEMORY;
+          break;
         case TCC_OPTION_Wl: {
           const char *p;
           if (strstart(oarg, "-Ttext,", &p)) {
@@ -415,6 +594,8 @@ int parse_arguments(TCCState *s, int argc, char **argv) {
           } else if (strstart(oarg, "--oformat,", &p)) {
             if (strstart(p, "elf32-", NULL)) {
               s->output_format = TCC_OUTPUT_FORMAT_ELF;		// dcm: documented very lightly in cc.h
+            } else if (!strcmp(p, "pei-i386")) {
+              s->output_format = TCC_OUTPUT_FORMAT_PE;
             } else if (!strcmp(p, "binary")) {
               s->output_format = TCC_OUTPUT_FORMAT_BINARY;	// dcm: doesn't appear to be tested anywhere, there are tests for TCC_OUTPUT_FORMAT_ELF though.
             } else {
@@ -444,7 +625,6 @@ int main(int argc, char **argv) {
   TCCState *s;
   int nb_objfiles, ret, oind;
   char objfilename[1024];
-  int64_t start_time = 0;
   char *alt_lib_path;
   //dcm: test for syntax edge case. The standard allows this - it redefines i too. The comma doesn't separate expns.
   //for (int b = 0, i = 1; i < 5; i++) {
@@ -480,8 +660,14 @@ int main(int argc, char **argv) {
     // Accepts only a single input file
     if (nb_objfiles != 1) error("cannot specify multiple files with -c");
     if (nb_libraries != 0) error("cannot specify libraries with -c");
+  } else {
+    // The object file cache is only used when compiling a single file
+    s->cache_dir = NULL;
   }
 
+  // Code generation statistics need the compiler to run
+  if (s->stats) s->cache_dir = NULL;
+
   if (output_type == TCC_OUTPUT_PREPROCESS) {
     if (!outfile) {
       s->outfile = stdout;
@@ -499,7 +685,7 @@ int main(int argc, char **argv) {
 
       if (output_type == TCC_OUTPUT_DLL) {
         strcpy(ext, ".dll");
-      } else if (output_type == TCC_OUTPUT_EXE) {
+      } else if (output_type == TCC_OUTPUT_EXE && s->output_format == TCC_OUTPUT_FORMAT_PE) {
         strcpy(ext, ".exe");
       } else if (output_type == TCC_OUTPUT_OBJ && !reloc_output && *ext) {
         strcpy(ext, ".o");
@@ -510,10 +696,17 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (do_bench) {
-    start_time = getclock_us();
+  // Linux executables are statically linked with the built-in runtime
+  if (s->output_format != TCC_OUTPUT_FORMAT_PE) {
+    if (output_type == TCC_OUTPUT_DLL) error("shared libraries can only be PE files");
+    if (output_type == TCC_OUTPUT_EXE) s->static_link = 1;
+    if (output_type == TCC_OUTPUT_EXE && s->profile_generate) {
+      error("-fprofile-generate cannot be used with Linux executables");
+    }
   }
 
+  if (do_bench) bench_start();
+
   tcc_set_output_type(s, output_type);	// dcm: does quite a bit of setup too.
 
   // Compile or add each files or library
@@ -535,33 +728,23 @@ int main(int argc, char **argv) {
   tcc_free(files);
   if (ret) goto cleanup;
 
-  if (do_bench) {
-    double total_time;
-    total_time = (double) (getclock_us() - start_time) / 1000000.0;
-    if (total_time < 0.001) total_time = 0.001;
-    if (total_bytes < 1) total_bytes = 1;	// dcm: total_bytes updated by preproc.c
-    printf("%d idents, %d lines, %d bytes, %0.3f s, %d lines/s, %0.1f MB/s\n", 
-           tok_ident - TOK_IDENT, total_lines, total_bytes,
-           total_time, (int)(total_lines / total_time), 
-           total_bytes / total_time / 1000000.0); 
-  }
-
   if (s->output_type == TCC_OUTPUT_PREPROCESS) {
     if (outfile) fclose(s->outfile);
-  } else if (s->output_type != TCC_OUTPUT_OBJ) {
+  } else if (s->output_type == TCC_OUTPUT_MEMORY) {
+    ret = tcc_run(s, argc - oind, argv + oind);
+  } else if (s->output_type != TCC_OUTPUT_OBJ && s->output_format == TCC_OUTPUT_FORMAT_PE) {
     ret = pe_output_file(s, outfile);
   } else {
+    bench_phase(BENCH_WRITE);
     ret = tcc_output_file(s, outfile) ? 1 : 0;
+    if (ret == 0 && s->cache_entry) cache_store(s, outfile);
   }
 
+  if (do_bench) bench_report(s);
+  if (s->stats) stats_report(s);
+
 cleanup:
   tcc_delete(s);
-
-#ifdef MEM_DEBUG
-  if (do_bench) {
-    printf("memory: %d bytes, max = %d bytes\n", mem_cur_size, mem_max_size);
-  }
-#endif
   return ret;
 }
 
@@ -63,9 +63,17 @@ typedef unsigned short nwchar_t;
 #define LDOUBLE_SIZE  12
 #define LDOUBLE_ALIGN 4
 
-// Maximum alignment (for aligned attribute support)
+// Maximum alignment of basic types (for aligned attribute support)
 #define MAX_ALIGN     8
 
+// Largest alignment supported for variables, types and code
+#define ALIGN_LIMIT   4096
+
+// Memory orders for atomic builtins
+#define MEMORDER_RELAXED  0
+#define MEMORDER_RELEASE  3
+#define MEMORDER_SEQ_CST  5
+
 // Capacity limits
 #define INCLUDE_STACK_SIZE          32
 #define IFDEF_STACK_SIZE            64
@@ -77,6 +85,9 @@ typedef unsigned short nwchar_t;
 #define TOK_ALLOC_INCR             512  // must be a power of two
 #define TOK_MAX_SIZE                 4  // Token max size in int unit when stored in string
 #define IO_BUF_SIZE               8192
+#define MAX_ROTATE_SIZE             64  // Max loop test size duplicated by loop rotation
+#define REG_CACHE_SIZE               8  // Max local variables cached in registers
+#define PROF_COLD_RATIO             16  // Fall-through blocks taken this much less often are moved out of line
 
 // Token values
 
@@ -208,7 +219,7 @@ typedef struct Section {
   struct Section *reloc;          // Corresponding section for relocation, if any
   struct Section *hash;           // Hash table for symbols
   struct Section *next;           // Used for linking merged sections
-  int unused;                     // Used for unused section elimination
+  int unused;                     // Section eliminated (1) or folded by ICF (2)
   char name[1];                   // Section name
 } Section;
 
@@ -234,6 +245,22 @@ enum stab_debug_code {
 
 #undef STAB
 
+// Compact line table opcodes (.lines section, see elf.c for the format)
+
+enum line_opcode {
+  LN_END = 0,                     // End of line program for function
+  LN_ADVANCE = 1,                 // Advance address (uleb) and line (sleb), add row
+  LN_FILE = 2,                    // Set file index (uleb)
+  LN_SPECIAL = 3,                 // First special opcode, adds a row
+};
+
+#define LN_LINE_BASE  -3
+#define LN_LINE_RANGE 12
+
+// Debug information levels
+#define DEBUG_LINES 1             // Stabs with compact line tables (-g)
+#define DEBUG_STABS 2             // Stabs with a stab for each line (-gstabs)
+
 // Special flag to indicate that the section should not be linked to the other ones
 #define SHF_PRIVATE 0x80000000
 
@@ -241,6 +268,7 @@ enum stab_debug_code {
 
 typedef struct DLLReference {
   int level;
+  void *handle;  // Module handle when running in memory
   char name[1];
 } DLLReference;
 
@@ -340,6 +368,7 @@ typedef struct SValue {
 #define VT_LLONG     12           // 64 bit integer
 #define VT_LONG      13           // long integer (NEVER USED as type, only during parsing)
 #define VT_LABEL     14           // asm label
+#define VT_VECTOR    15           // GNUC vector of arithmetic elements
 
 #define VT_BTYPE      0x000f      // mask for basic type
 #define VT_UNSIGNED   0x0010      // unsigned type
@@ -354,11 +383,12 @@ typedef struct SValue {
 #define VT_STATIC  0x00000100     // static variable
 #define VT_TYPEDEF 0x00000200     // typedef definition
 #define VT_INLINE  0x00000400     // inline definition
+#define VT_TLS     0x00004000     // thread local variable
 
 #define VT_STRUCT_SHIFT 16        // shift for bitfield shift values
 
 // Type mask
-#define VT_STORAGE (VT_EXTERN | VT_STATIC | VT_TYPEDEF | VT_INLINE)
+#define VT_STORAGE (VT_EXTERN | VT_STATIC | VT_TYPEDEF | VT_INLINE | VT_TLS)
 #define VT_TYPE    (~(VT_STORAGE))
 
 // Wrappers for casting sym->r for other purposes
@@ -367,12 +397,20 @@ typedef struct {
     func_call : 8,
     func_args : 8,
     func_export : 1,
-    func_naked : 1;
+    func_naked : 1,
+    func_noinstr : 1,
+    func_regparm : 2,
+    func_regparm_set : 1,
+    func_regparm_used : 1;
 } func_attr_t;
 
 #define FUNC_CALL(r) (((func_attr_t*)&(r))->func_call)
 #define FUNC_EXPORT(r) (((func_attr_t*)&(r))->func_export)
 #define FUNC_NAKED(r) (((func_attr_t*)&(r))->func_naked)
+#define FUNC_NOINSTR(r) (((func_attr_t*)&(r))->func_noinstr)
+#define FUNC_REGPARM(r) (((func_attr_t*)&(r))->func_regparm)
+#define FUNC_REGPARM_SET(r) (((func_attr_t*)&(r))->func_regparm_set)
+#define FUNC_REGPARM_USED(r) (((func_attr_t*)&(r))->func_regparm_used)
 #define FUNC_ARGS(r) (((func_attr_t*)&(r))->func_args)
 #define INLINE_DEF(r) (*(int **)&(r))
 
@@ -382,6 +420,8 @@ typedef struct AttributeDef {
   int packed; 
   Section *section;
   int func_attr;                  // Calling convention, exports, ...
+  int tls;                        // Thread local storage
+  int vector_size;                // GNUC vector size in bytes
 } AttributeDef;
 
 // type_decl() types
@@ -416,6 +456,8 @@ enum {
   TREG_EDX,
   TREG_EBX,
   TREG_ST0,
+  TREG_ESI = 6,
+  TREG_EDI,
 };
 
 // Return registers for function
@@ -445,6 +487,7 @@ typedef struct {
   int addr;
   int target;
   Sym *sym;
+  int prof;   // Profile probe for conditional jump, negative if inverted
 } Branch;
 
 typedef struct {
@@ -454,6 +497,35 @@ typedef struct {
   int br;
 } CodeBuffer;
 
+// Code generation statistics for a function (-fstats)
+#define STATS_HELPERS 8
+
+typedef struct FuncStats {
+  struct FuncStats *next;
+  const char *filename;
+  int size;                         // Bytes of code emitted
+  int prolog_size;
+  int epilog_size;
+  int frame_size;                   // Size of local variables
+  int saved_regs;                   // Callee-saved registers used
+  int spills;                       // Registers saved by save_reg()
+  int long_jumps;
+  int short_jumps;
+  int removed_jumps;                // Jumps eliminated by the jump optimizer
+  int nb_helpers;
+  int helper_tok[STATS_HELPERS];    // Runtime helpers called
+  int helper_calls[STATS_HELPERS];
+  char name[1];
+} FuncStats;
+
+// Section data contributed by an input file, for the linker map
+typedef struct MapEntry {
+  int sh_num;
+  unsigned long offset;
+  unsigned long size;
+  char *input;                    // File name or archive(member)
+} MapEntry;
+
 // Parsing state (used to save parser state to reparse part of the source several times)
 typedef struct ParseState {
   int *macro_ptr;
@@ -571,6 +643,15 @@ typedef struct TCCState {
   // If true, disable funtion-level linking
   int nofll;
 
+  // If true, fold identical function sections
+  int icf;
+
+  // If true, patch the previous image in place when possible (--incremental)
+  int incremental;
+
+  // Functions to place first in the text segment (--symbol-ordering-file)
+  const char *symbol_ordering_file;
+
   // If true, disable shared module loading
   int noshare;
 
@@ -604,6 +685,9 @@ typedef struct TCCState {
   // File alignment for sections in PE files
   unsigned long filealign;
 
+  // Number of threads used for applying relocations when linking
+  int link_threads;
+
   // If true, all symbols are exported
   int rdynamic;
 
@@ -620,6 +704,37 @@ typedef struct TCCState {
   // C language options
   int char_is_unsigned;
   int leading_underscore;
+
+  // If true, static functions called directly take parameters in registers
+  int auto_regparm;
+
+  // Code alignment for functions and loops (-falign-functions, -falign-loops)
+  int align_functions;
+  int align_loops;
+
+  // If true, string literals are placed in a mergeable string section
+  int merge_strings;
+
+  // Profile guided optimization (-fprofile-generate[=file], -fprofile-use=file)
+  int profile_generate;
+  const char *profile_file;
+  const char *profile_use;
+
+  // Function instrumentation (-finstrument-functions, -pg)
+  int instrument_functions;
+  int profile_mcount;
+
+  // Object file cache (-fcache-dir=dir) and the cache entry for the
+  // object file being compiled. Diagnostics are collected in cache_diag
+  // while cache_log is set, and only collected if it is CACHE_LOG_QUIET.
+  const char *cache_dir;
+  char *cache_entry;
+  CString cache_diag;
+  int cache_log;
+
+  // Code generation statistics (-fstats, 1 = text, 2 = JSON)
+  int stats;
+  FuncStats *func_stats;
     
   // Warning switches
   int warn_write_strings;
@@ -654,25 +769,43 @@ typedef struct TCCState {
   // Output file for preprocessing
   FILE *outfile;
     
-  // Linker map file
+  // Linker map file and the section data contributed by each input file
   const char *mapfile;
+  MapEntry **map_entries;
+  int nb_map_entries;
+  unsigned long *map_offsets;
+  int nb_map_offsets;
 } TCCState;
 
 // Output type
+#define TCC_OUTPUT_MEMORY     0   // Program is run in memory (-run)
 #define TCC_OUTPUT_EXE        1   // Executable file (default)
 #define TCC_OUTPUT_DLL        2   // Dynamic library
 #define TCC_OUTPUT_OBJ        3   // Object file
 #define TCC_OUTPUT_PREPROCESS 4   // Preprocessed file (used internally)
 
 // Output format
-#define TCC_OUTPUT_FORMAT_ELF    0 // Default output format: ELF
+#define TCC_OUTPUT_FORMAT_ELF    0 // ELF object files and Linux executables
 #define TCC_OUTPUT_FORMAT_BINARY 1 // Binary image output
+#define TCC_OUTPUT_FORMAT_PE     2 // Default output format: PE executables
 
 // Flags for tcc_add_file_internal()
 #define AFF_PRINT_ERROR     0x0001 // Print error if file not found
 #define AFF_REFERENCED_DLL  0x0002 // Load a referenced DLL from another DLL
 #define AFF_PREPROCESS      0x0004 // Preprocess file
 
+// Benchmark phases for -bench
+#define BENCH_OTHER      0 // Driver and anything not covered below
+#define BENCH_PREPROCESS 1 // Lexing, preprocessing and macro expansion
+#define BENCH_PARSE      2 // Parsing and code generation
+#define BENCH_GCODE      3 // Branch optimization and code output in gcode()
+#define BENCH_LOAD       4 // Loading object files, archives and dlls
+#define BENCH_GC         5 // Unused section elimination and section merging
+#define BENCH_LINK       6 // Symbol resolution and address assignment
+#define BENCH_RELOCATE   7 // Applying relocations
+#define BENCH_WRITE      8 // Writing the output file
+#define BENCH_PHASES     9
+
 // Parse flags
 #define PARSE_FLAG_PREPROCESS   0x0001 // Activate preprocessing
 #define PARSE_FLAG_TOK_NUM      0x0002 // Return numbers instead of TOK_PPNUM
@@ -684,12 +817,14 @@ typedef struct TCCState {
 // Globals
 //
 
-extern CType char_pointer_type, func_old_type, int_type;
+extern CType char_pointer_type, func_old_type, func_void_type, int_type;
 
 extern int rsym;                  // return symbol
 extern int anon_sym;              // anonymous symbol index
 extern int ind;                   // output code index
 extern int loc;                   // local variable index
+extern int min_loc;               // lowest local variable index used by function
+extern int loc_align;             // largest alignment of local variables in function
 extern int func_naked;            // no generation of function prolog
 
 // Expression generation modifiers
@@ -704,6 +839,7 @@ extern TokenSym **table_ident;
 extern TokenSym *hash_ident[TOK_HASH_SIZE];
 extern char token_buf[STRING_MAX_SIZE + 1];
 extern char *func_name;
+extern Sym *func_sym;
 extern CType func_old_type;
 extern Sym *global_stack, *local_stack;
 extern Sym *define_stack;
@@ -714,7 +850,8 @@ extern SValue *vtop;
 
 extern TCCState *tcc_state;
 extern int verbose;
-extern int do_debug;
+extern int do_debug;              // DEBUG_LINES or DEBUG_STABS
+extern int do_bench;
 extern int tok_ident;
 
 // Parser state
@@ -730,6 +867,11 @@ extern int *macro_ptr;
 extern int total_lines;
 extern int total_bytes;
 
+extern int mem_cur_size;
+extern int mem_max_size;
+extern int mem_allocs;
+extern int mem_frees;
+
 extern const char *tcc_lib_path;
 
 // Symbol sections
@@ -737,16 +879,23 @@ extern Section *symtab_section, *strtab_section;
 
 // Text section
 extern Section *text_section, *data_section, *bss_section; // Predefined sections
+extern Section *string_section; // Mergeable string literals
+extern Section *tls_section; // Thread local variables
 extern Section *cur_text_section; // Current section where function code is generated
 extern Section *last_text_section; // to handle .previous asm directive
 
 // Debug sections
 extern Section *stab_section, *stabstr_section;
+extern Section *lines_section;
 
 //
 // Global functions
 //
 
+// cc.c
+int64_t getclock_us(void);
+int bench_phase(int phase);
+
 // symbol.c
 Sym *sym_malloc(void);
 void sym_free(Sym *sym);
@@ -784,6 +933,7 @@ int is_null_pointer(SValue *p);
 int is_integer_btype(int bt);
 CType *pointed_type(CType *type);
 void mk_pointer(CType *type);
+void mk_vector(CType *type, int size);
 void type_to_str(char *buf, int buf_size, CType *type, const char *varstr);
 
 // preproc.c
@@ -857,21 +1007,29 @@ void vpushi(int v);
 void vpush_tokc(int t);
 void vpush_ref(CType *type, Section *sec, unsigned long offset, unsigned long size);
 void vpush_global_sym(CType *type, int v);
+void vpush_helper_sym(int v);
 void vdup(void);
 void vsetc(CType *type, int r, CValue *vc);
 void vset(CType *type, int r, int v);
 void vseti(int r, int v);
 void vswap(void);
 int get_reg(int rc);
+void reg_cache_flush(void);
+void reg_cache_kill(int r);
+int reg_cache_find(SValue *sv);
+void reg_cache_load(int r, SValue *sv);
+void reg_cache_store(int r, SValue *sv, int size);
 int gv(int rc);
 void gv2(int rc1, int rc2);
 void vrotb(int n);
+void vrott(int n);
 void vpop(void);
 void gv_dup(void);
 void gen_cast(CType *type);
 void gen_op(int op);
 void gen_assign_cast(CType *dt);
 void gaddrof(void);
+void vpush_temp(CType *type);
 
 // codegen386.c
 void reset_code_buf(void);
@@ -883,12 +1041,14 @@ void gline(int linenum);
 
 void mark_code_buffer(CodeBuffer *cb);
 void cut_code_buffer(CodeBuffer *cb);
-void paste_code_buffer(CodeBuffer *cb);
+int copy_code_buffer(CodeBuffer *cb, int chain);
+int paste_code_buffer(CodeBuffer *cb);
 
 void g(int c);
 void o(unsigned int c);
 void gen_le16(int c);
 void gen_le32(int c);
+int gchain(int a, int b);
 void gsym_at(int b, int l);
 int gsym(int b);
 void assign_label_symbol(int l, Sym *sym);
@@ -897,13 +1057,25 @@ void gjmp_addr(int a);
 int glabel(void);
 void galign(int n, int v);
 void greloc(Sym *sym, int c, int rel);
+void gen_modrm(int op_reg, int r, Sym *sym, int c);
+void gen_tls_addr(void);
 
 void store(int r, SValue *v);
 void load(int r, SValue *sv);
 int gtst(int inv, int t);
 void gen_opi(int op);
+void gen_opl_shift(int op);
+void gen_atomic(int op, int fetch_new);
+void gen_atomic_cmpxchg(int kind);
+void gen_fence(void);
+void gen_bitop(int op);
+void gen_prefetch(int locality);
 void gen_opf(int op);
+int gen_opv(int op);
+void gen_movv(void);
 void gfunc_call(int nb_args);
+int gfunc_regparm(CType *func_type);
+void gfunc_regparm_redecl(Sym *sym, CType *type);
 void gfunc_prolog(CType *func_type);
 void gfunc_epilog(void);
 void gen_cvt_itof(int t);
@@ -921,8 +1093,6 @@ int asm_int_expr(TCCState *s1);
 void asm_expr(TCCState *s1, ExprValue *pe);
 void asm_expr_logic(TCCState *s1, ExprValue *pe);
 
-static void *resolve_sym(TCCState *s1, const char *symbol, int type) { return NULL; }
-
 // asm386.c
 void gen_expr32(ExprValue *pe);
 void asm_opcode(TCCState *s1, int opcode);
@@ -934,7 +1104,15 @@ void asm_compute_constraints(ASMOperand *operands,
 void asm_gen_code(ASMOperand *operands, int nb_operands, int nb_outputs, int is_output,
                   uint8_t *clobber_regs, int out_reg);
 
+// cache.c
+#define CACHE_LOG        1
+#define CACHE_LOG_QUIET  2
+
+int cache_compile(TCCState *s1, const char *filename);
+void cache_store(TCCState *s1, const char *objfile);
+
 // elf.c
+unsigned long elf_hash(const unsigned char *name);
 Section *new_symtab(TCCState *s1,
                     const char *symtab_name, int sh_type, int sh_flags,
                     const char *strtab_name, 
@@ -953,11 +1131,19 @@ void put_stabs(const char *str, int type, int other, int desc, unsigned long val
 void put_stabs_r(const char *str, int type, int other, int desc, unsigned long value, Section *sec, int sym_index);
 void put_stabn(int type, int other, int desc, int value);
 void put_stabd(int type, int other, int desc);
+void lines_begin(const char *dir, const char *filename);
+int lines_file(const char *filename);
+void put_line(unsigned long addr, int line, int file);
+void put_lines(int sym_index, unsigned long size);
+void lines_end(void);
 
 void tcc_add_linker_symbols(TCCState *s1);
 int tcc_output_file(TCCState *s1, const char *filename);
 int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset);
 int tcc_load_archive(TCCState *s1, int fd);
+void map_input_start(TCCState *s1);
+void map_input_end(TCCState *s1, const char *filename, const char *member);
+void map_free(TCCState *s1);
 int tcc_load_dll(TCCState *s1, int fd, const char *filename, int level);
 int tcc_load_ldscript(TCCState *s1);
 void *tcc_get_symbol_err(TCCState *s, const char *name);
@@ -967,6 +1153,27 @@ int pe_output_file(TCCState * s1, const char *filename);
 int pe_load_def_file(struct TCCState *s1, int fd);
 int pe_test_res_file(void *v, int size);
 int pe_load_res_file(struct TCCState *s1, int fd);
+void *resolve_sym(TCCState *s1, const char *symbol, int type);
+int tcc_relocate(TCCState *s1);
+int tcc_run(TCCState *s1, int argc, char **argv);
+
+// profile.c
+extern Section *prof_section;
+extern int prof_sym;
+
+int prof_record(const char *name, unsigned int checksum, int nb_counters);
+unsigned int *prof_lookup(TCCState *s1, const char *name, unsigned int checksum, int nb_counters);
+unsigned int prof_function_count(TCCState *s1, const char *name);
+int prof_add_runtime(TCCState *s1, const char *filename);
+void prof_free(void);
+
+// stats.c
+extern FuncStats *cur_stats;
+
+void stats_begin(TCCState *s1, const char *name);
+void stats_helper(int tok);
+void stats_report(TCCState *s1);
+void stats_free(TCCState *s1);
 
 // util.c
 void *tcc_malloc(unsigned long size);
@@ -1002,6 +1209,7 @@ void cstr_cat(CString *cstr, const char *str);
 void cstr_wccat(CString *cstr, int ch);
 void add_char(CString *cstr, int c);
 
+void print_diagnostic(TCCState *s1, const char *msg);
 void error(const char *fmt, ...);
 void warning(const char *fmt, ...);
 void error_noabort(const char *fmt, ...);
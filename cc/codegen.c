@@ -81,6 +81,12 @@ void vpush_global_sym(CType *type, int v) {
   vtop->sym = sym;
 }
 
+// Push a reference to runtime helper function v
+void vpush_helper_sym(int v) {
+  stats_helper(v);
+  vpush_global_sym(&func_old_type, v);
+}
+
 void vpush_tokc(int t) {
   CType type;
   type.t = t;
@@ -119,6 +125,149 @@ void vdup(void) {
   vpushv(vtop);
 }
 
+// Register cache. Records which registers hold the value of a local
+// variable in the current basic block, so it can be reused instead of
+// reloaded from the stack.
+typedef struct RegCache {
+  int r;    // register holding the value
+  int loc;  // stack offset of local variable
+  int t;    // type of load
+} RegCache;
+
+static RegCache reg_cache[REG_CACHE_SIZE];
+static int reg_cache_used;
+
+// Return load type for value if it can be cached, otherwise -1
+static int reg_cache_type(SValue *sv) {
+  int t;
+
+  if ((sv->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != (VT_LOCAL | VT_LVAL)) return -1;
+  t = sv->type.t & VT_TYPE;
+  if (t & (VT_VOLATILE | VT_BITFIELD | VT_ARRAY)) return -1;
+
+  // Use memory access type for casted lvalues
+  if (sv->r & VT_LVAL_BYTE) {
+    t = VT_BYTE;
+  } else if (sv->r & VT_LVAL_SHORT) {
+    t = VT_SHORT;
+  }
+  if (sv->r & VT_LVAL_UNSIGNED) t |= VT_UNSIGNED;
+  if (t == VT_BYTE || t == (VT_BYTE | VT_UNSIGNED)) return t;
+  if (t == VT_SHORT || t == (VT_SHORT | VT_UNSIGNED)) return t;
+  if ((t & VT_BTYPE) == VT_INT || (t & VT_BTYPE) == VT_PTR) return VT_INT;
+  return -1;
+}
+
+// Forget all cached register values
+void reg_cache_flush(void) {
+  reg_cache_used = 0;
+}
+
+// Forget cached values held by register r
+void reg_cache_kill(int r) {
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < reg_cache_used; i++) {
+    if (reg_cache[i].r != r) reg_cache[n++] = reg_cache[i];
+  }
+  reg_cache_used = n;
+}
+
+// Forget cached values for stack locations overlapping [loc, loc+size)
+static void reg_cache_kill_loc(int loc, int size) {
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < reg_cache_used; i++) {
+    if (reg_cache[i].loc >= loc + size || reg_cache[i].loc + 4 <= loc) {
+      reg_cache[n++] = reg_cache[i];
+    }
+  }
+  reg_cache_used = n;
+}
+
+static void reg_cache_add(int r, int loc, int t) {
+  if (reg_cache_used == REG_CACHE_SIZE) {
+    // Drop oldest entry
+    memmove(reg_cache, reg_cache + 1, (REG_CACHE_SIZE - 1) * sizeof(RegCache));
+    reg_cache_used--;
+  }
+  reg_cache[reg_cache_used].r = r;
+  reg_cache[reg_cache_used].loc = loc;
+  reg_cache[reg_cache_used].t = t;
+  reg_cache_used++;
+}
+
+// Find register holding the value of a local variable, or -1 if none
+int reg_cache_find(SValue *sv) {
+  int i, t;
+
+  t = reg_cache_type(sv);
+  if (t < 0) return -1;
+  for (i = 0; i < reg_cache_used; i++) {
+    if (reg_cache[i].loc == (int) sv->c.ul && reg_cache[i].t == t) return reg_cache[i].r;
+  }
+  return -1;
+}
+
+// Update cache after register r has been loaded from value sv
+void reg_cache_load(int r, SValue *sv) {
+  int i, t, v;
+
+  reg_cache_kill(r);
+  t = reg_cache_type(sv);
+  v = sv->r & VT_VALMASK;
+  if (t >= 0) {
+    reg_cache_add(r, sv->c.ul, t);
+  } else if (v < VT_CONST && !(sv->r & VT_LVAL) && v != r) {
+    // Register copy holds the same values
+    for (i = 0; i < reg_cache_used; i++) {
+      if (reg_cache[i].r == v) reg_cache_add(r, reg_cache[i].loc, reg_cache[i].t);
+    }
+  }
+}
+
+// Update cache after register r has been stored in value sv
+void reg_cache_store(int r, SValue *sv, int size) {
+  int v, t;
+
+  v = sv->r & VT_VALMASK;
+  if (v == VT_LOCAL) {
+    reg_cache_kill_loc(sv->c.ul, size);
+    t = reg_cache_type(sv);
+    if (t == VT_INT) reg_cache_add(r, sv->c.ul, t);
+  } else if (v == VT_CONST) {
+    // Global variables cannot overlap local variables
+  } else if ((sv->r & VT_LVAL) || v == VT_LLOCAL) {
+    // Store through pointer can modify any local variable
+    reg_cache_flush();
+  } else {
+    // Register to register move
+    reg_cache_kill(v);
+  }
+}
+
+// Check if register is used by any value on the value stack
+static int reg_in_use(int r) {
+  SValue *p;
+
+  for (p = vstack; p <= vtop; p++) {
+    if ((p->r & VT_VALMASK) == r || (p->r2 & VT_VALMASK) == r) return 1;
+  }
+  return 0;
+}
+
+// Check if register holds any cached values
+static int reg_cached(int r) {
+  int i;
+
+  for (i = 0; i < reg_cache_used; i++) {
+    if (reg_cache[i].r == r) return 1;
+  }
+  return 0;
+}
+
 // Save r to the memory stack, and mark it as being free
 void save_reg(int r) {
   int l, saved, size, align;
@@ -146,6 +295,7 @@ void save_reg(int r) {
         sv.r = VT_LOCAL | VT_LVAL;
         sv.c.ul = loc;
         store(r, &sv);
+        if (cur_stats) cur_stats->spills++;
 
         // x86 specific: need to pop fp register ST0 if saved
         if (r == TREG_ST0) {
@@ -178,15 +328,15 @@ int get_reg(int rc) {
   int r;
   SValue *p;
 
-  // Find a free register
+  // Find a free register, preferably a scratch register not holding cached values
   for (r = 0; r < NB_REGS; r++) {
-    if (reg_classes[r] & rc) {
-      for (p = vstack; p <= vtop; p++) {
-        if ((p->r & VT_VALMASK) == r || (p->r2 & VT_VALMASK) == r) goto notfound;
-      }
+    if ((reg_classes[r] & rc) && !(reg_classes[r] & RC_SAVE) && !reg_in_use(r) && !reg_cached(r)) return r;
+  }
+  for (r = 0; r < NB_REGS; r++) {
+    if ((reg_classes[r] & rc) && !reg_in_use(r)) {
+      reg_cache_kill(r);
       return r;
     }
-  notfound: ;
   }
 
   // No register left: free the first one on the stack (VERY
@@ -201,6 +351,7 @@ int get_reg(int rc) {
     if (r < VT_CONST && (reg_classes[r] & rc)) {
     save_found:
       save_reg(r);
+      reg_cache_kill(r);
       return r;
     }
   }
@@ -211,17 +362,13 @@ int get_reg(int rc) {
 // Find a free pointer-type register
 int get_ptr_reg() {
   int r;
-  SValue *p;
 
   // Find a free pointer register
   for (r = 0; r < NB_REGS; r++) {
-    if (reg_classes[r] & RC_PTR) {
-      for (p = vstack; p <= vtop; p++) {
-        if ((p->r & VT_VALMASK) == r || (p->r2 & VT_VALMASK) == r) goto notfound;
-      }
+    if ((reg_classes[r] & RC_PTR) && !reg_in_use(r)) {
+      reg_cache_kill(r);
       return r;
     }
-  notfound: ;
   }
 
   // No pointer register found
@@ -232,6 +379,7 @@ int get_ptr_reg() {
 void save_regs(int n) {
   int r;
   SValue *p, *p1;
+  reg_cache_flush();
   p1 = vtop - n;
   for (p = vstack; p <= p1; p++) {
     r = p->r & VT_VALMASK;
@@ -263,6 +411,16 @@ void gaddrof(void) {
   }
 }
 
+// Push a temporary stack variable of 'type'
+void vpush_temp(CType *type) {
+  int size, align;
+
+  size = type_size(type, &align);
+  loc = (loc - size) & -align;
+  if (align > loc_align) loc_align = align;
+  vset(type, VT_LOCAL | VT_LVAL, loc);
+}
+
 // Store vtop in a register belonging to class 'rc'. lvalues are
 // converted to values. Cannot be used if vtop cannot be converted 
 // to register value (such as structures).
@@ -270,6 +428,10 @@ int gv(int rc) {
   int r, r2, rc2, bit_pos, bit_size, size, align, i;
   uint64_t ll;
 
+  if ((vtop->type.t & VT_BTYPE) == VT_VECTOR && (vtop->r & VT_LVAL)) {
+    error("used vector type where scalar is required");
+  }
+
   // NOTE: get_reg can modify vstack[]
   if (vtop->type.t & VT_BITFIELD) {
     bit_pos = (vtop->type.t >> VT_STRUCT_SHIFT) & 0x3f;
@@ -316,6 +478,13 @@ int gv(int rc) {
         (vtop->r & VT_LVAL) ||
         !(reg_classes[r] & rc) ||
         ((vtop->type.t & VT_BTYPE) == VT_LLONG && !(reg_classes[vtop->r2] & rc))) {
+      // Reuse register already holding the value of a local variable
+      r = reg_cache_find(vtop);
+      if (r >= 0 && (reg_classes[r] & rc) && !reg_in_use(r)) {
+        vtop->r = r;
+        return r;
+      }
+
       if (rc == RC_INT && (vtop->type.t & VT_BTYPE) == VT_PTR) {
         r = get_ptr_reg();
       } else {
@@ -518,6 +687,11 @@ void gv_dup(void) {
   }
 }
 
+// Check if value is a long long constant with a non-zero high word
+static int lconst_high(SValue *v) {
+  return (v->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST && (v->c.ull >> 32) != 0;
+}
+
 // Generate CPU independent (unsigned) long long operations
 void gen_opl(int op) {
   int t, a, b, op1, c, i;
@@ -538,10 +712,40 @@ void gen_opl(int op) {
     case TOK_UMOD:
       func = TOK___umoddi3;
     gen_func:
+      a = 0;
+      if (!lconst_high(vtop - 1) && !lconst_high(vtop)) {
+        // Use a 32-bit division if both high words are zero
+        save_regs(0);
+        vpushv(vtop - 1);
+        lexpand();
+        vswap();
+        vpop();
+        vpushv(vtop - 1);
+        lexpand();
+        vswap();
+        vpop();
+        gen_op('|');
+        b = gtst(0, 0);
+        vpushv(vtop - 1);
+        lexpand();
+        vpop();
+        vpushv(vtop - 1);
+        lexpand();
+        vpop();
+        gen_op(op == '%' || op == TOK_UMOD ? TOK_UMOD : TOK_UDIV);
+        gv(RC_IRET);
+        vtop--;
+        o(0xd231); // xor %edx, %edx
+        reg_cache_kill(TREG_EDX);
+        a = gjmp(0, 0);
+        gsym(b);
+      }
+
       // Call generic long long function
-      vpush_global_sym(&func_old_type, func);
+      vpush_helper_sym(func);
       vrott(3);
       gfunc_call(2);
+      gsym(a);
       vpushi(0);
       vtop->r = REG_IRET;
       vtop->r2 = REG_LRET;
@@ -665,18 +869,7 @@ void gen_opl(int op) {
         if (op != TOK_SHL) vswap();
         lbuild(t);
       } else {
-        // TODO: should provide a faster fallback on x86?
-        switch (op) {
-          case TOK_SAR:
-            func = TOK___sardi3;
-            goto gen_func;
-          case TOK_SHR:
-            func = TOK___shrdi3;
-            goto gen_func;
-          case TOK_SHL:
-            func = TOK___shldi3;
-            goto gen_func;
-        }
+        gen_opl_shift(op);
       }
       break;
 
@@ -916,6 +1109,138 @@ void gen_opif(int op) {
 }
 
 // Generic gen_op: handles types problems
+// Push element of vector 'sv' at 'offset' with 'type'
+static void vpush_element(SValue *sv, CType *type, int offset) {
+  vpushv(sv);
+  vtop->type = *type;
+  vtop->r = (vtop->r & ~VT_LVAL_TYPE) | lvalue_type(type->t);
+  vtop->c.i += offset;
+}
+
+// Convert scalar in vtop to a vector of 'type' with the value in all elements
+static void vec_splat(CType *type) {
+  CType et;
+  SValue d;
+  int i, n, esize, align;
+
+  et = type->ref->type;
+  n = type->ref->c;
+  esize = type_size(&et, &align);
+  gen_cast(&et);
+  if (is_float(et.t)) {
+    gv(RC_FLOAT);
+  } else if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != VT_CONST) {
+    gv(RC_INT);
+  }
+  vpush_temp(type);
+  d = *vtop;
+  vswap();
+  for (i = 0; i < n; i++) {
+    vpush_element(&d, &et, i * esize);
+    vpushv(vtop - 1);
+    vstore();
+    vtop--; // NOT vpop() because on x86 it would flush the fp stack
+  }
+  vpop();
+}
+
+// Copy vector in vtop to the stack if it is addressed through a register
+static void vec_spill(void) {
+  SValue tmp;
+  int v;
+
+  v = vtop->r & VT_VALMASK;
+  if (v != VT_LOCAL && v != VT_CONST) {
+    vpush_temp(&vtop->type);
+    tmp = *vtop;
+    vswap();
+    vstore();
+    *vtop = tmp;
+  }
+}
+
+// Generate vector operation one element at a time. Used for operations
+// that have no vector instruction.
+static void gen_opv_elements(int op, CType *rtype) {
+  SValue a, b, d;
+  CType et, rt;
+  int i, n, esize, align, cmp;
+
+  vec_spill();
+  vswap();
+  vec_spill();
+  vswap();
+  a = vtop[-1];
+  b = vtop[0];
+  et = a.type.ref->type;
+  rt = rtype->ref->type;
+  n = a.type.ref->c;
+  esize = type_size(&et, &align);
+  cmp = op >= TOK_ULT && op <= TOK_GT;
+  vpush_temp(rtype);
+  d = *vtop;
+  for (i = 0; i < n; i++) {
+    vpush_element(&d, &rt, i * esize);
+    vpush_element(&a, &et, i * esize);
+    vpush_element(&b, &et, i * esize);
+    gen_op(op);
+    if (cmp) {
+      // True is all bits set
+      vpushi(0);
+      vswap();
+      gen_op('-');
+    }
+    vstore();
+    vpop();
+  }
+  vtop[-2] = vtop[0];
+  vtop -= 2;
+}
+
+// Generate vector operation. A scalar operand is converted to a vector
+// with the scalar in all elements. Comparisons give a vector of signed
+// integers which are -1 where the comparison is true and 0 otherwise.
+static void gen_opvec(int op) {
+  CType type, rtype, *et;
+  int size, align, esize;
+
+  if ((vtop[0].type.t & VT_BTYPE) != VT_VECTOR) {
+    type = vtop[-1].type;
+    vec_splat(&type);
+  } else if ((vtop[-1].type.t & VT_BTYPE) != VT_VECTOR) {
+    type = vtop[0].type;
+    vswap();
+    vec_splat(&type);
+    vswap();
+  } else {
+    type = vtop[-1].type;
+    if (!are_compatible_parameter_types(&vtop[-1].type, &vtop[0].type)) {
+      error("invalid operands for vector operation");
+    }
+  }
+  type.t &= ~(VT_CONSTANT | VT_VOLATILE);
+  et = &type.ref->type;
+  if (is_float(et->t) && op != '+' && op != '-' && op != '*' && op != '/' && (op < TOK_ULT || op > TOK_GT)) {
+    error("invalid operands for vector operation");
+  }
+
+  // Comparisons give integer vectors with elements of the same size
+  rtype = type;
+  if (op >= TOK_ULT && op <= TOK_GT) {
+    esize = type_size(et, &align);
+    rtype.t = esize == 1 ? VT_BYTE : esize == 2 ? VT_SHORT : esize == 4 ? VT_INT : VT_LLONG;
+    mk_vector(&rtype, type_size(&type, &align));
+  }
+
+  if (nocode_wanted) {
+    vtop--;
+  } else {
+    size = type_size(&type, &align);
+    if (size != 16 || !gen_opv(op)) gen_opv_elements(op, &rtype);
+  }
+  vtop->type = rtype;
+}
+
 void gen_op(int op) {
   int u, t1, t2, bt1, bt2, t;
   CType type1;
@@ -925,7 +1250,9 @@ void gen_op(int op) {
   bt1 = t1 & VT_BTYPE;
   bt2 = t2 & VT_BTYPE;
 
-  if (bt1 == VT_PTR || bt2 == VT_PTR) {
+  if (bt1 == VT_VECTOR || bt2 == VT_VECTOR) {
+    gen_opvec(op);
+  } else if (bt1 == VT_PTR || bt2 == VT_PTR) {
     // At least one operand is a pointer
     // For relational op both must be pointers
     if (op >= TOK_ULT && op <= TOK_LOR) {
@@ -1045,11 +1372,11 @@ void gen_cvt_itof1(int t) {
   if ((vtop->type.t & (VT_BTYPE | VT_UNSIGNED)) == (VT_LLONG | VT_UNSIGNED)) {
 
     if (t == VT_FLOAT) {
-      vpush_global_sym(&func_old_type, TOK___ulltof);
+      vpush_helper_sym(TOK___ulltof);
     } else if (t == VT_DOUBLE) {
-      vpush_global_sym(&func_old_type, TOK___ulltod);
+      vpush_helper_sym(TOK___ulltod);
     } else {
-      vpush_global_sym(&func_old_type, TOK___ulltold);
+      vpush_helper_sym(TOK___ulltold);
     }
     vrott(2);
     gfunc_call(1);
@@ -1068,11 +1395,11 @@ void gen_cvt_ftoi1(int t) {
     // Not handled natively
     st = vtop->type.t & VT_BTYPE;
     if (st == VT_FLOAT) {
-      vpush_global_sym(&func_old_type, TOK___fixunssfdi);
+      vpush_helper_sym(TOK___fixunssfdi);
     } else if (st == VT_DOUBLE) {
-      vpush_global_sym(&func_old_type, TOK___fixunsdfdi);
+      vpush_helper_sym(TOK___fixunsdfdi);
     } else {
-      vpush_global_sym(&func_old_type, TOK___fixunsxfdi);
+      vpush_helper_sym(TOK___fixunsxfdi);
     }
     vrott(2);
     gfunc_call(1);
@@ -1127,6 +1454,18 @@ void gen_cast(CType *type) {
     gv(RC_INT);
   }
 
+  // Vectors can only be reinterpreted as vectors of the same size
+  if ((vtop->type.t & VT_BTYPE) == VT_VECTOR || (type->t & VT_BTYPE) == VT_VECTOR) {
+    if ((type->t & VT_BTYPE) != VT_VOID) {
+      if ((vtop->type.t & VT_BTYPE) != (type->t & VT_BTYPE) ||
+          type_size(&vtop->type, &c) != type_size(type, &c)) {
+        error("invalid vector conversion");
+      }
+    }
+    vtop->type = *type;
+    return;
+  }
+
   dbt = type->t & (VT_BTYPE | VT_UNSIGNED);
   sbt = vtop->type.t & (VT_BTYPE | VT_UNSIGNED);
   if (sbt != dbt && !nocode_wanted) {
@@ -1337,6 +1676,16 @@ void gen_assign_cast(CType *dt) {
       // TODO: more tests
       break;
 
+    case VT_VECTOR:
+      // Vectors with elements of different signedness are compatible
+      if (sbt != VT_VECTOR || dt->ref->c != st->ref->c) goto error;
+      btype1 = dt->ref->type;
+      btype2 = st->ref->type;
+      btype1.t &= ~VT_UNSIGNED;
+      btype2.t &= ~VT_UNSIGNED;
+      if (!are_compatible_parameter_types(&btype1, &btype2)) goto error;
+      break;
+
     case VT_STRUCT:
       btype1 = *dt;
       btype2 = *st;
@@ -1373,12 +1722,18 @@ void vstore(void) {
     if (!(ft & VT_BITFIELD)) gen_assign_cast(&vtop[-1].type);
   }
 
-  if (sbt == VT_STRUCT) {
+  if (sbt == VT_VECTOR && type_size(&vtop->type, &align) == 16) {
+    // Vectors are copied in one piece
+    if (!nocode_wanted) gen_movv();
+    vswap();
+    vpop();
+    // Leave source on stack
+  } else if (sbt == VT_STRUCT || sbt == VT_VECTOR) {
     // If structure, only generate pointer structure assignment: generate memcpy
     // TODO: optimize if small size
     if (!nocode_wanted) {
       size = type_size(&vtop->type, &align);
-      vpush_global_sym(&func_old_type, TOK_memcpy);
+      vpush_helper_sym(TOK_memcpy);
 
       // Destination
       vpushv(vtop - 2);
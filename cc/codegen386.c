@@ -45,10 +45,25 @@ static int branch_size;
 static int br;
 
 static int regs_used;
+static uint8_t fastcall_regs[3] = { TREG_EAX, TREG_EDX, TREG_ECX };
+static uint8_t fastcallw_regs[2] = { TREG_ECX, TREG_EDX };
 static int func_ret_sub;
 static int func_noargs;
+static int func_args_size;
+static int func_vararg;
+static int func_regparm;
+static int func_eax_param;
+static int func_reg_params;
 int func_naked;
 
+static int prof_enabled;
+static int prof_probes;
+static unsigned int prof_checksum;
+static int prof_base;
+
+static int func_instrument;
+static int func_mcount;
+
 void reset_code_buf(void) {
   code = NULL;
   code_size = 0;
@@ -114,6 +129,7 @@ int gbranch(int type) {
   b->addr = 0;
   b->target = 0;
   b->sym = NULL;
+  b->prof = 0;
 
   return br++;
 }
@@ -131,9 +147,12 @@ void gline(int linenum) {
   
   b = gbranch(CodeLine);
   branch[b].target = linenum;
+  if (do_debug == DEBUG_LINES) branch[b].param = lines_file(file->filename);
 }
 
 int glabel(void) {
+  // Registers can hold different values when jumping to a label
+  reg_cache_flush();
   return gbranch(CodeLabel);
 }
 
@@ -154,6 +173,16 @@ void galign(int n, int v) {
   branch[b].target = v;
 }
 
+// Append jump chain 'b' to jump chain 'a'
+int gchain(int a, int b) {
+  int *p;
+
+  p = &a;
+  while (*p != 0) p = &branch[*p].target;
+  *p = b;
+  return a;
+}
+
 // Output a label and patch all calls to it
 void gsym_at(int b, int l) {
   int n;
@@ -191,23 +220,66 @@ void greloc(Sym *sym, int c, int rel) {
   gen_le32(c);
 }
 
+// Offset of the TLS array pointer in the thread information block
+#define TIB_TLSBASE 0x2c
+
+// Convert the thread local variable in vtop to a reference through a
+// register. The TLS block for the module is found in the TLS array of
+// the thread at the index the loader stored in _tls_index.
+void gen_tls_addr(void) {
+  int r;
+
+  r = get_reg(RC_INT);
+  o(0x8b); // mov _tls_index, r
+  gen_modrm(r, VT_CONST | VT_SYM, external_global_sym(TOK__tls_index, &int_type, VT_LVAL), 0);
+  o(0xe0c1 + (r << 8)); // shl $2, r
+  g(2);
+  g(0x64); // add %fs:TIB_TLSBASE, r
+  o(0x03);
+  gen_modrm(r, VT_CONST, NULL, TIB_TLSBASE);
+  o(0x8b); // mov (r), r
+  g(r * 9);
+  o(0x81); // add $sym@tlsoff, r
+  g(0xc0 + r);
+  greloc(vtop->sym, vtop->c.ul, R_386_TLS_LDO_32);
+
+  vtop->r = (vtop->r & ~(VT_VALMASK | VT_SYM)) | r;
+  vtop->c.ul = 0;
+}
+
 // Output constant with relocation if 'r & VT_SYM' is true
 void gen_addr32(int r, Sym *sym, int c) {
   if (r & VT_SYM) {
-    greloc(sym, c, 0);
+    greloc(sym, c, R_386_32);
   } else {
     gen_le32(c);
   }
 }
 
 void mark_code_buffer(CodeBuffer *cb) {
+  reg_cache_flush();
   cb->code = NULL;
   cb->ind = ind;
   cb->branch = NULL;
   cb->br = br;
 }
 
-void cut_code_buffer(CodeBuffer *cb) {
+// Jump targets in a code buffer are stored relative to the buffer. Zero
+// is the end of a jump chain, positive values are branches in the buffer
+// and negative values are labels outside the buffer.
+static int save_jump_target(CodeBuffer *cb, int t) {
+  if (t == 0) return 0;
+  if (t >= cb->br && t < br) return t - cb->br + 1;
+  return -t;
+}
+
+static int load_jump_target(int t, int br_ofs) {
+  if (t == 0) return 0;
+  if (t > 0) return t - 1 + br_ofs;
+  return -t;
+}
+
+static void save_code_buffer(CodeBuffer *cb) {
   int i;
   int code_buffer_size = ind - cb->ind;
   int branch_buffer_size = br - cb->br;
@@ -218,15 +290,50 @@ void cut_code_buffer(CodeBuffer *cb) {
   for (i = 0; i < branch_buffer_size; ++i) {
     Branch *b = cb->branch + i;
     b->ind -= cb->ind;
-    if (b->type == CodeJump) b->target -= cb->br;
+    if (b->type == CodeJump) b->target = save_jump_target(cb, b->target);
+  }
+}
+
+void cut_code_buffer(CodeBuffer *cb) {
+  save_code_buffer(cb);
+  cb->ind = ind - cb->ind;
+  cb->br = br - cb->br;
+  ind -= cb->ind;
+  br -= cb->br;
+  reg_cache_flush();
+}
+
+// Copy the code generated since mark_code_buffer() so it can be pasted a
+// second time. All jumps must stay inside the buffer or go to labels
+// before it, except for the jump chain 'chain' that leaves the buffer.
+// Returns zero if the code cannot be duplicated.
+int copy_code_buffer(CodeBuffer *cb, int chain) {
+  int i, t, ends;
+  Branch *b;
+
+  ends = 0;
+  for (i = cb->br; i < br; ++i) {
+    b = branch + i;
+    if (b->type == CodeLabel && b->sym) return 0;
+    if (b->type != CodeJump) continue;
+    t = b->target;
+    if (t == 0) {
+      ends++;
+    } else if ((t < cb->br || t >= br) && branch[t].type != CodeLabel) {
+      return 0;
+    }
   }
-  ind = cb->ind;
-  br = cb->br;
-  cb->ind = code_buffer_size;
-  cb->br = branch_buffer_size;
+  if (ends != (chain != 0)) return 0;
+
+  save_code_buffer(cb);
+  cb->ind = ind - cb->ind;
+  cb->br = br - cb->br;
+  return 1;
 }
 
-void paste_code_buffer(CodeBuffer *cb) {
+// Insert code buffer at the current position and return the branch index
+// of the start of the pasted code.
+int paste_code_buffer(CodeBuffer *cb) {
   int i;
   int ind_ofs = ind;
   int br_ofs = br;
@@ -236,11 +343,13 @@ void paste_code_buffer(CodeBuffer *cb) {
     Branch *b = branch + gbranch(cb->branch[i].type);
     *b = cb->branch[i];
     b->ind += ind_ofs;
-    if (b->type == CodeJump) b->target += br_ofs;
+    if (b->type == CodeJump) b->target = load_jump_target(b->target, br_ofs);
   }
 
-  free(cb->code);
-  free(cb->branch);
+  tcc_free(cb->code);
+  tcc_free(cb->branch);
+  reg_cache_flush();
+  return br_ofs;
 }
 
 void gen(int c) {
@@ -276,30 +385,369 @@ int skip_nops(int b, int skip_labels) {
   return b;
 }
 
+// Add a profile probe to conditional jump 'b'
+static void gprobe(int b) {
+  if (!prof_enabled) return;
+  branch[b].prof = ++prof_probes;
+  prof_checksum = prof_checksum * 31 + branch[b].param;
+}
+
+// Output address of profile counter data at offset 'ofs' in the record
+// of the current function
+static void gen_prof_addr(int ofs) {
+  put_elf_reloc(symtab_section, cur_text_section, cur_text_section->data_offset, R_386_32, prof_sym);
+  genword(prof_base + ofs);
+}
+
+// Increment 64-bit profile counter 'n'
+static void gen_prof_count(int n, int save_flags) {
+  if (save_flags) gen(0x9c); // pushf
+  gen(0x83); // addl $1, counter
+  gen(0x05);
+  gen_prof_addr(n * 8);
+  gen(1);
+  gen(0x83); // adcl $0, counter+4
+  gen(0x15);
+  gen_prof_addr(n * 8 + 4);
+  gen(0);
+  if (save_flags) gen(0x9d); // popf
+}
+
+// Check if the flags are used by a conditional jump at branch point 'b'
+// with no code in between, like in 64-bit compares
+static int prof_flags_live(int b) {
+  int n;
+
+  n = skip_nops(b, 1);
+  if (branch[n].ind != branch[b].ind || !branch[n].param) return 0;
+  return branch[n].type == CodeJump || branch[n].type == CodeShortJump;
+}
+
+// Size of the fall-through counter after conditional jump 'b'
+static int prof_probe_size(int b) {
+  return prof_flags_live(b + 1) ? 16 : 14;
+}
+
+// Move fall-through blocks of conditional jumps out of line when the
+// profile shows they are rarely executed. A block ends with an
+// unconditional jump, so it can be placed after the function epilog. The
+// conditional jump is inverted to jump to the block, and a jump to the
+// original target is added, which is removed if the target follows.
+static void layout_cold_blocks(unsigned int *counts) {
+  int i, j, k, n, nsegs, pos;
+  int *map, *seg, *seg_label;
+  unsigned int taken, fall;
+  unsigned char *new_code;
+  Branch *new_branch, *b;
+
+  // Find cold blocks. seg[i] is the block number + 1 for branch points in
+  // cold blocks and minus the block number - 1 for their jumps.
+  seg = tcc_mallocz(br * sizeof(int));
+  nsegs = 0;
+  for (i = 0; i < br; i = j) {
+    j = i + 1;
+    b = branch + i;
+    if (b->type != CodeJump || !b->param || b->prof <= 0) continue;
+    taken = counts[2 * b->prof - 1];
+    fall = counts[2 * b->prof];
+    if (taken == 0 || fall > taken / PROF_COLD_RATIO) continue;
+    for (k = j; k < br; k++) {
+      if (branch[k].type == CodeEnd) break;
+      if (branch[k].type == CodeJump && !branch[k].param) break;
+    }
+    if (branch[k].type != CodeJump) continue;
+    nsegs++;
+    seg[i] = -nsegs;
+    for (n = j; n <= k; n++) seg[n] = nsegs;
+    j = k + 1;
+  }
+  if (nsegs == 0) {
+    tcc_free(seg);
+    return;
+  }
+
+  // Compute new positions of branch points. Cold blocks are placed after
+  // the end of the function, each starting with a new label.
+  map = tcc_malloc(br * sizeof(int));
+  seg_label = tcc_malloc((nsegs + 1) * sizeof(int));
+  pos = 0;
+  for (i = 0; i < br; i++) {
+    if (seg[i] > 0) continue;
+    map[i] = pos++;
+    if (seg[i] < 0) pos++;
+  }
+  for (k = 1; k <= nsegs; k++) {
+    seg_label[k] = pos++;
+    for (i = 0; i < br; i++) {
+      if (seg[i] == k) map[i] = pos++;
+    }
+  }
+
+  // Build new code and branch buffers. The code before a branch point
+  // moves with it. The jump optimizer looks ahead of the last branch
+  // point, so spare entries are kept at the end.
+  new_code = tcc_malloc(code_size);
+  branch_size = pos + 2;
+  new_branch = tcc_mallocz(branch_size * sizeof(Branch));
+  ind = 0;
+  for (k = 0; k <= nsegs; k++) {
+    if (k > 0) {
+      b = new_branch + seg_label[k];
+      memset(b, 0, sizeof(Branch));
+      b->type = CodeLabel;
+      b->ind = ind;
+    }
+    for (i = 0; i < br; i++) {
+      if (k == 0 ? seg[i] > 0 : seg[i] != k) continue;
+      n = i > 0 ? branch[i].ind - branch[i - 1].ind : branch[i].ind;
+      memcpy(new_code + ind, code + branch[i].ind - n, n);
+      ind += n;
+      b = new_branch + map[i];
+      *b = branch[i];
+      b->ind = ind;
+      if (b->type == CodeJump) b->target = map[b->target];
+      if (seg[i] < 0) {
+        // Jump to cold block and continue at the original target
+        b[1] = *b;
+        b[1].param = 0;
+        b[1].prof = 0;
+        b->param ^= 1;
+        b->prof = -b->prof;
+        b->target = seg_label[-seg[i]];
+      }
+    }
+  }
+
+  tcc_free(code);
+  tcc_free(branch);
+  code = new_code;
+  branch = new_branch;
+  br = pos;
+  tcc_free(seg_label);
+  tcc_free(map);
+  tcc_free(seg);
+}
+
+// The instrumentation hooks find the call site through the frame pointer
+static int need_frame(void) {
+  return do_debug || min_loc || !func_noargs || func_instrument || func_mcount;
+}
+
+// Call instrumentation hook
+static void gen_hook_call(int tok) {
+  Sym *sym = external_global_sym(tok, &func_void_type, 0);
+  gen(0xe8); // call hook
+  put_reloc(cur_text_section, sym, cur_text_section->data_offset, R_386_PC32);
+  genword(-4);
+}
+
+// Call __cyg_profile_func_enter/exit(this_fn, call_site)
+static void gen_hook(int tok) {
+  gen(0xff); // push 4(%ebp)
+  gen(0x75);
+  gen(0x04);
+  gen(0x68); // push $func
+  put_reloc(cur_text_section, func_sym, cur_text_section->data_offset, R_386_32);
+  genword(0);
+  gen_hook_call(tok);
+  gen(0x83); // add $8, %esp
+  gen(0xc4);
+  gen(0x08);
+}
+
+// Size of function epilog
+static int epilog_size(int realign) {
+  int r, n;
+
+  if (func_naked) return 0;
+  n = 0;
+  for (r = 0; r <= NB_REGS; ++r) {
+    if ((reg_classes[r] & RC_SAVE) && (regs_used & (1 << r))) n++;
+  }
+  if (need_frame()) n++;
+  if (realign) n++;
+  n += func_ret_sub == 0 ? 1 : 3;
+  if (func_instrument) n += is_float(func_vt.t) ? 32 : 20;
+  return n;
+}
+
+// Generate function epilog
+static void gen_epilog(int realign) {
+  int r;
+
+  if (func_naked) return;
+
+  if (func_instrument) {
+    // Call exit hook preserving the return value
+    gen(0x50); // push %eax
+    gen(0x52); // push %edx
+    if (is_float(func_vt.t)) {
+      gen(0x83); // sub $12, %esp
+      gen(0xec);
+      gen(0x0c);
+      gen(0xdb); // fstpt (%esp)
+      gen(0x3c);
+      gen(0x24);
+    }
+    gen_hook(TOK___cyg_profile_func_exit);
+    if (is_float(func_vt.t)) {
+      gen(0xdb); // fldt (%esp)
+      gen(0x2c);
+      gen(0x24);
+      gen(0x83); // add $12, %esp
+      gen(0xc4);
+      gen(0x0c);
+    }
+    gen(0x5a); // pop %edx
+    gen(0x58); // pop %eax
+  }
+
+  // Restore callee-saved registers used by function.
+  for (r = NB_REGS; r >= 0; --r) {
+    if ((reg_classes[r] & RC_SAVE) && (regs_used & (1 << r))) {
+      gen(0x58 + r); // pop r
+    }
+  }
+
+  if (need_frame()) gen(0xc9); // leave
+  if (realign) gen(0xc9); // leave realigned frame
+
+  // Generate return
+  if (func_ret_sub == 0) {
+    gen(0xc3); // ret
+  } else {
+    gen(0xc2); // ret n
+    gen(func_ret_sub);
+    gen(func_ret_sub >> 8);
+  }
+}
+
 void gcode(void) {
-  int i, n, t, r, stacksize, addr, pc, disp, rel, errs, more, func_start;
+  int i, n, t, r, stacksize, addr, pc, disp, errs, more, func_start, realign;
+  int prof_gen, nstubs;
+  int *stubs;
+  unsigned int *prof_counts;
   Branch *b, *bn;
 
+  // Get profile for function
+  prof_gen = 0;
+  prof_counts = NULL;
+  if (prof_enabled) {
+    n = 1 + 2 * prof_probes;
+    if (tcc_state->profile_use) prof_counts = prof_lookup(tcc_state, func_name, prof_checksum, n);
+    if (tcc_state->profile_generate) {
+      prof_gen = 1;
+      prof_base = prof_record(func_name, prof_checksum, n);
+    }
+  }
+
   // Generate function prolog
   func_start = cur_text_section->data_offset;
+  if (loc < min_loc) min_loc = loc;
+
+  // Entry for callers using the default calling convention loads the
+  // register parameters from the stack
+  for (i = 0; i < func_regparm; i++) {
+    gen(0x8b); // mov 4*(i+1)(%esp), r
+    gen(0x44 + fastcall_regs[i] * 8);
+    gen(0x24);
+    gen(4 * (i + 1));
+  }
+
+  realign = 0;
   if (!func_naked) {
     // Align local size to word
-    stacksize = (-loc + 3) & -4;
+    stacksize = (-min_loc + 3) & -4;
+
+    // The stack is only word aligned on entry, so variables with larger
+    // alignment than the basic types need a realigned frame
+    if (loc_align > MAX_ALIGN) {
+      if (func_vararg) error("cannot align local variables to %d bytes in variadic function", loc_align);
+      realign = 1;
+    }
 
-    if (stacksize >= 4096) {
+    if (stacksize >= 4096 && !func_eax_param && !realign) {
       // Generate stack guard since parameters can cross page boundary
       Sym *sym = external_global_sym(TOK___chkstk, &func_old_type, 0);
+      stats_helper(TOK___chkstk);
       gen(0xb8); // mov stacksize, %eax
       genword(stacksize);
       gen(0xe8);  // call __chkstk, (does the stackframe too)
       put_reloc(cur_text_section, sym, cur_text_section->data_offset, R_386_PC32);
       genword(-4);
     } else {
-      if (do_debug || loc || !func_noargs) {
+      if (need_frame()) {
+        gen(0x55); // push %ebp
+        gen(0x89); // mov %esp, %ebp
+        gen(0xe5);
+      }
+      if (realign) {
+        // Build a new frame on an aligned stack with a copy of the return
+        // address and the parameters, so %ebp is aligned
+        if (-loc_align == (char) -loc_align) {
+          gen(0x83); // and $-loc_align, %esp
+          gen(0xe4);
+          gen(-loc_align);
+        } else {
+          gen(0x81); // and $-loc_align, %esp
+          gen(0xe4);
+          genword(-loc_align);
+        }
+        n = (-(func_args_size + 8)) & (loc_align - 1);
+        if (n > 0 && n == (char) n) {
+          gen(0x83); // sub $n, %esp
+          gen(0xec);
+          gen(n);
+        } else if (n > 0) {
+          gen(0x81); // sub $n, %esp
+          gen(0xec);
+          genword(n);
+        }
+        for (i = func_args_size + 4; i >= 4; i -= 4) {
+          gen(0xff); // push i(%ebp)
+          if (i == (char) i) {
+            gen(0x75);
+            gen(i);
+          } else {
+            gen(0xb5);
+            genword(i);
+          }
+        }
         gen(0x55); // push %ebp
         gen(0x89); // mov %esp, %ebp
         gen(0xe5);
       }
+      // __chkstk uses %eax, so probe the stack inline when it holds a
+      // parameter. %eax is saved in the first word of the frame and used
+      // as the page counter.
+      if (stacksize >= 8192) {
+        n = (stacksize - 4) / 4096;
+        gen(0x50);  // push %eax
+        gen(0xb8);  // mov n, %eax
+        genword(n);
+        gen(0x81);  // 1: sub esp, 4096
+        gen(0xec);
+        genword(4096);
+        gen(0x85);  // test %eax, (%esp)
+        gen(0x04);
+        gen(0x24);
+        gen(0x48);  // dec %eax
+        gen(0x75);  // jnz 1b
+        gen(-12);
+        gen(0x8b);  // mov n*4096(%esp), %eax
+        gen(0x84);
+        gen(0x24);
+        genword(n * 4096);
+        stacksize -= 4 + n * 4096;
+      } else if (stacksize >= 4096) {
+        gen(0x81);  // sub esp, 4096
+        gen(0xec);
+        genword(4096);
+        gen(0x85);  // test %eax, (%esp)
+        gen(0x04);
+        gen(0x24);
+        stacksize -= 4096;
+      }
       if (stacksize > 0) {
         if (stacksize == (char) stacksize) {
           gen(0x83);  // sub esp, stacksize
@@ -321,6 +769,60 @@ void gcode(void) {
     }
   }
 
+  // Call instrumentation hooks saving register parameters around them
+  if (func_mcount || func_instrument) {
+    if (func_reg_params) {
+      gen(0x50); // push %eax
+      gen(0x51); // push %ecx
+      gen(0x52); // push %edx
+    }
+    if (func_mcount) gen_hook_call(TOK_mcount);
+    if (func_instrument) gen_hook(TOK___cyg_profile_func_enter);
+    if (func_reg_params) {
+      gen(0x5a); // pop %edx
+      gen(0x59); // pop %ecx
+      gen(0x58); // pop %eax
+    }
+  }
+
+  if (prof_gen) {
+    // Register profile writer at program start
+    if (!strcmp(func_name, "main")) {
+      Sym *sym = external_global_sym(TOK___prof_init, &func_old_type, 0);
+      gen(0x60); // pusha
+      gen(0xe8); // call __prof_init
+      put_reloc(cur_text_section, sym, cur_text_section->data_offset, R_386_PC32);
+      genword(-4);
+      gen(0x61); // popa
+    }
+
+    // Count function entry
+    gen_prof_count(0, 0);
+  }
+
+  if (prof_counts) {
+    if (prof_counts[0] == 0) {
+      // Do not pad functions that were never executed
+      for (i = 0; i < br; ++i) {
+        if (branch[i].type == CodeAlign) branch[i].type = CodeNop;
+      }
+    } else {
+      layout_cold_blocks(prof_counts);
+    }
+  }
+
+  if (cur_stats) {
+    cur_stats->prolog_size = cur_text_section->data_offset - func_start;
+    cur_stats->epilog_size = epilog_size(realign);
+    cur_stats->frame_size = func_naked ? 0 : (-min_loc + 3) & -4;
+    for (r = 0; r < NB_REGS; ++r) {
+      if ((reg_classes[r] & RC_SAVE) && (regs_used & (1 << r))) cur_stats->saved_regs |= 1 << r;
+    }
+    for (i = 0; i < br; ++i) {
+      if (branch[i].type == CodeJump) cur_stats->removed_jumps++;
+    }
+  }
+
   // Optimize jumps
   more = 1;
   while (more) {
@@ -363,6 +865,7 @@ void gcode(void) {
       if (bn->type == CodeJump && !bn->param && b->target == t && bn->ind == branch[t].ind) {
         // Optimize inverted jump
         if (b->param) b->param ^= 1;
+        b->prof = -b->prof;
         b->target = bn->target;
         bn->type = CodeNop;
         more = 1;
@@ -396,26 +899,40 @@ void gcode(void) {
       case CodeJump:
         addr += 5;
         if (b->param != 0) addr++;
+        if (prof_gen && b->prof) addr += prof_probe_size(i);
         break;
         
       case CodeAlign:
         // Use convervative estimate for short/long jump estimation
         addr += b->param - 1;
         break;
+
+      case CodeEnd:
+        addr += epilog_size(realign);
+        break;
     }
     pc = b->ind;
   }
   
-  // Find jumps which can be encoded as short jumps
+  // Find jumps which can be encoded as short jumps. Jumps with profile
+  // probes always jump to a counter stub after the function.
   for (i = 0; i < br; ++i) {
     b = branch + i;
-    if (b->type == CodeJump) {
+    if (b->type == CodeJump && !(prof_gen && b->prof)) {
       disp = branch[b->target].addr - b->addr - 2;
       if (b->param) disp--;
       if (disp == (char) disp) b->type = CodeShortJump;
     }
   }
 
+  if (cur_stats) {
+    for (i = 0; i < br; ++i) {
+      if (branch[i].type == CodeJump) cur_stats->long_jumps++;
+      if (branch[i].type == CodeShortJump) cur_stats->short_jumps++;
+    }
+    cur_stats->removed_jumps -= cur_stats->long_jumps + cur_stats->short_jumps;
+  }
+
   // Assign final addresses to branch points
   addr = cur_text_section->data_offset;
   pc = 0;
@@ -427,6 +944,7 @@ void gcode(void) {
       case CodeJump:
         addr += 5;
         if (b->param) addr++;
+        if (prof_gen && b->prof) addr += prof_probe_size(i);
         break;
 
       case CodeShortJump:
@@ -436,6 +954,10 @@ void gcode(void) {
       case CodeAlign:
         addr = (addr + b->param - 1) & -b->param;
         break;
+
+      case CodeEnd:
+        addr += epilog_size(realign);
+        break;
     }
     pc = b->ind;
   }
@@ -443,6 +965,8 @@ void gcode(void) {
   // Generate code blocks
   pc = 0;
   errs = 0;
+  nstubs = 0;
+  stubs = prof_gen ? tcc_malloc(br * sizeof(int)) : NULL;
   for (i = 0; i < br; ++i) {
     b = branch + i;
     
@@ -471,6 +995,13 @@ void gcode(void) {
         if (b->param == 0) {
           gen(0xe9);
           genword(branch[b->target].addr - (b->addr + 5));
+        } else if (prof_gen && b->prof) {
+          // Jump to stub counting the taken edge and count fall-through
+          gen(0x0f);
+          gen(b->param - 0x10);
+          genword(0);
+          stubs[nstubs++] = i;
+          gen_prof_count(b->prof > 0 ? 2 * b->prof : -2 * b->prof - 1, prof_flags_live(i + 1));
         } else {
           gen(0x0f);
           gen(b->param - 0x10);
@@ -493,47 +1024,46 @@ void gcode(void) {
         break;
 
       case CodeReloc:
-        if (b->param) {
-          rel = R_386_PC32;
-        } else {
-          rel = R_386_32;
-        }
-        put_elf_reloc(symtab_section, cur_text_section, b->addr, rel, b->target);
+        put_elf_reloc(symtab_section, cur_text_section, b->addr, b->param, b->target);
         break;
         
       case CodeAlign:
-        i = addr;
-        while (i & (b->param - 1)) {
+        n = b->addr;
+        while (n & (b->param - 1)) {
           gen(b->target);
-          i++;
+          n++;
         }
         break;
 
       case CodeLine:
-        put_stabn(N_SLINE, 0, b->target, b->addr - func_start);
+        if (do_debug == DEBUG_STABS) {
+          put_stabn(N_SLINE, 0, b->target, b->addr - func_start);
+        } else {
+          put_line(b->addr - func_start, b->target, b->param);
+        }
         break;
-    }
-  }
 
-  // Generate function epilog
-  if (!func_naked) {
-    // Restore callee-saved registers used by function.
-    for (r = NB_REGS; r >= 0; --r) {
-      if ((reg_classes[r] & RC_SAVE) && (regs_used & (1 << r))) {
-        gen(0x58 + r); // pop r
-      }
+      case CodeEnd:
+        // Generate function epilog. Cold blocks can follow it.
+        gen_epilog(realign);
+        break;
     }
+  }
 
-    if (do_debug || loc || !func_noargs) gen(0xc9); // leave
+  // Generate stubs counting the taken edges of conditional jumps
+  for (i = 0; i < nstubs; ++i) {
+    b = branch + stubs[i];
+    addr = cur_text_section->data_offset;
+    *(int *) (cur_text_section->data + b->addr + 2) = addr - (b->addr + 6);
+    gen_prof_count(b->prof > 0 ? 2 * b->prof - 1 : -2 * b->prof, prof_flags_live(b->target));
+    gen(0xe9); // jmp target
+    genword(branch[b->target].addr - (cur_text_section->data_offset + 4));
+  }
+  tcc_free(stubs);
 
-    // Generate return
-    if (func_ret_sub == 0) {
-      gen(0xc3); // ret
-    } else {
-      gen(0xc2); // ret n
-      gen(func_ret_sub);
-      gen(func_ret_sub >> 8);
-    }
+  if (cur_stats) {
+    cur_stats->size = cur_text_section->data_offset - func_start;
+    cur_stats = NULL;
   }
 
 #ifdef DEBUG_BRANCH
@@ -578,7 +1108,7 @@ void gen_modrm(int op_reg, int r, Sym *sym, int c) {
 
 // Load 'r' from value 'sv'
 void load(int r, SValue *sv) {
-  int v, t, ft, fc, fr, a;
+  int v, t, ft, fc, fr, a, dr;
   SValue v1;
 
   fr = sv->r;
@@ -586,6 +1116,18 @@ void load(int r, SValue *sv) {
   fc = sv->c.ul;
   regs_used |= 1 << r;
 
+  // Copy local variable from register if it has already been loaded
+  v = reg_cache_find(sv);
+  if (v >= 0) {
+    if (v != r) {
+      o(0x89);
+      o(0xc0 + r + v * 8); // mov v, r
+    }
+    reg_cache_load(r, sv);
+    return;
+  }
+  dr = r;
+
   v = fr & VT_VALMASK;
   if (fr & VT_LVAL) {
     if (v == VT_LLOCAL) {
@@ -647,17 +1189,20 @@ void load(int r, SValue *sv) {
       o(0xc0 + r + v * 8); // mov v, r
     }
   }
+  reg_cache_load(dr, sv);
 }
 
 // Store register 'r' in lvalue 'v'
 void store(int r, SValue *v) {
-  int fr, bt, ft, fc;
+  int fr, bt, ft, fc, sr, size;
 
   ft = v->type.t;
   fc = v->c.ul;
   fr = v->r & VT_VALMASK;
   bt = ft & VT_BTYPE;
   regs_used |= 1 << r;
+  sr = r;
+  size = 4;
 
   // TODO: incorrect if float reg to reg
   if (bt == VT_FLOAT) {
@@ -666,14 +1211,20 @@ void store(int r, SValue *v) {
   } else if (bt == VT_DOUBLE) {
     o(0xdd); // fstpl
     r = 2;
+    size = 8;
   } else if (bt == VT_LDOUBLE) {
     o(0xc0d9); // fld %st(0)
     o(0xdb); // fstpt
     r = 7;
+    size = LDOUBLE_SIZE;
   } else {
-    if (bt == VT_SHORT) o(0x66);
+    if (bt == VT_SHORT) {
+      o(0x66);
+      size = 2;
+    }
     if (bt == VT_BYTE || bt == VT_BOOL) {
       o(0x88);
+      size = 1;
     } else {
       o(0x89);
     }
@@ -683,6 +1234,7 @@ void store(int r, SValue *v) {
   } else if (fr != r) {
     o(0xc0 + fr + r * 8); // mov r, fr
   }
+  reg_cache_store(sr, v, size);
 }
 
 void gadd_sp(int val) {
@@ -704,7 +1256,7 @@ void gcall_or_jmp(int is_jmp) {
     o(0xe8 + is_jmp); // call/jmp im
     sym = NULL;
     if (vtop->r & VT_SYM) sym = vtop->sym;
-    greloc(sym, vtop->c.ul - 4, 1);
+    greloc(sym, vtop->c.ul - 4, R_386_PC32);
   } else {
     // Otherwise, indirect call
     r = gv(RC_INT);
@@ -713,8 +1265,67 @@ void gcall_or_jmp(int is_jmp) {
   }
 }
 
-static uint8_t fastcall_regs[3] = { TREG_EAX, TREG_EDX, TREG_ECX };
-static uint8_t fastcallw_regs[2] = { TREG_ECX, TREG_EDX };
+
+// Return true if a parameter of type 'type' can be passed in a register
+static int regparm_type(CType *type) {
+  int bt = type->t & VT_BTYPE;
+
+  return bt == VT_INT || bt == VT_PTR || bt == VT_BYTE || bt == VT_SHORT || bt == VT_BOOL;
+}
+
+// Return the number of parameters of function 'sym' that can be passed in
+// registers
+static int regparm_params(Sym *s) {
+  int n;
+
+  if (FUNC_CALL(s->r) != FUNC_CDECL || FUNC_NAKED(s->r) || s->c != FUNC_NEW) return 0;
+  if ((s->type.t & VT_BTYPE) == VT_STRUCT || (s->type.t & VT_BTYPE) == VT_VECTOR) return 0;
+  n = 0;
+  while ((s = s->next) != NULL) {
+    if (!regparm_type(&s->type)) return 0;
+    if (++n > 3) return 0;
+  }
+  return n;
+}
+
+// Return the number of parameters passed in registers to a static function
+// that is called directly. Such functions have an entry point for other
+// callers that loads the parameters from the stack, followed by the entry
+// point for direct calls. The decision is made at the first declaration and
+// kept in the function type, so callers and the definition agree on it.
+int gfunc_regparm(CType *func_type) {
+  Sym *s;
+
+  if (!tcc_state->auto_regparm) return 0;
+  if ((func_type->t & (VT_BTYPE | VT_STATIC)) != (VT_FUNC | VT_STATIC)) return 0;
+  s = func_type->ref;
+  if (!FUNC_REGPARM_SET(s->r)) {
+    FUNC_REGPARM(s->r) = regparm_params(s);
+    FUNC_REGPARM_SET(s->r) = 1;
+  }
+  return FUNC_REGPARM(s->r);
+}
+
+// Update the register parameters of function 'sym' for a later declaration
+// or the definition of it with type 'type'. An old-style or different
+// declaration turns them off, unless a direct call has already passed
+// parameters in registers. Then the definition must take them too.
+void gfunc_regparm_redecl(Sym *sym, CType *type) {
+  Sym *s, *t;
+  int n, i;
+
+  s = sym->type.ref;
+  t = type->ref;
+  n = gfunc_regparm(&sym->type);
+  if (n == 0) return;
+  if (FUNC_REGPARM_USED(s->r)) {
+    for (i = 0, t = t->next; i < n && t; i++, t = t->next) {
+      if (!regparm_type(&t->type)) error("conflicting types for '%s'", get_tok_str(sym->v, NULL));
+    }
+  } else if (regparm_params(t) != n) {
+    FUNC_REGPARM(s->r) = 0;
+  }
+}
 
 // Generate function call. The function address is pushed first, then
 // all the parameters in call order. This function pops all the
@@ -725,7 +1336,7 @@ void gfunc_call(int nb_args) {
   
   args_size = 0;
   for (i = 0; i < nb_args; i++) {
-    if ((vtop->type.t & VT_BTYPE) == VT_STRUCT) {
+    if ((vtop->type.t & VT_BTYPE) == VT_STRUCT || (vtop->type.t & VT_BTYPE) == VT_VECTOR) {
       size = type_size(&vtop->type, &align);
       // Align to stack align size
       size = (size + 3) & ~3;
@@ -800,6 +1411,17 @@ void gfunc_call(int nb_args) {
   func_sym = vtop->type.ref;
   func_call = FUNC_CALL(func_sym->r);
 
+  // Direct calls to static functions skip the stack parameter entry
+  v = vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM);
+  if (v == (VT_CONST | VT_SYM) && vtop->c.i == 0 && vtop->sym->type.ref == func_sym) {
+    i = gfunc_regparm(&vtop->sym->type);
+    if (i) {
+      FUNC_REGPARM_USED(func_sym->r) = 1;
+      func_call = FUNC_FASTCALL1 + i - 1;
+      vtop->c.i = i * 4;
+    }
+  }
+
   // fast call case
   if ((func_call >= FUNC_FASTCALL1 && func_call <= FUNC_FASTCALL3) ||
     func_call == FUNC_FASTCALLW) {
@@ -822,6 +1444,9 @@ void gfunc_call(int nb_args) {
   gcall_or_jmp(0);
   if (args_size && func_call != FUNC_STDCALL) gadd_sp(args_size);
   vtop--;
+
+  // Function can modify scratch registers and local variables
+  reg_cache_flush();
 }
 
 // Generate function prolog of type 't'
@@ -836,14 +1461,25 @@ void gfunc_prolog(CType *func_type) {
   printf("compile %s\n", func_name);
 #endif
   reset_code_buf();
+  reg_cache_flush();
   gbranch(CodeStart);
 
   sym = func_type->ref;
   func_naked = FUNC_NAKED(sym->r);
   func_call = FUNC_CALL(sym->r);
+  prof_enabled = !func_naked && (tcc_state->profile_generate || tcc_state->profile_use);
+  prof_probes = 0;
+  prof_checksum = 0;
+  func_instrument = !func_naked && !FUNC_NOINSTR(sym->r) && tcc_state->instrument_functions;
+  func_mcount = !func_naked && !FUNC_NOINSTR(sym->r) && tcc_state->profile_mcount;
   addr = 8;
   loc = 0;
+  min_loc = 0;
+  loc_align = 0;
   regs_used = 0;
+  if (tcc_state->stats) stats_begin(tcc_state, func_name);
+  func_regparm = gfunc_regparm(func_type);
+  if (func_regparm) func_call = FUNC_FASTCALL1 + func_regparm - 1;
   if (func_call >= FUNC_FASTCALL1 && func_call <= FUNC_FASTCALL3) {
     fastcall_nb_regs = func_call - FUNC_FASTCALL1 + 1;
     fastcall_regs_ptr = fastcall_regs;
@@ -858,7 +1494,7 @@ void gfunc_prolog(CType *func_type) {
 
   // If the function returns a structure, then add an implicit pointer parameter
   func_vt = sym->type;
-  if ((func_vt.t & VT_BTYPE) == VT_STRUCT) {
+  if ((func_vt.t & VT_BTYPE) == VT_STRUCT || (func_vt.t & VT_BTYPE) == VT_VECTOR) {
     // TODO: fastcall case?
     func_vc = addr;
     addr += 4;
@@ -891,15 +1527,24 @@ void gfunc_prolog(CType *func_type) {
   if (func_call == FUNC_STDCALL) func_ret_sub = addr - 8;
   
   func_noargs = (addr == 8);
+  func_args_size = addr - 8;
+  func_vararg = func_type->ref->c == FUNC_ELLIPSIS;
+  func_eax_param = fastcall_regs_ptr == fastcall_regs && param_index > 0;
+  func_reg_params = fastcall_nb_regs > 0 && param_index > 0;
 }
 
 // Generate function epilog
 void gfunc_epilog(void) {
+  int phase;
+
   // Mark end of code
   gbranch(CodeEnd);
   
   // Output code for function
+  phase = bench_phase(BENCH_GCODE);
   gcode();
+  bench_phase(phase);
+  prof_enabled = 0;
 
   // Clear code buffer
   clear_code_buf();
@@ -907,22 +1552,18 @@ void gfunc_epilog(void) {
 
 // Generate a test. set 'inv' to invert test. Stack entry is popped.
 int gtst(int inv, int t) {
-  int v, r, *p;
+  int v, r;
 
   v = vtop->r & VT_VALMASK;
   if (v == VT_CMP) {
     // Fast case: can jump directly since flags are set
     t = gjmp(t, vtop->c.i ^ inv); // jcc t
+    gprobe(t);
   } else if (v == VT_JMP || v == VT_JMPI) {
     // && or || optimization
     if ((v & 1) == inv) {
       // Insert vtop->c jump list in t
-      p = &vtop->c.i;
-      while (*p != 0) {
-        p = &branch[*p].target;
-      }
-      *p = t;
-      t = vtop->c.i;
+      t = gchain(vtop->c.i, t);
     } else {
       t = gjmp(t, 0);
       gsym(vtop->c.i);
@@ -940,6 +1581,7 @@ int gtst(int inv, int t) {
       o(0x85);  // test r,r
       o(0xc0 + r * 9);
       t = gjmp(t, TOK_NE ^ inv); // jz/jnz t
+      gprobe(t);
     }
   }
   vtop--;
@@ -983,6 +1625,7 @@ void gen_opi(int op) {
         o((opc << 3) | 0x01);
         o(0xc0 + r + fr * 8); 
       }
+      reg_cache_kill(r);
       vtop--;
       if (op >= TOK_ULT && op <= TOK_GT) {
         vtop->r = VT_CMP;
@@ -1015,6 +1658,7 @@ void gen_opi(int op) {
       vtop--;
       o(0xaf0f); // imul fr, r
       o(0xc0 + fr + r * 8);
+      reg_cache_kill(r);
       break;
     case TOK_SHL:
       opc = 4;
@@ -1042,6 +1686,7 @@ void gen_opi(int op) {
         o(0xd3); // shl/shr/sar %cl, r
         o(opc | r);
       }
+      reg_cache_kill(r);
       vtop--;
       break;
     case '/':
@@ -1076,6 +1721,8 @@ void gen_opi(int op) {
           r = TREG_EAX;
         }
       }
+      reg_cache_kill(TREG_EAX);
+      reg_cache_kill(TREG_EDX);
       vtop->r = r;
       break;
     default:
@@ -1084,6 +1731,638 @@ void gen_opi(int op) {
   }
 }
 
+// Generate a long long shift by a variable number of bits
+void gen_opl_shift(int op) {
+  int t, v, r, lo, hi, b;
+
+  // Flags must be used before generating the value
+  v = vtop->r & VT_VALMASK;
+  if (v == VT_CMP || (v & ~1) == VT_JMP) gv(RC_ECX);
+  save_regs(2);
+
+  // Generate the value in two registers other than ecx
+  t = vtop[-1].type.t;
+  vswap();
+  gv(RC_INT);
+  if (vtop->r == TREG_ECX || vtop->r2 == TREG_ECX) {
+    r = get_reg(RC_INT);
+    o(0x89); // mov %ecx, r
+    o(0xc8 + r);
+    if (vtop->r == TREG_ECX) {
+      vtop->r = r;
+    } else {
+      vtop->r2 = r;
+    }
+  }
+  vswap();
+
+  // Generate the shift count in ecx
+  gv(RC_ECX);
+  lo = vtop[-1].r;
+  hi = vtop[-1].r2;
+  if (op == TOK_SHL) {
+    o(0xa50f); // shld %cl, lo, hi
+    o(0xc0 + hi + lo * 8);
+    o(0xe0d3 + (lo << 8)); // shl %cl, lo
+  } else {
+    o(0xad0f); // shrd %cl, hi, lo
+    o(0xc0 + lo + hi * 8);
+    if (op == TOK_SAR) {
+      o(0xf8d3 + (hi << 8)); // sar %cl, hi
+    } else {
+      o(0xe8d3 + (hi << 8)); // shr %cl, hi
+    }
+  }
+
+  // The shift instructions only use the low five bits of the count
+  o(0x20c1f6); // test $32, %cl
+  b = gjmp(0, TOK_EQ);
+  if (op == TOK_SHL) {
+    o(0x89); // mov lo, hi
+    o(0xc0 + hi + lo * 8);
+    o(0x31); // xor lo, lo
+    o(0xc0 + lo * 9);
+  } else {
+    o(0x89); // mov hi, lo
+    o(0xc0 + lo + hi * 8);
+    if (op == TOK_SAR) {
+      o(0xc1); // sar $31, hi
+      o(0xf8 + hi);
+      g(31);
+    } else {
+      o(0x31); // xor hi, hi
+      o(0xc0 + hi * 9);
+    }
+  }
+  gsym(b);
+  reg_cache_kill(lo);
+  reg_cache_kill(hi);
+  vtop--;
+  vtop->type.t = t;
+}
+
+// Registers that have byte forms
+#define RC_BYTE (RC_EAX | RC_ECX | RC_EDX)
+
+// Generate instruction with register 'r' and a memory operand of 'size'
+// bytes addressed by register 'p'. 'opc' is the byte form of the opcode.
+static void gen_memop(int opc, int size, int r, int p) {
+  if (size == 2) g(0x66);
+  if (opc > 0xff) g(opc >> 8);
+  g((opc & 0xff) + (size != 1));
+  g(r * 8 + p);
+}
+
+// Sign or zero extend byte or short value in register r
+static void gen_extend(int r, int t) {
+  int bt;
+
+  bt = t & VT_BTYPE;
+  if (bt == VT_BYTE || bt == VT_BOOL) {
+    o(t & VT_UNSIGNED || bt == VT_BOOL ? 0xb60f : 0xbe0f); // movzbl/movsbl r, r
+  } else if (bt == VT_SHORT) {
+    o(t & VT_UNSIGNED ? 0xb70f : 0xbf0f); // movzwl/movswl r, r
+  } else {
+    return;
+  }
+  o(0xc0 + r * 9);
+}
+
+// Store long long vtop in a new stack slot and return its offset
+static int gen_llong_slot(void) {
+  SValue sv;
+
+  gv(RC_INT);
+  loc = (loc - 8) & -4;
+  sv.type.t = VT_INT;
+  sv.r = VT_LOCAL | VT_LVAL;
+  sv.c.ul = loc;
+  store(vtop->r, &sv);
+  sv.c.ul += 4;
+  store(vtop->r2, &sv);
+  vtop->r = VT_LOCAL | VT_LVAL;
+  vtop->r2 = VT_CONST;
+  vtop->c.ul = loc;
+  return loc;
+}
+
+// Generate 64-bit atomic operation with a lock cmpxchg8b loop. The
+// operand is kept in memory, since all other registers are needed.
+static void gen_atomic_llong(int op, int fetch_new) {
+  static const uint8_t opcodes[] = { '+', 0x03, 0x13, '-', 0x2b, 0x1b, '&', 0x23, 0x23,
+                                     '~', 0x23, 0x23, '|', 0x0b, 0x0b, '^', 0x33, 0x33, 0 };
+  int v, p, l, i;
+  CType type;
+
+  type = vtop->type;
+  v = gen_llong_slot();
+  save_regs(2);
+  vswap();
+  gv(RC_EAX);
+  vswap();
+  reg_cache_flush();
+
+  p = TREG_ESI;
+  g(0x56); // push %esi
+  g(0x53); // push %ebx
+  o(0xc689); // mov %eax, %esi
+  o(0x8b); // mov (p), %eax
+  g(p);
+  o(0x8b); // mov 4(p), %edx
+  g(0x50 + p);
+  g(4);
+  if (op == '=') {
+    o(0x8b); // mov v, %ebx
+    gen_modrm(TREG_EBX, VT_LOCAL, NULL, v);
+    o(0x8b); // mov v+4, %ecx
+    gen_modrm(TREG_ECX, VT_LOCAL, NULL, v + 4);
+  }
+  l = glabel();
+  if (op != '=') {
+    for (i = 0; opcodes[i] != op; i += 3);
+    o(0xc389); // mov %eax, %ebx
+    o(0xd189); // mov %edx, %ecx
+    o(opcodes[i + 1]); // op v, %ebx
+    gen_modrm(TREG_EBX, VT_LOCAL, NULL, v);
+    o(opcodes[i + 2]); // op v+4, %ecx
+    gen_modrm(TREG_ECX, VT_LOCAL, NULL, v + 4);
+    if (op == '~') {
+      o(0xd3f7); // not %ebx
+      o(0xd1f7); // not %ecx
+    }
+  }
+  o(0xc70ff0); // lock cmpxchg8b (p)
+  g(0x08 + p);
+  gjmp(l, TOK_NE);
+  if (fetch_new) {
+    o(0xd889); // mov %ebx, %eax
+    o(0xca89); // mov %ecx, %edx
+  }
+  g(0x5b); // pop %ebx
+  g(0x5e); // pop %esi
+
+  vtop--;
+  vtop->type = type;
+  vtop->r = TREG_EAX;
+  vtop->r2 = TREG_EDX;
+}
+
+// Generate atomic read-modify-write operation on the object pointed to by
+// vtop[-1] with the operand in vtop[0]. 'op' is one of '=', '+', '-', '&',
+// '|', '^' or '~' for nand. The result is the old value of the object, or
+// the new value if 'fetch_new' is set.
+void gen_atomic(int op, int fetch_new) {
+  int v, p, r, size, align;
+  CType type;
+
+  type = vtop->type;
+  size = type_size(&type, &align);
+  if (size == 8) {
+    gen_atomic_llong(op, fetch_new);
+    return;
+  }
+
+  // Flags must be used before generating the other operands
+  v = vtop->r & VT_VALMASK;
+  if (v == VT_CMP || (v & ~1) == VT_JMP) gv(RC_INT);
+  save_regs(2);
+
+  if (op == '=' || op == '+' || op == '-') {
+    // Exchange and add can be done in one instruction
+    gv2(RC_INT, RC_BYTE);
+    p = vtop[-1].r;
+    v = vtop->r;
+    reg_cache_flush();
+    if (op == '-') o(0xd8f7 + (v << 8)); // neg v
+    if (fetch_new) {
+      r = get_reg(RC_INT);
+      o(0x89); // mov v, r
+      o(0xc0 + r + v * 8);
+    }
+    if (op == '=') {
+      gen_memop(0x86, size, v, p); // xchg v, (p)
+    } else {
+      g(0xf0);
+      gen_memop(0x0fc0, size, v, p); // lock xadd v, (p)
+    }
+    if (fetch_new) {
+      o(0x01); // add r, v
+      o(0xc0 + v + r * 8);
+    }
+    r = v;
+  } else {
+    // Compute new value in %ebx from the old value in %eax until it is
+    // stored without interference
+    gv2(RC_ECX, RC_EDX);
+    reg_cache_flush();
+    g(0x53); // push %ebx
+    gen_memop(0x8a, size, TREG_EAX, TREG_ECX); // mov (%ecx), %eax
+    r = glabel();
+    o(0xc389); // mov %eax, %ebx
+    if (op == '|') {
+      o(0xd309); // or %edx, %ebx
+    } else if (op == '^') {
+      o(0xd331); // xor %edx, %ebx
+    } else {
+      o(0xd321); // and %edx, %ebx
+      if (op == '~') o(0xd3f7); // not %ebx
+    }
+    g(0xf0);
+    gen_memop(0x0fb0, size, TREG_EBX, TREG_ECX); // lock cmpxchg %ebx, (%ecx)
+    gjmp(r, TOK_NE);
+    if (fetch_new) o(0xd989); // mov %ebx, %ecx
+    g(0x5b); // pop %ebx
+    r = fetch_new ? TREG_ECX : TREG_EAX;
+  }
+  gen_extend(r, type.t);
+
+  vtop--;
+  vtop->type = type;
+  vtop->r = r;
+  vtop->r2 = VT_CONST;
+}
+
+// Generate atomic compare and exchange of the object pointed to by vtop[-2]
+// with the expected value in vtop[-1] and the new value in vtop[0]. If
+// 'kind' is 0 the result is the old value, otherwise it is true if the new
+// value was stored. If 'kind' is 2, vtop[-1] points to the expected value,
+// which is updated with the old value on failure.
+void gen_atomic_cmpxchg(int kind) {
+  int v, p, e, b, size, align, n, c;
+  CType type;
+
+  type = vtop->type;
+  size = type_size(&type, &align);
+  if (size == 8) {
+    // Keep the values in memory, since all other registers are needed
+    n = gen_llong_slot();
+    vswap();
+    c = kind == 2 ? 0 : gen_llong_slot();
+    vswap();
+    save_regs(3);
+    vrotb(3);
+    gv(RC_EAX);
+    vrotb(3);
+    if (kind == 2) gv(RC_ECX);
+    reg_cache_flush();
+
+    p = TREG_ESI;
+    e = TREG_EDI;
+    g(0x56); // push %esi
+    g(0x57); // push %edi
+    g(0x53); // push %ebx
+    o(0xc689); // mov %eax, %esi
+    if (kind == 2) o(0xcf89); // mov %ecx, %edi
+    o(0x8b); // mov n, %ebx
+    gen_modrm(TREG_EBX, VT_LOCAL, NULL, n);
+    o(0x8b); // mov n+4, %ecx
+    gen_modrm(TREG_ECX, VT_LOCAL, NULL, n + 4);
+    if (kind == 2) {
+      o(0x8b); // mov (e), %eax
+      g(e);
+      o(0x8b); // mov 4(e), %edx
+      g(0x50 + e);
+      g(4);
+    } else {
+      o(0x8b); // mov c, %eax
+      gen_modrm(TREG_EAX, VT_LOCAL, NULL, c);
+      o(0x8b); // mov c+4, %edx
+      gen_modrm(TREG_EDX, VT_LOCAL, NULL, c + 4);
+    }
+    o(0xc70ff0); // lock cmpxchg8b (p)
+    g(0x08 + p);
+    if (kind == 2) {
+      b = gjmp(0, TOK_EQ);
+      o(0x89); // mov %eax, (e)
+      g(e);
+      o(0x89); // mov %edx, 4(e)
+      g(0x50 + e);
+      g(4);
+      gsym(b);
+    }
+    g(0x5b); // pop %ebx
+    g(0x5f); // pop %edi
+    g(0x5e); // pop %esi
+  } else {
+    // Flags must be used before generating the other operands
+    v = vtop->r & VT_VALMASK;
+    if (v == VT_CMP || (v & ~1) == VT_JMP) gv(RC_INT);
+    save_regs(3);
+
+    // New value in %edx, expected value or its address in %eax and
+    // pointer in %ecx
+    gv(RC_EDX);
+    vswap();
+    gv(RC_EAX);
+    vrott(3);
+    vswap();
+    gv(RC_ECX);
+    reg_cache_flush();
+
+    if (kind == 2) {
+      g(0x53); // push %ebx
+      o(0xc389); // mov %eax, %ebx
+      gen_memop(0x8a, size, TREG_EAX, TREG_EBX); // mov (%ebx), %eax
+    }
+    g(0xf0);
+    gen_memop(0x0fb0, size, TREG_EDX, TREG_ECX); // lock cmpxchg %edx, (%ecx)
+    if (kind == 2) {
+      b = gjmp(0, TOK_EQ);
+      gen_memop(0x88, size, TREG_EAX, TREG_EBX); // mov %eax, (%ebx)
+      gsym(b);
+      g(0x5b); // pop %ebx
+    }
+    if (kind == 0) gen_extend(TREG_EAX, type.t);
+  }
+
+  vtop -= 2;
+  if (kind == 0) {
+    vtop->type = type;
+    vtop->r = TREG_EAX;
+    vtop->r2 = size == 8 ? TREG_EDX : VT_CONST;
+  } else {
+    vtop->type.t = VT_INT;
+    vtop->r = VT_CMP;
+    vtop->r2 = VT_CONST;
+    vtop->c.i = TOK_EQ;
+  }
+}
+
+// Generate full memory barrier
+void gen_fence(void) {
+  reg_cache_flush();
+  o(0x0c83f0); // lock orl $0, (%esp)
+  g(0x24);
+  g(0x00);
+}
+
+// Sum the bits of register 'r' into its bytes using 't' as scratch
+static void gen_popcount_bytes(int r, int t) {
+  o(0x89); // mov r, t
+  o(0xc0 + t + r * 8);
+  o(0xe8c1 + (t << 8)); // shr $1, t
+  g(1);
+  oad(0xe081 + (t << 8), 0x55555555); // and $0x55555555, t
+  o(0x29); // sub t, r
+  o(0xc0 + r + t * 8);
+  o(0x89); // mov r, t
+  o(0xc0 + t + r * 8);
+  o(0xe8c1 + (t << 8)); // shr $2, t
+  g(2);
+  oad(0xe081 + (r << 8), 0x33333333); // and $0x33333333, r
+  oad(0xe081 + (t << 8), 0x33333333); // and $0x33333333, t
+  o(0x01); // add t, r
+  o(0xc0 + r + t * 8);
+  o(0x89); // mov r, t
+  o(0xc0 + t + r * 8);
+  o(0xe8c1 + (t << 8)); // shr $4, t
+  g(4);
+  o(0x01); // add t, r
+  o(0xc0 + r + t * 8);
+  oad(0xe081 + (r << 8), 0x0f0f0f0f); // and $0x0f0f0f0f, r
+}
+
+// Generate bit manipulation builtin on the unsigned value in vtop. 'op'
+// is TOK_builtin_clz, ctz, ffs, popcount or bswap16/32/64. The bit
+// counting operations return an int; the byte swaps keep the type.
+void gen_bitop(int op) {
+  int r, hi, t, b, ll;
+
+  ll = (vtop->type.t & VT_BTYPE) == VT_LLONG;
+  gv(RC_INT);
+  r = vtop->r;
+  hi = vtop->r2;
+  reg_cache_kill(r);
+  if (ll) reg_cache_kill(hi);
+  switch (op) {
+    case TOK_builtin_bswap16:
+      o(0xc166); // rol $8, r16
+      o(0xc0 + r);
+      g(8);
+      o(0xb70f); // movzwl r16, r
+      o(0xc0 + r * 9);
+      return;
+
+    case TOK_builtin_bswap32:
+      o(0xc80f + (r << 8)); // bswap r
+      return;
+
+    case TOK_builtin_bswap64:
+      o(0xc80f + (r << 8)); // bswap lo
+      o(0xc80f + (hi << 8)); // bswap hi
+      vtop->r = hi;
+      vtop->r2 = r;
+      return;
+
+    case TOK_builtin_clz:
+      if (ll) {
+        o(0xbd0f); // bsr hi, hi
+        o(0xc0 + hi * 9);
+        b = gjmp(0, TOK_NE);
+        o(0xbd0f); // bsr r, hi
+        o(0xc0 + r + hi * 8);
+        o(0xe883 + (hi << 8)); // sub $32, hi
+        g(32);
+        gsym(b);
+        o(0xd8f7 + (hi << 8)); // neg hi
+        o(0xc083 + (hi << 8)); // add $31, hi
+        g(31);
+        r = hi;
+      } else {
+        o(0xbd0f); // bsr r, r
+        o(0xc0 + r * 9);
+        o(0xf083 + (r << 8)); // xor $31, r
+        g(31);
+      }
+      break;
+
+    case TOK_builtin_ctz:
+      o(0xbc0f); // bsf r, r
+      o(0xc0 + r * 9);
+      if (ll) {
+        b = gjmp(0, TOK_NE);
+        o(0xbc0f); // bsf hi, r
+        o(0xc0 + hi + r * 8);
+        o(0xc083 + (r << 8)); // add $32, r
+        g(32);
+        gsym(b);
+      }
+      break;
+
+    case TOK_builtin_ffs:
+      // bsf leaves the destination undefined and sets ZF for zero
+      o(0xbc0f); // bsf r, r
+      o(0xc0 + r * 9);
+      b = gjmp(0, TOK_NE);
+      if (ll) {
+        o(0xbc0f); // bsf hi, r
+        o(0xc0 + hi + r * 8);
+        t = gjmp(0, TOK_NE);
+        oad(0xb8 + r, -33); // mov $-33, r
+        gsym(t);
+        o(0xc083 + (r << 8)); // add $32, r
+        g(32);
+      } else {
+        oad(0xb8 + r, -1); // mov $-1, r
+      }
+      gsym(b);
+      o(0x40 + r); // inc r
+      break;
+
+    case TOK_builtin_popcount:
+      // Count bits in parallel within the register (no popcnt on older cpus)
+      t = get_reg(RC_INT);
+      gen_popcount_bytes(r, t);
+      if (ll) {
+        gen_popcount_bytes(hi, t);
+        o(0x01); // add hi, r
+        o(0xc0 + r + hi * 8);
+      }
+      oad(0xc069 + (r * 9 << 8), 0x01010101); // imul $0x01010101, r, r
+      o(0xe8c1 + (r << 8)); // shr $24, r
+      g(24);
+      break;
+  }
+  vtop->type.t = VT_INT;
+  vtop->r = r;
+  vtop->r2 = VT_CONST;
+}
+
+// Generate prefetch of the address in vtop with a locality hint from 0
+// (non-temporal) to 3 (keep in all cache levels)
+void gen_prefetch(int locality) {
+  int r;
+
+  r = vtop->r;
+  if ((r & VT_LVAL) || ((r & VT_VALMASK) != VT_CONST && (r & VT_VALMASK) != VT_LOCAL)) {
+    r = gv(RC_INT);
+  }
+  o(0x180f); // prefetchnta/prefetcht2/t1/t0
+  gen_modrm(locality ? 4 - locality : 0, r, vtop->sym, vtop->c.ul);
+  vpop();
+}
+
+// Make the vector lvalue in vtop usable as a memory operand
+static void vec_addr(void) {
+  CType type;
+
+  if ((vtop->r & VT_VALMASK) == VT_LLOCAL) {
+    // Load saved pointer to the vector
+    type = vtop->type;
+    vtop->type.t = VT_INT;
+    gaddrof();
+    gv(RC_INT);
+    vtop->type = type;
+    vtop->r |= VT_LVAL;
+  }
+}
+
+// Generate SSE instruction 'opc' with register xmm 'x' and the vector in
+// vtop as memory operand
+static void gen_vecmem(int opc, int x) {
+  vec_addr();
+  o(opc);
+  gen_modrm(x, vtop->r, vtop->sym, vtop->c.i);
+}
+
+// Copy 16 byte vector in vtop to the vector lvalue in vtop[-1]
+void gen_movv(void) {
+  gen_vecmem(0x100f, 0); // movups v, %xmm0
+  vswap();
+  gen_vecmem(0x110f, 0); // movups %xmm0, lv
+  reg_cache_store(0, vtop, 16);
+  vswap();
+}
+
+// Generate SSE instruction for operation 'op' on the 16 byte vectors in
+// vtop[-1] and vtop[0], and replace them with a temporary holding the
+// result. Returns 0 if there is no instruction for the operation. Vectors
+// are always accessed with unaligned moves since parameters and vectors
+// reached through pointers are only word aligned.
+int gen_opv(int op) {
+  int bt, esize, align, opc, pred, swap, inv, n;
+  CType type, *et;
+
+  type = vtop[-1].type;
+  et = &type.ref->type;
+  bt = et->t & VT_BTYPE;
+  esize = type_size(et, &align);
+  pred = -1;
+  swap = inv = 0;
+  if (is_float(bt)) {
+    switch (op) {
+      case '+': opc = 0x580f; break; // addps
+      case '-': opc = 0x5c0f; break; // subps
+      case '*': opc = 0x590f; break; // mulps
+      case '/': opc = 0x5e0f; break; // divps
+      case TOK_EQ: pred = 0; break;
+      case TOK_LT: pred = 1; break;
+      case TOK_LE: pred = 2; break;
+      case TOK_NE: pred = 4; break;
+      case TOK_GT: pred = 1; swap = 1; break;
+      case TOK_GE: pred = 2; swap = 1; break;
+      default: return 0;
+    }
+    if (pred >= 0) opc = 0xc20f; // cmpps
+    if (bt == VT_DOUBLE) opc = (opc << 8) | 0x66; // packed double forms
+  } else {
+    n = esize == 1 ? 0 : esize == 2 ? 1 : esize == 4 ? 2 : 3;
+    switch (op) {
+      case '+': opc = esize == 8 ? 0xd4 : 0xfc + n; break; // paddb/w/d/q
+      case '-': opc = 0xf8 + n; break; // psubb/w/d/q
+      case '*':
+        // Only 16 bit multiply in SSE2
+        if (esize != 2) return 0;
+        opc = 0xd5; // pmullw
+        break;
+      case '&': opc = 0xdb; break; // pand
+      case '|': opc = 0xeb; break; // por
+      case '^': opc = 0xef; break; // pxor
+      case TOK_EQ:
+      case TOK_NE:
+        if (esize == 8) return 0;
+        opc = 0x74 + n; // pcmpeqb/w/d
+        inv = op == TOK_NE;
+        break;
+      case TOK_LT:
+      case TOK_GT:
+      case TOK_LE:
+      case TOK_GE:
+        // Only signed comparisons in SSE2
+        if (esize == 8 || (et->t & VT_UNSIGNED)) return 0;
+        opc = 0x64 + n; // pcmpgtb/w/d
+        swap = op == TOK_LT || op == TOK_GE;
+        inv = op == TOK_LE || op == TOK_GE;
+        break;
+      default:
+        return 0;
+    }
+    opc = 0x0f66 | (opc << 16);
+  }
+
+  if (swap) vswap();
+  vswap();
+  gen_vecmem(0x100f, 0); // movups a, %xmm0
+  vswap();
+  gen_vecmem(0x100f, 1); // movups b, %xmm1
+  o(opc); // op %xmm1, %xmm0
+  g(0xc1);
+  if (pred >= 0) g(pred);
+  if (inv) {
+    o(0x760f66); // pcmpeqd %xmm2, %xmm2
+    g(0xd2);
+    o(0xef0f66); // pxor %xmm2, %xmm0
+    g(0xc2);
+  }
+  vtop -= 2;
+
+  // Store result in temporary
+  vpush_temp(&type);
+  gen_vecmem(0x110f, 0); // movups %xmm0, tmp
+  reg_cache_store(0, vtop, 16);
+  return 1;
+}
+
 // Generate a floating point operation 'v = t1 op t2' instruction. The
 // two operands are guaranted to have the same floating point type
 // TODO: need to use ST1 too
@@ -1122,6 +2401,7 @@ void gen_opf(int op) {
     if (swapped) o(0xc9d9); // fxch %st(1)
     o(0xe9da); // fucompp
     o(0xe0df); // fnstsw %ax
+    reg_cache_kill(TREG_EAX);
     if (op == TOK_EQ) {
       o(0x45e480); // and $0x45, %ah
       o(0x40fC80); // cmp $0x40, %ah
@@ -1236,7 +2516,7 @@ void gen_cvt_ftoi(int t) {
   }
 
   o(0x2dd9); // ldcw xxx
-  greloc(external_global_sym(TOK___tcc_int_fpu_control, &ushort_type, VT_LVAL), 0, 0);
+  greloc(external_global_sym(TOK___tcc_int_fpu_control, &ushort_type, VT_LVAL), 0, R_386_32);
   
   oad(0xec81, size); // sub $xxx, %esp
   if (size == 4)  {
@@ -1246,7 +2526,7 @@ void gen_cvt_ftoi(int t) {
   }
   o(0x24);
   o(0x2dd9); // ldcw xxx
-  greloc(external_global_sym(TOK___tcc_fpu_control, &ushort_type, VT_LVAL), 0, 0);
+  greloc(external_global_sym(TOK___tcc_fpu_control, &ushort_type, VT_LVAL), 0, R_386_32);
 
   r = get_reg(RC_INT);
   o(0x58 + r); // pop r
@@ -22,7 +22,7 @@
 #include "cc.h"
 
 // Global variables
-int rsym, anon_sym, ind, loc;
+int rsym, anon_sym, ind, loc, min_loc, loc_align;
 SValue vstack[VSTACK_SIZE];
 SValue *vtop;
 
@@ -33,6 +33,7 @@ int global_expr;
 CType func_vt;
 int func_vc;
 char *func_name;
+Sym *func_sym;
 
 // Keywords	// dcm: with this defn, it creates an array of strings. tokens.h also includes opcodes.h. No sure how the null terminating string is created.
 static const char tcc_keywords[] =
@@ -69,6 +70,7 @@ void parse_attribute(AttributeDef *ad) {
             next();
             n = expr_const();
             if (n <= 0 || (n & (n - 1)) != 0) error("alignment must be a positive power of two");
+            if (n > ALIGN_LIMIT) error("requested alignment is too large");
             skip(')');
           } else {
             n = MAX_ALIGN;
@@ -81,6 +83,13 @@ void parse_attribute(AttributeDef *ad) {
           ad->packed = 1;
           break;
 
+        case TOK_VECTOR_SIZE1:
+        case TOK_VECTOR_SIZE2:
+          skip('(');
+          ad->vector_size = expr_const();
+          skip(')');
+          break;
+
         case TOK_UNUSED1:
         case TOK_UNUSED2:
           // Currently, no need to handle it because tcc does not track unused objects
@@ -91,6 +100,11 @@ void parse_attribute(AttributeDef *ad) {
           // Currently, no need to handle it because tcc does not track unused objects
           break;
 
+        case TOK_NO_INSTRUMENT_FUNCTION1:
+        case TOK_NO_INSTRUMENT_FUNCTION2:
+          FUNC_NOINSTR(ad->func_attr) = 1;
+          break;
+
         case TOK_CDECL1:
         case TOK_CDECL2:
         case TOK_CDECL3:
@@ -177,6 +191,10 @@ void parse_declspec(AttributeDef *ad) {
         FUNC_NAKED(ad->func_attr) = 1;
         break;
 
+      case TOK_THREAD3:
+        ad->tls = 1;
+        break;
+
       default:
         if (tcc_state->warn_unsupported) {
           warning("'%s' declspec ignored", get_tok_str(t, NULL));
@@ -228,15 +246,17 @@ Sym *struct_find(int v) {
 
 // enum/struct/union declaration. u is either VT_ENUM or VT_STRUCT
 //dcm: called from parse_btype() only
-void struct_decl(CType *type, int u) {
+void struct_decl(CType *type, int u, AttributeDef *pad) {
   int a, v, size, align, maxalign, c, offset;
   int bit_size, bit_pos, bsize, bt, lbit_pos;
   Sym *s, *ss, *ass, **ps;
-  AttributeDef ad;
+  AttributeDef ad, sad;
   CType type1, btype;
 
   a = tok; // Save decl type
   next();
+  memset(&sad, 0, sizeof(sad));
+  if (tok == TOK_ATTRIBUTE1 || tok == TOK_ATTRIBUTE2) parse_attribute(&sad);
   if (tok != '{') {
     v = tok;
     next();
@@ -323,7 +343,7 @@ void struct_decl(CType *type, int u) {
           size = type_size(&type1, &align);
           if (ad.aligned) {
             if (align < ad.aligned) align = ad.aligned;
-          } else if (ad.packed) {
+          } else if (ad.packed || sad.packed) {
             align = 1;
           } else if (*tcc_state->pack_stack_ptr) {
             if (align > *tcc_state->pack_stack_ptr) align = *tcc_state->pack_stack_ptr;
@@ -391,6 +411,15 @@ void struct_decl(CType *type, int u) {
         skip(';');
       }
       skip('}');
+      if (tok == TOK_ATTRIBUTE1 || tok == TOK_ATTRIBUTE2) {
+        // Alignment following the definition applies to the type, other
+        // attributes to the declaration
+        parse_attribute(&sad);
+        if (sad.packed) pad->packed = 1;
+        if (sad.section) pad->section = sad.section;
+      }
+      if (sad.aligned > maxalign) maxalign = sad.aligned;
+
       // Store size and alignment
       s->c = (c + maxalign - 1) & -maxalign; 
       s->r = maxalign;
@@ -477,7 +506,7 @@ int parse_btype(CType *type, AttributeDef *ad) {
         break;		//dcm:  similar logic to TOK_LONG processing above.
 
       case TOK_ENUM:
-        struct_decl(&type1, VT_ENUM);
+        struct_decl(&type1, VT_ENUM, ad);
       basic_type2:
         u = type1.t;
         type->ref = type1.ref;
@@ -485,7 +514,7 @@ int parse_btype(CType *type, AttributeDef *ad) {
 
       case TOK_STRUCT:
       case TOK_UNION:
-        struct_decl(&type1, VT_STRUCT);
+        struct_decl(&type1, VT_STRUCT, ad);
         goto basic_type2;
 
       // Type modifiers
@@ -541,6 +570,12 @@ int parse_btype(CType *type, AttributeDef *ad) {
         next();
         break;
 
+      case TOK_THREAD1:
+      case TOK_THREAD2:
+        t |= VT_TLS;
+        next();
+        break;
+
       case TOK_INLINE1:
       case TOK_INLINE2:
       case TOK_INLINE3:
@@ -580,6 +615,7 @@ int parse_btype(CType *type, AttributeDef *ad) {
   }		//dcm: end of while(1) loop
 
 done:
+  if (ad->tls) t |= VT_TLS;
   if ((t & (VT_SIGNED | VT_UNSIGNED)) == (VT_SIGNED | VT_UNSIGNED)) {
     error("signed and unsigned modifier");
   }
@@ -594,6 +630,10 @@ done:
   }
   
   type->t = t;
+  if (ad->vector_size) {
+    mk_vector(type, ad->vector_size);
+    ad->vector_size = 0;
+  }
   return type_found;
 }
 
@@ -762,6 +802,10 @@ void type_decl(CType *type, AttributeDef *ad, int *v, int td) {
   }
   post_type(type, ad);
   parse_modifiers(ad);
+  if (ad->vector_size) {
+    mk_vector(type, ad->vector_size);
+    ad->vector_size = 0;
+  }
   if (!type1.t) return;
 
   // Append type at the end of type1
@@ -855,6 +899,218 @@ void inc(int post, int c) {
   if (post) vpop(); // If post op, return saved value
 }
 
+// Parse memory order argument of atomic builtin. Orders that are not
+// constant are treated as sequentially consistent.
+static int parse_memorder(void) {
+  int order;
+
+  skip(',');
+  expr_eq();
+  order = MEMORDER_SEQ_CST;
+  if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) order = vtop->c.i;
+  vpop();
+  return order;
+}
+
+// Parse operand of atomic builtin and convert it to the object type
+static void parse_atomic_operand(CType *type) {
+  skip(',');
+  expr_eq();
+  gen_cast(type);
+}
+
+// Parse __sync_xxx and __atomic_xxx builtins
+static void parse_atomic(int t) {
+  CType type;
+  int n, bt, order;
+
+  next();
+  skip('(');
+  if (t == TOK_sync_synchronize || t == TOK_atomic_thread_fence || t == TOK_atomic_signal_fence) {
+    // Memory barriers. Only sequential consistency needs a fence on x86.
+    order = MEMORDER_SEQ_CST;
+    if (t != TOK_sync_synchronize) order = expr_const();
+    if (t != TOK_atomic_signal_fence && order == MEMORDER_SEQ_CST) gen_fence();
+    skip(')');
+    type.t = VT_VOID;
+    vset(&type, VT_CONST, 0);
+    return;
+  }
+
+  // First argument points to the object
+  expr_eq();
+  if ((vtop->type.t & VT_BTYPE) != VT_PTR) expect("pointer");
+  type = *pointed_type(&vtop->type);
+  type.t &= ~(VT_CONSTANT | VT_VOLATILE);
+  bt = type.t & VT_BTYPE;
+  if ((type.t & VT_ARRAY) || (bt != VT_INT && bt != VT_BYTE && bt != VT_SHORT &&
+      bt != VT_LLONG && bt != VT_PTR && bt != VT_BOOL && bt != VT_ENUM)) {
+    error("invalid type for atomic operation");
+  }
+
+  if (t >= TOK_sync_fetch_and_add && t <= TOK_atomic_nand_fetch) {
+    n = t - TOK_sync_fetch_and_add;
+    parse_atomic_operand(&type);
+    if (t >= TOK_atomic_fetch_add) parse_memorder();
+    gen_atomic("+-|&^~"[n % 6], (n / 6) & 1);
+  } else {
+    switch (t) {
+      case TOK_sync_bool_compare_and_swap:
+      case TOK_sync_val_compare_and_swap:
+        parse_atomic_operand(&type);
+        parse_atomic_operand(&type);
+        gen_atomic_cmpxchg(t == TOK_sync_bool_compare_and_swap);
+        break;
+
+      case TOK_atomic_compare_exchange_n:
+        skip(',');
+        expr_eq();
+        if ((vtop->type.t & VT_BTYPE) != VT_PTR) expect("pointer");
+        parse_atomic_operand(&type);
+        skip(',');
+        expr_eq(); // weak
+        vpop();
+        parse_memorder();
+        parse_memorder();
+        gen_atomic_cmpxchg(2);
+        break;
+
+      case TOK_sync_lock_test_and_set:
+      case TOK_atomic_exchange_n:
+        parse_atomic_operand(&type);
+        if (t == TOK_atomic_exchange_n) parse_memorder();
+        gen_atomic('=', 0);
+        break;
+
+      case TOK_sync_lock_release:
+      case TOK_atomic_store_n:
+        if (t == TOK_sync_lock_release) {
+          vpushi(0);
+          gen_cast(&type);
+          order = MEMORDER_RELEASE;
+        } else {
+          parse_atomic_operand(&type);
+          order = parse_memorder();
+        }
+        if (order == MEMORDER_SEQ_CST || bt == VT_LLONG) {
+          // Sequentially consistent and 64-bit stores need a locked exchange
+          gen_atomic('=', 0);
+        } else {
+          vswap();
+          indir();
+          vswap();
+          vstore();
+        }
+        vpop();
+        type.t = VT_VOID;
+        vset(&type, VT_CONST, 0);
+        break;
+
+      case TOK_atomic_load_n:
+        parse_memorder();
+        if (bt == VT_LLONG) {
+          // Compare and exchange with zero to read 64 bits at once
+          vpushi(0);
+          gen_cast(&type);
+          vpushi(0);
+          gen_cast(&type);
+          gen_atomic_cmpxchg(0);
+        } else {
+          indir();
+          gv(RC_INT);
+        }
+        break;
+    }
+  }
+  skip(')');
+}
+
+// Evaluate bit manipulation builtin on constant 'v' with 'bits' bits
+static uint64_t fold_bitop(int op, uint64_t v, int bits) {
+  uint64_t r;
+  int n;
+
+  switch (op) {
+    case TOK_builtin_clz:
+      for (n = bits; v; n--) v >>= 1;
+      return n;
+    case TOK_builtin_ctz:
+    case TOK_builtin_ffs:
+      if (v == 0) return op == TOK_builtin_ffs ? 0 : bits;
+      for (n = 0; !(v & 1); n++) v >>= 1;
+      return op == TOK_builtin_ffs ? n + 1 : n;
+    case TOK_builtin_popcount:
+      for (n = 0; v; v &= v - 1) n++;
+      return n;
+    default:
+      // Byte swap
+      for (r = 0, n = 0; n < bits; n += 8, v >>= 8) r = (r << 8) | (v & 0xff);
+      return r;
+  }
+}
+
+// Parse bit manipulation builtins
+static void parse_bitop(int t) {
+  CType type;
+  int op, bits;
+  uint64_t v;
+
+  next();
+  skip('(');
+  expr_eq();
+  skip(')');
+  if (t >= TOK_builtin_bswap16) {
+    op = t;
+    bits = 16 << (t - TOK_builtin_bswap16);
+  } else {
+    op = TOK_builtin_clz + (t - TOK_builtin_clz) / 3 * 3;
+    bits = (t - TOK_builtin_clz) % 3 == 2 ? 64 : 32;
+  }
+  type.t = (bits == 64 ? VT_LLONG : bits == 16 ? VT_SHORT : VT_INT) | VT_UNSIGNED;
+  gen_cast(&type);
+  if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+    v = bits == 64 ? vtop->c.ull : vtop->c.ui;
+    if (bits == 16) v &= 0xffff;
+    vtop->c.ull = fold_bitop(op, v, bits);
+    if (op < TOK_builtin_bswap16) vtop->type.t = VT_INT;
+  } else if (nocode_wanted) {
+    if (op < TOK_builtin_bswap16) vtop->type.t = VT_INT;
+    vtop->r = TREG_EAX;
+  } else {
+    gen_bitop(op);
+  }
+}
+
+// Parse __builtin_prefetch(addr, rw, locality). Prefetching for writes
+// is the same as for reads.
+static void parse_prefetch(void) {
+  int locality;
+  CType type;
+
+  next();
+  skip('(');
+  expr_eq();
+  locality = 3;
+  if (tok == ',') {
+    next();
+    expr_const();
+    if (tok == ',') {
+      next();
+      locality = expr_const();
+      if (locality < 0 || locality > 3) error("invalid locality for prefetch");
+    }
+  }
+  skip(')');
+  if ((vtop->type.t & VT_BTYPE) != VT_PTR) expect("pointer");
+  if (nocode_wanted) {
+    vpop();
+  } else {
+    gen_prefetch(locality);
+  }
+  type.t = VT_VOID;
+  vset(&type, VT_CONST, 0);
+}
+
 void unary(void) {
   int n, t, align, size, r;
   CType type;
@@ -937,6 +1193,9 @@ void unary(void) {
       mk_pointer(&type);
       type.t |= VT_ARRAY;
       memset(&ad, 0, sizeof(AttributeDef));
+      // Narrow string literals go into the mergeable string section, 
+      // so the linker can share identical strings and string tails
+      if ((t & VT_BTYPE) == VT_BYTE && tcc_state->merge_strings) ad.section = string_section;
       decl_initializer_alloc(&type, &ad, VT_CONST, 2, 0, 0);
       break;
 
@@ -1077,6 +1336,39 @@ void unary(void) {
       break;
     }
 
+    case TOK_builtin_prefetch:
+      parse_prefetch();
+      break;
+
+    case TOK_builtin_unreachable:
+      // Control never gets here, so no code is needed
+      next();
+      skip('(');
+      skip(')');
+      type.t = VT_VOID;
+      vset(&type, VT_CONST, 0);
+      break;
+
+    case TOK_builtin_assume_aligned:
+      // The alignment is only a hint; the value is the pointer itself
+      next();
+      skip('(');
+      expr_eq();
+      if ((vtop->type.t & VT_BTYPE) != VT_PTR) expect("pointer");
+      skip(',');
+      align = expr_const();
+      if (align <= 0 || (align & (align - 1))) error("alignment must be a positive power of two");
+      if (tok == ',') {
+        next();
+        expr_eq();
+        vpop();
+      }
+      skip(')');
+      type.t = VT_VOID;
+      mk_pointer(&type);
+      gen_cast(&type);
+      break;
+
     case TOK_INC:
     case TOK_DEC:
       t = tok;
@@ -1114,6 +1406,14 @@ void unary(void) {
 
     default:
       t = tok;
+      if (t >= TOK_sync_fetch_and_add && t <= TOK_atomic_signal_fence) {
+        parse_atomic(t);
+        break;
+      }
+      if (t >= TOK_builtin_clz && t <= TOK_builtin_bswap64) {
+        parse_bitop(t);
+        break;
+      }
       next();
       if (t < TOK_UIDENT) expect("identifier");
       s = sym_find(t);
@@ -1146,6 +1446,16 @@ void unary(void) {
         vtop->sym = s;
         vtop->c.ul = 0;
       }
+      // Thread local variables are addressed through the TLS block of the
+      // current thread, so their address is never constant
+      if (s->type.t & VT_TLS) {
+        vtop->type.t &= ~VT_TLS;
+        if (nocode_wanted) {
+          vtop->r = (vtop->r & ~(VT_VALMASK | VT_SYM)) | TREG_EAX;
+        } else {
+          gen_tls_addr();
+        }
+      }
   }
   
   // Post operations
@@ -1185,6 +1495,14 @@ void unary(void) {
       }
       next();
     } else if (tok == '[') {		//dcm: array accessing
+      if ((vtop->type.t & VT_BTYPE) == VT_VECTOR) {
+        // Vector elements are accessed through a pointer to the element type
+        test_lvalue();
+        gaddrof();
+        type = vtop->type.ref->type;
+        mk_pointer(&type);
+        vtop->type = type;
+      }
       next();
       gexpr();
       gen_op('+');
@@ -1216,11 +1534,12 @@ void unary(void) {
       nb_args = 0;
       ret.r2 = VT_CONST;
 
-      // Compute first implicit argument if a structure is returned
-      if ((s->type.t & VT_BTYPE) == VT_STRUCT) {
+      // Compute first implicit argument if a structure or vector is returned
+      if ((s->type.t & VT_BTYPE) == VT_STRUCT || (s->type.t & VT_BTYPE) == VT_VECTOR) {
         // Get some space for the returned structure
         size = type_size(&s->type, &align);
         loc = (loc - size) & -align;
+        if (align > loc_align) loc_align = align;
         ret.type = s->type;
         ret.r = VT_LOCAL | VT_LVAL;
         // Pass it as 'int' to avoid structure arg passing problems
@@ -1516,7 +1835,7 @@ void expr_eq(void) {
       } else if (bt1 == VT_FUNC || bt2 == VT_FUNC) {
         // TODO: test function pointer compatibility
         type = type1;
-      } else if (bt1 == VT_STRUCT || bt2 == VT_STRUCT) {
+      } else if (bt1 == VT_STRUCT || bt2 == VT_STRUCT || bt1 == VT_VECTOR || bt2 == VT_VECTOR) {
         // TODO: test structure compatibility
         type = type1;
       } else if (bt1 == VT_VOID || bt2 == VT_VOID) {
@@ -1535,7 +1854,7 @@ void expr_eq(void) {
         
       // Now we convert second operand
       gen_cast(&type);
-      if (VT_STRUCT == (vtop->type.t & VT_BTYPE)) gaddrof();
+      if (VT_STRUCT == (vtop->type.t & VT_BTYPE) || VT_VECTOR == (vtop->type.t & VT_BTYPE)) gaddrof();
       rc = RC_INT;
       if (is_float(type.t)) {
         rc = RC_FLOAT;
@@ -1552,10 +1871,12 @@ void expr_eq(void) {
       // Put again first value and cast it
       *vtop = sv;
       gen_cast(&type);
-      if (VT_STRUCT == (vtop->type.t & VT_BTYPE)) gaddrof();
+      if (VT_STRUCT == (vtop->type.t & VT_BTYPE) || VT_VECTOR == (vtop->type.t & VT_BTYPE)) gaddrof();
       r1 = gv(rc);
       move_reg(r2, r1);
       vtop->r = r2;
+      // Vector operations need the vector in memory
+      if (VT_VECTOR == (type.t & VT_BTYPE)) vtop->r |= VT_LVAL;
       gsym(tt);
     }
   }
@@ -1635,8 +1956,23 @@ int is_label(void) {
   }
 }
 
+// Output label at the top of a loop body, aligned if requested
+static int loop_label(void) {
+  if (tcc_state->align_loops > 1) galign(tcc_state->align_loops, 0x90);
+  return glabel();
+}
+
+// Release the stack slots allocated since 'saved_loc' when a scope is
+// popped, so they can be reused by later declarations and temporaries.
+static void pop_local_slots(int saved_loc) {
+  // Values on the value stack can live in the slots
+  if (vtop >= vstack) return;
+  if (loc < min_loc) min_loc = loc;
+  loc = saved_loc;
+}
+
 void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int is_expr) {
-  int a, b, c, d;
+  int a, b, c, d, saved_loc;
   Sym *s;
 
   // Generate line number info
@@ -1671,23 +2007,39 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
       gsym(a);
     }
   } else if (tok == TOK_WHILE) {
+    CodeBuffer cb;
+    int rotate, tail, body;
     next();
     d = glabel();
     skip('(');
+    mark_code_buffer(&cb);
     gexpr();
     skip(')');
     a = gtst(1, 0);
+    tail = a ? a - cb.br : -1;
+    rotate = ind - cb.ind <= MAX_ROTATE_SIZE && copy_code_buffer(&cb, a);
+    body = loop_label();
     b = 0;
     block(&a, &b, case_sym, def_sym, case_reg, 0);
-    gjmp(d, 0);
+    if (rotate) {
+      // Repeat the loop test at the bottom of the loop
+      gsym(b);
+      save_regs(0);
+      c = paste_code_buffer(&cb);
+      if (tail >= 0) a = gchain(tail + c, a);
+      gjmp(body, 0);
+    } else {
+      gjmp(d, 0);
+      gsym_at(b, d);
+    }
     gsym(a);
-    gsym_at(b, d);
   } else if (tok == '{') {	//dcm: come here for nested compound statement.
     Sym *llabel;
 
     next();
     // Record local declaration stack position
     s = local_stack;
+    saved_loc = loc;
     llabel = local_label_stack;
     // Handle local labels declarations
     if (tok == TOK_LABEL) {
@@ -1717,13 +2069,14 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
 
     // Pop locally defined symbols
     sym_pop(&local_stack, s);
+    pop_local_slots(saved_loc);
     next();
   } else if (tok == TOK_RETURN) {
     next();
     if (tok != ';') {
       gexpr();
       gen_assign_cast(&func_vt);
-      if ((func_vt.t & VT_BTYPE) == VT_STRUCT) {
+      if ((func_vt.t & VT_BTYPE) == VT_STRUCT || (func_vt.t & VT_BTYPE) == VT_VECTOR) {
         CType type;
         // If returning structure, must copy it to implicit first pointer arg location
         type = func_vt;
@@ -1755,10 +2108,12 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
     next();
     skip(';');
   } else if (tok == TOK_FOR) {
-    CodeBuffer cb;
+    CodeBuffer cb, test;
+    int rotate, tail, body;
     next();
 	// Record local declaration stack position	//dcm: added for local var decl. processing
 	s = local_stack;
+    saved_loc = loc;
     skip('('); 
     if (tok != ';') {		//dcm: add decl code here. declSingular() eats the terminating ";" if it finds a decl
 		if (!isDeclSingular(VT_LOCAL)) {
@@ -1772,9 +2127,13 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
     a = glabel();
     b = 0;
     c = 0;
+    rotate = 0;
     if (tok != ';') {
+      mark_code_buffer(&test);
       gexpr();
       b = gtst(1, 0);
+      tail = b ? b - test.br : -1;
+      rotate = ind - test.ind <= MAX_ROTATE_SIZE && copy_code_buffer(&test, b);
     }
     skip(';');
     save_regs(0);
@@ -1786,19 +2145,29 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
     save_regs(0);
     cut_code_buffer(&cb);
     skip(')');
+    body = loop_label();
     block(&b, &c, case_sym, def_sym, case_reg, 0);
     gsym(c);
     save_regs(0);
     paste_code_buffer(&cb);
-    gjmp(a, 0);
+    if (rotate) {
+      // Repeat the loop test at the bottom of the loop
+      save_regs(0);
+      d = paste_code_buffer(&test);
+      if (tail >= 0) b = gchain(tail + d, b);
+      gjmp(body, 0);
+    } else {
+      gjmp(a, 0);
+    }
     gsym(b);
 	// Pop locally defined symbols		//dcm: added for local var decl. processing
 	sym_pop(&local_stack, s);
+    pop_local_slots(saved_loc);
   } else if (tok == TOK_DO) {
     next();
     a = 0;
     b = 0;
-    d = glabel();
+    d = loop_label();
     block(&a, &b, case_sym, def_sym, case_reg, 0);
     skip(TOK_WHILE);
     skip('(');
@@ -1898,9 +2267,11 @@ void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int
   } else if (tok == TOK_ASM2) {
     // Inline assembler with masm syntax
     masm_instr(tcc_state);
+    reg_cache_flush();
   } else if (tok == TOK_ASM1 || tok == TOK_ASM3) {
     // Inline assembler with gas syntax
     asm_instr();
+    reg_cache_flush();
   } else {
     b = is_label();
     if (b) {
@@ -2145,7 +2516,7 @@ void init_putz(CType *t, Section *sec, unsigned long c, int size) {
   if (sec) {
     // Nothing to do because globals are already set to zero
   } else {
-    vpush_global_sym(&func_old_type, TOK_memset);
+    vpush_helper_sym(TOK_memset);
     vseti(VT_LOCAL, c);
     vpushi(0);
     vpushi(size);
@@ -2251,6 +2622,25 @@ void decl_initializer(CType *type, Section *sec, unsigned long c, int first, int
     }
     // patch type size if needed
     if (n < 0) s->c = array_length;
+  } else if ((type->t & VT_BTYPE) == VT_VECTOR && tok == '{') {
+    // Vectors are initialized like arrays of their elements
+    s = type->ref;
+    n = s->c;
+    t1 = &s->type;
+    size1 = type_size(t1, &align1);
+    next();
+    index = 0;
+    while (tok != '}') {
+      if (index >= n) error("too many elements in vector initializer");
+      decl_initializer(t1, sec, c + index * size1, 0, size_only);
+      index++;
+      if (tok == '}') break;
+      skip(',');
+    }
+    skip('}');
+    if (!size_only && index < n) {
+      init_putz(t1, sec, c + index * size1, (n - index) * size1);
+    }
   } else if ((type->t & VT_BTYPE) == VT_STRUCT && (sec || !first || tok == '{')) {
     int par_count;
 
@@ -2400,6 +2790,7 @@ void decl_initializer_alloc(CType *type, AttributeDef *ad, int r, int has_init,
   if ((r & VT_VALMASK) == VT_LOCAL) {
     sec = NULL;
     loc = (loc - size) & -align;
+    if (align > loc_align) loc_align = align;
     addr = loc;
     if (v) {
       // Local variable
@@ -2419,6 +2810,9 @@ void decl_initializer_alloc(CType *type, AttributeDef *ad, int r, int has_init,
         if (!are_compatible_types(&sym->type, type)) {
           error("incompatible types for redefinition of '%s'", get_tok_str(v, NULL));
         }
+        if ((sym->type.t ^ type->t) & VT_TLS) {
+          error("conflicting thread local storage for '%s'", get_tok_str(v, NULL));
+        }
         if (sym->type.t & VT_EXTERN) {
           // If the variable is extern, it was not allocated
           sym->type.t &= ~VT_EXTERN;
@@ -2442,7 +2836,9 @@ void decl_initializer_alloc(CType *type, AttributeDef *ad, int r, int has_init,
 
     // Allocate symbol in corresponding section
     sec = ad->section;
-    if (!sec) {
+    if (type->t & VT_TLS) {
+      sec = tls_section;
+    } else if (!sec) {
       if (has_init) {
         sec = data_section;
       } else if (tcc_state->nocommon) {
@@ -2566,13 +2962,26 @@ void func_decl_list(Sym *func_sym) {
 
 // Parse a function defined by symbol 'sym' and generate its code in 'cur_text_section'
 void gen_function(Sym *sym) {
-  int func_start, func_size;
+  int func_start, func_size, n;
   int saved_nocode_wanted = nocode_wanted;
   nocode_wanted = 0;
 
+  // Align function start. Loop alignment is relative to the section start.
+  if (tcc_state->align_loops > cur_text_section->sh_addralign) {
+    cur_text_section->sh_addralign = tcc_state->align_loops;
+  }
+  n = tcc_state->align_functions;
+  if (n > 1) {
+    if (n > cur_text_section->sh_addralign) cur_text_section->sh_addralign = n;
+    func_start = (cur_text_section->data_offset + n - 1) & -n;
+    n = func_start - cur_text_section->data_offset;
+    memset(section_ptr_add(cur_text_section, n), 0x90, n);
+  }
+
   // Define function symbol. The function size is patched later.
   func_start = cur_text_section->data_offset;
   func_name = get_tok_str(sym->v, NULL);
+  func_sym = sym;
   put_extern_sym(sym, cur_text_section, func_start, 0);
 
   // Put debug symbol
@@ -2592,7 +3001,9 @@ void gen_function(Sym *sym) {
   // Patch symbol size
   ((Elf32_Sym *) symtab_section->data)[sym->c].st_size = func_size;
   if (do_debug) put_stabn(N_FUN, 0, 0, cur_text_section->data_offset - func_start);
+  if (do_debug == DEBUG_LINES) put_lines(sym->c, func_size);
   func_name = ""; // For safety
+  func_sym = NULL;
   func_vt.t = VT_VOID; // For safety
   nocode_wanted = saved_nocode_wanted;
 }
@@ -2721,12 +3132,25 @@ int isDeclSingular(int l) {
           if (FUNC_EXPORT(r)) {
             FUNC_EXPORT(type.ref->r) = 1;
           }
+          if (FUNC_NOINSTR(r)) {
+            FUNC_NOINSTR(type.ref->r) = 1;
+          }
 
           if (!are_compatible_types(&sym->type, &type)) {
           func_error1:
             error("incompatible types for redefinition of '%s'", get_tok_str(v, NULL));
           }
 
+          // A function declared static keeps internal linkage
+          type.t |= sym->type.t & VT_STATIC;
+
+          // Take the register parameters callers have been given
+          gfunc_regparm_redecl(sym, &type);
+          r = sym->type.ref->r;
+          FUNC_REGPARM(type.ref->r) = FUNC_REGPARM(r);
+          FUNC_REGPARM_SET(type.ref->r) = FUNC_REGPARM_SET(r);
+          FUNC_REGPARM_USED(type.ref->r) = FUNC_REGPARM_USED(r);
+
           // If symbol is already defined, then put complete type
           sym->type = type;
         } else {
@@ -2823,6 +3247,9 @@ int isDeclSingular(int l) {
             // NOTE: as GCC, uninitialized global static arrays of null size are considered as extern
             external_sym(v, &type, r);
           } else {
+            if ((type.t & VT_TLS) && l == VT_LOCAL && !(btype.t & VT_STATIC)) {
+              error("thread local variable '%s' must be static", get_tok_str(v, NULL));
+            }
             type.t |= (btype.t & VT_STATIC); // Retain "static"
             if (type.t & VT_STATIC) {
               r |= VT_CONST;
@@ -2867,6 +3294,7 @@ void preprocess_init(TCCState *s1) {
 // Compile the C file opened in 'file'. Return non zero if errors.
 int tcc_compile(TCCState *s1) {
   Sym *define_start;
+  CType void_type;
   char buf[512];
   volatile int section_sym;
 
@@ -2888,6 +3316,7 @@ int tcc_compile(TCCState *s1) {
     pstrcat(buf, sizeof(buf), "/");
     put_stabs_r(buf, N_SO, 0, 0, text_section->data_offset, text_section, section_sym);
     put_stabs_r(file->filename, N_SO, 0, 0, text_section->data_offset, text_section, section_sym);
+    if (do_debug == DEBUG_LINES) lines_begin(buf, file->filename);
   }
 
   // An ELF symbol of type STT_FILE must be put so that STB_LOCAL
@@ -2902,6 +3331,11 @@ int tcc_compile(TCCState *s1) {
   func_old_type.t = VT_FUNC;
   func_old_type.ref = sym_push(SYM_FIELD, &int_type, FUNC_CDECL, FUNC_OLD);
 
+  // Old style function returning void for hooks defined in the program
+  void_type.t = VT_VOID;
+  func_void_type.t = VT_FUNC;
+  func_void_type.ref = sym_push(SYM_FIELD, &void_type, FUNC_CDECL, FUNC_OLD);
+
   define_start = define_stack;
   nocode_wanted = 1;
 
@@ -2930,6 +3364,7 @@ int tcc_compile(TCCState *s1) {
 
   // Generate inline functions
   gen_inline_functions();
+  if (do_debug == DEBUG_LINES) lines_end();
 
   sym_pop(&global_stack, NULL);
 
@@ -2987,6 +3422,7 @@ int tcc_compile_string(TCCState *s, const char *str) {
   file = bf;
   
   ret = tcc_compile(s);
+  file = NULL;
   
   tcc_free(buf);
 
@@ -3043,6 +3479,7 @@ TCCState *tcc_new(void) {
   if (!s) return NULL;
   tcc_state = s;
   s->output_type = TCC_OUTPUT_EXE;
+  s->output_format = TCC_OUTPUT_FORMAT_PE;
 
   // Add all tokens
   table_ident = NULL;
@@ -3082,6 +3519,12 @@ TCCState *tcc_new(void) {
   tcc_define_symbol(s, "__WCHAR_TYPE__", "unsigned short");
   tcc_define_symbol(s, "_INTEGRAL_MAX_BITS", "64");
   tcc_define_symbol(s, "_TCC_PLATFORM", "\"" TCC_PLATFORM "\"");
+  tcc_define_symbol(s, "__ATOMIC_RELAXED", "0");
+  tcc_define_symbol(s, "__ATOMIC_CONSUME", "1");
+  tcc_define_symbol(s, "__ATOMIC_ACQUIRE", "2");
+  tcc_define_symbol(s, "__ATOMIC_RELEASE", "3");
+  tcc_define_symbol(s, "__ATOMIC_ACQ_REL", "4");
+  tcc_define_symbol(s, "__ATOMIC_SEQ_CST", "5");
 
   // No section zero
   dynarray_add((void ***)&s->sections, &s->nb_sections, NULL);
@@ -3090,6 +3533,10 @@ TCCState *tcc_new(void) {
   text_section = new_section(s, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
   data_section = new_section(s, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
   bss_section = new_section(s, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE);
+  string_section = new_section(s, ".rodata.str", SHT_PROGBITS, SHF_ALLOC | SHF_MERGE | SHF_STRINGS);
+  string_section->sh_addralign = 1;
+  string_section->sh_entsize = 1;
+  tls_section = new_section(s, ".tls", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE | SHF_TLS);
 
   // Symbols are always generated for linking stage
   symtab_section = new_symtab(s, ".symtab", SHT_SYMTAB, 0, ".strtab", ".hashtab", SHF_PRIVATE);
@@ -3100,6 +3547,9 @@ TCCState *tcc_new(void) {
   s->alacarte_link = 1;
   s->imagebase = 0xFFFFFFFF;
   s->filealign = 512;
+  s->link_threads = 4;
+  s->merge_strings = 1;
+  s->auto_regparm = 1;
 
   return s;
 }
@@ -3134,6 +3584,11 @@ void tcc_delete(TCCState *s1) {
   dynarray_reset(&s1->include_paths, &s1->nb_include_paths);
   dynarray_reset(&s1->sysinclude_paths, &s1->nb_sysinclude_paths);
 
+  prof_free();
+  stats_free(s1);
+  map_free(s1);
+  tcc_free(s1->cache_entry);
+  cstr_free(&s1->cache_diag);
   tcc_free(s1);
 }
 
@@ -3156,7 +3611,7 @@ int tcc_add_sysinclude_path(TCCState *s1, const char *pathname) {
 int tcc_add_file_ex(TCCState *s1, const char *filename, int flags) {
   const char *ext;
   Elf32_Ehdr ehdr;
-  int fd, ret;
+  int fd, ret, phase;
   BufferedFile *saved_file;
 
   // Find source file type with extension
@@ -3174,11 +3629,18 @@ int tcc_add_file_ex(TCCState *s1, const char *filename, int flags) {
     goto fail1;
   }
 
+  phase = bench_phase(BENCH_PARSE);
+  map_input_start(s1);
   if (flags & AFF_PREPROCESS) {
+    bench_phase(BENCH_PREPROCESS);
     ret = tcc_preprocess(s1);
   } else if (!ext[0] || !strcmp(ext, "c")) {
     // C file assumed
-    ret = tcc_compile(s1);
+    if (s1->cache_dir && strcmp(filename, "-") != 0) {
+      ret = cache_compile(s1, filename);
+    } else {
+      ret = tcc_compile(s1);
+    }
   } else if (!strcmp(ext, "S")) {
     // Preprocessed assembler
     ret = tcc_assemble(s1, 1);
@@ -3186,8 +3648,10 @@ int tcc_add_file_ex(TCCState *s1, const char *filename, int flags) {
     // Non-preprocessed assembler
     ret = tcc_assemble(s1, 0);
   } else if (!strcmp(ext, "def")) {
+    bench_phase(BENCH_LOAD);
     ret = pe_load_def_file(s1, file->fd);
   } else {	//dcm: come here to load the libc.a file.
+    bench_phase(BENCH_LOAD);
     fd = file->fd;
     // Assume executable format: auto guess file type
     ret = read(fd, &ehdr, sizeof(ehdr));
@@ -3225,6 +3689,8 @@ int tcc_add_file_ex(TCCState *s1, const char *filename, int flags) {
     }
   }
  cleanup:
+  map_input_end(s1, filename, NULL);
+  bench_phase(phase);
   tcc_close(file);
  fail1:
   file = saved_file;
@@ -3311,6 +3777,12 @@ int tcc_set_output_type(TCCState *s, int output_type) {	// dcm: only ever called
     stab_section->link = stabstr_section;
     // Put first entry
     put_stabs("", 0, 0, 0, 0);
+
+    // Line tables
+    if (do_debug == DEBUG_LINES) {
+      lines_section = new_section(s, ".lines", SHT_PROGBITS, 0);
+      lines_section->sh_addralign = 1;
+    }
   }
 
   snprintf(buf, sizeof(buf), "%s/lib", tcc_lib_path);
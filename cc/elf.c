@@ -285,6 +285,163 @@ void put_stabd(int type, int other, int desc) {
   put_stabs(NULL, type, other, desc, 0);
 }
 
+// Compact line tables (-g).
+//
+// Instead of a 12 byte N_SLINE stab for every statement, the line numbers
+// of a function are delta-encoded into a line program which is written to
+// the .lines section when the function is done. Every translation unit is
+// self-contained, so the linker can concatenate .lines sections without
+// fixups, and only the start address of each function is relocated.
+//
+//   unit:     u32 unit size, u32 offset of file table, functions, file table
+//   function: u32 address, uleb code size, line program, LN_END
+//   files:    uleb count, directory, file names (zero-terminated strings)
+//
+// The line program starts at offset 0, line 0 and file 0, which is the
+// main source file. Special opcodes add a row with the address advanced
+// by (op - LN_SPECIAL) / LN_LINE_RANGE and the line advanced by
+// LN_LINE_BASE + (op - LN_SPECIAL) % LN_LINE_RANGE.
+
+static int lines_unit;
+static char *lines_dir;
+static char **lines_files;
+static int nb_lines_files;
+
+static unsigned char *line_prog;
+static int line_prog_size, line_prog_alloc;
+static unsigned long line_addr;
+static int line_line, line_file;
+
+static int encode_uleb(unsigned char *p, unsigned long v) {
+  int n = 0;
+
+  do {
+    p[n] = v & 0x7f;
+    v >>= 7;
+    if (v) p[n] |= 0x80;
+    n++;
+  } while (v);
+  return n;
+}
+
+static int encode_sleb(unsigned char *p, long v) {
+  int n = 0, more;
+
+  do {
+    p[n] = v & 0x7f;
+    v >>= 7;
+    more = !((v == 0 && !(p[n] & 0x40)) || (v == -1 && (p[n] & 0x40)));
+    if (more) p[n] |= 0x80;
+    n++;
+  } while (more);
+  return n;
+}
+
+static void put_lines_u32(unsigned char *p, unsigned long v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+// Start line table for translation unit
+void lines_begin(const char *dir, const char *filename) {
+  lines_unit = lines_section->data_offset;
+  memset(section_ptr_add(lines_section, 8), 0, 8);
+  lines_dir = tcc_strdup(dir);
+  lines_file(filename);
+}
+
+// Return index of file in the file table of the unit
+int lines_file(const char *filename) {
+  int i;
+
+  for (i = nb_lines_files - 1; i >= 0; i--) {
+    if (strcmp(lines_files[i], filename) == 0) return i;
+  }
+  dynarray_add((void ***) &lines_files, &nb_lines_files, tcc_strdup(filename));
+  return nb_lines_files - 1;
+}
+
+// Add row to the line program for the current function
+void put_line(unsigned long addr, int line, int file) {
+  unsigned char *p;
+  unsigned long da;
+  int dl, op;
+
+  if (line_prog_size + 16 > line_prog_alloc) {
+    line_prog_alloc = line_prog_alloc ? line_prog_alloc * 2 : 256;
+    line_prog = tcc_realloc(line_prog, line_prog_alloc);
+  }
+  p = line_prog + line_prog_size;
+  if (file != line_file) {
+    *p++ = LN_FILE;
+    p += encode_uleb(p, file);
+    line_file = file;
+  }
+  da = addr - line_addr;
+  dl = line - line_line;
+  op = 256;
+  if (dl >= LN_LINE_BASE && dl < LN_LINE_BASE + LN_LINE_RANGE && da < 256) {
+    op = da * LN_LINE_RANGE + dl - LN_LINE_BASE + LN_SPECIAL;
+  }
+  if (op <= 255) {
+    *p++ = op;
+  } else {
+    *p++ = LN_ADVANCE;
+    p += encode_uleb(p, da);
+    p += encode_sleb(p, dl);
+  }
+  line_prog_size = p - line_prog;
+  line_addr = addr;
+  line_line = line;
+}
+
+// Write the line program for the function with symbol 'sym_index'
+void put_lines(int sym_index, unsigned long size) {
+  unsigned char buf[8];
+  unsigned char *p;
+  int offset, n;
+
+  offset = lines_section->data_offset;
+  n = encode_uleb(buf, size);
+  p = section_ptr_add(lines_section, 4 + n + line_prog_size + 1);
+  put_lines_u32(p, 0);
+  memcpy(p + 4, buf, n);
+  memcpy(p + 4 + n, line_prog, line_prog_size);
+  p[4 + n + line_prog_size] = LN_END;
+  put_elf_reloc(symtab_section, lines_section, offset, R_386_32, sym_index);
+
+  line_prog_size = 0;
+  line_addr = 0;
+  line_line = 0;
+  line_file = 0;
+}
+
+// Write the file table and finish the line table for the unit
+void lines_end(void) {
+  unsigned char buf[8];
+  int i, n;
+
+  if (!lines_dir) return;
+  put_lines_u32(lines_section->data + lines_unit + 4, lines_section->data_offset - lines_unit);
+  n = encode_uleb(buf, nb_lines_files);
+  memcpy(section_ptr_add(lines_section, n), buf, n);
+  put_elf_str(lines_section, lines_dir);
+  for (i = 0; i < nb_lines_files; i++) put_elf_str(lines_section, lines_files[i]);
+  put_lines_u32(lines_section->data + lines_unit, lines_section->data_offset - lines_unit);
+
+  tcc_free(lines_dir);
+  lines_dir = NULL;
+  dynarray_reset(&lines_files, &nb_lines_files);
+  tcc_free(line_prog);
+  line_prog = NULL;
+  line_prog_size = line_prog_alloc = 0;
+  line_addr = 0;
+  line_line = 0;
+  line_file = 0;
+}
+
 // In an ELF file symbol table, the local symbols must appear below
 // the global and weak ones. Since TCC cannot sort it while generating
 // the code, we must do it after. All the relocation tables are also
@@ -478,6 +635,9 @@ void relocate_section(TCCState *s1, Section *s) {
         // Load the got offset
         *(int *) ptr += s1->got_offsets[sym_index];
         break;
+      case R_386_TLS_LDO_32:
+        *(int *) ptr += val - s1->sections[sym->st_shndx]->sh_addr;
+        break;
     }
   }
 
@@ -727,21 +887,217 @@ void add_init_array_defines(TCCState *s1, const char *section_name) {
   add_elf_sym(symtab_section, end_offset, 0, ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), 0, s->sh_num, sym_end);
 }
 
-// Add TCC runtime libraries
+// Startup code and runtime support for statically linked Linux
+// executables. A part is compiled into the executable if the symbol it
+// defines is referenced but not defined by the program or its libraries.
+static const struct {
+  const char *symbol;
+  const char *source;
+} elf_runtime[] = {
+  { "_start",
+    "int main(int argc, char **argv, char **envp);\n"
+    "void exit(int status);\n"
+    "void __start_main(int *sp) {\n"
+    "  exit(main(sp[0], (char **) (sp + 1), (char **) (sp + 2 + sp[0])));\n"
+    "}\n"
+    "__asm__(\".globl _start\\n\"\n"
+    "        \"_start:\\n\"\n"
+    "        \"xor %ebp, %ebp\\n\"\n"
+    "        \"mov %esp, %eax\\n\"\n"
+    "        \"and $-16, %esp\\n\"\n"
+    "        \"sub $12, %esp\\n\"\n"
+    "        \"push %eax\\n\"\n"
+    "        \"call __start_main\\n\");\n" },
+  { "exit",
+    "void _exit(int status);\n"
+    "void exit(int status) {\n"
+    "  _exit(status);\n"
+    "}\n" },
+  { "_exit",
+    "void _exit(int status) {\n"
+    "  for (;;) __asm__ __volatile__(\"int $0x80\" : : \"a\" (252), \"b\" (status));\n"
+    "}\n" },
+  { "read",
+    "int read(int fd, void *buf, unsigned int size) {\n"
+    "  int ret;\n"
+    "  __asm__ __volatile__(\"int $0x80\" : \"=a\" (ret) : \"a\" (3), \"b\" (fd), \"c\" (buf), \"d\" (size) : \"memory\");\n"
+    "  return ret;\n"
+    "}\n" },
+  { "write",
+    "int write(int fd, const void *buf, unsigned int size) {\n"
+    "  int ret;\n"
+    "  __asm__ __volatile__(\"int $0x80\" : \"=a\" (ret) : \"a\" (4), \"b\" (fd), \"c\" (buf), \"d\" (size) : \"memory\");\n"
+    "  return ret;\n"
+    "}\n" },
+  { "open",
+    "int open(const char *name, int flags, int mode) {\n"
+    "  int ret;\n"
+    "  __asm__ __volatile__(\"int $0x80\" : \"=a\" (ret) : \"a\" (5), \"b\" (name), \"c\" (flags), \"d\" (mode) : \"memory\");\n"
+    "  return ret;\n"
+    "}\n" },
+  { "close",
+    "int close(int fd) {\n"
+    "  int ret;\n"
+    "  __asm__ __volatile__(\"int $0x80\" : \"=a\" (ret) : \"a\" (6), \"b\" (fd));\n"
+    "  return ret;\n"
+    "}\n" },
+  { "clock_gettime",
+    "int clock_gettime(int clock, void *ts) {\n"
+    "  int ret;\n"
+    "  __asm__ __volatile__(\"int $0x80\" : \"=a\" (ret) : \"a\" (265), \"b\" (clock), \"c\" (ts) : \"memory\");\n"
+    "  return ret;\n"
+    "}\n" },
+  { "memcpy",
+    "void *memcpy(void *dst, const void *src, unsigned int n) {\n"
+    "  char *d = dst;\n"
+    "  const char *s = src;\n"
+    "  while (n--) *d++ = *s++;\n"
+    "  return dst;\n"
+    "}\n" },
+  { "memset",
+    "void *memset(void *dst, int c, unsigned int n) {\n"
+    "  char *d = dst;\n"
+    "  while (n--) *d++ = c;\n"
+    "  return dst;\n"
+    "}\n" },
+  { "__chkstk",
+    "__asm__(\".globl __chkstk\\n\"\n"
+    "        \"__chkstk:\\n\"\n"
+    "        \"xchg (%esp), %ebp\\n\"\n"
+    "        \"push %ebp\\n\"\n"
+    "        \"lea 4(%esp), %ebp\\n\"\n"
+    "        \"push %ecx\\n\"\n"
+    "        \"mov %ebp, %ecx\\n\"\n"
+    "        \"__chkstk_probe:\\n\"\n"
+    "        \"sub $4096, %ecx\\n\"\n"
+    "        \"test %eax, (%ecx)\\n\"\n"
+    "        \"sub $4096, %eax\\n\"\n"
+    "        \"cmp $4096, %eax\\n\"\n"
+    "        \"jge __chkstk_probe\\n\"\n"
+    "        \"sub %eax, %ecx\\n\"\n"
+    "        \"test %eax, (%ecx)\\n\"\n"
+    "        \"mov %esp, %eax\\n\"\n"
+    "        \"mov %ecx, %esp\\n\"\n"
+    "        \"mov (%eax), %ecx\\n\"\n"
+    "        \"jmp *4(%eax)\\n\");\n" },
+  { "__tcc_fpu_control",
+    "unsigned short __tcc_fpu_control = 0x137f;\n" },
+  { "__tcc_int_fpu_control",
+    "unsigned short __tcc_int_fpu_control = 0x137f | 0x0c00;\n" },
+  { "__udivmoddi4",
+    "unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem) {\n"
+    "  unsigned long long q, r;\n"
+    "  int i;\n"
+    "  if ((n >> 32) == 0 && (d >> 32) == 0) {\n"
+    "    if (rem) *rem = (unsigned int) n % (unsigned int) d;\n"
+    "    return (unsigned int) n / (unsigned int) d;\n"
+    "  }\n"
+    "  if (d >> 63) {\n"
+    "    q = n >= d;\n"
+    "    if (rem) *rem = q ? n - d : n;\n"
+    "    return q;\n"
+    "  }\n"
+    "  q = r = 0;\n"
+    "  for (i = 63; i >= 0; i--) {\n"
+    "    r = r << 1 | (n >> i & 1);\n"
+    "    if (r >= d) {\n"
+    "      r -= d;\n"
+    "      q |= 1ULL << i;\n"
+    "    }\n"
+    "  }\n"
+    "  if (rem) *rem = r;\n"
+    "  return q;\n"
+    "}\n" },
+  { "__udivdi3",
+    "unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem);\n"
+    "unsigned long long __udivdi3(unsigned long long a, unsigned long long b) {\n"
+    "  return __udivmoddi4(a, b, 0);\n"
+    "}\n" },
+  { "__umoddi3",
+    "unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem);\n"
+    "unsigned long long __umoddi3(unsigned long long a, unsigned long long b) {\n"
+    "  unsigned long long r;\n"
+    "  __udivmoddi4(a, b, &r);\n"
+    "  return r;\n"
+    "}\n" },
+  { "__divdi3",
+    "unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem);\n"
+    "long long __divdi3(long long a, long long b) {\n"
+    "  unsigned long long q;\n"
+    "  q = __udivmoddi4(a < 0 ? -a : a, b < 0 ? -b : b, 0);\n"
+    "  return (a < 0) != (b < 0) ? -q : q;\n"
+    "}\n" },
+  { "__moddi3",
+    "unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem);\n"
+    "long long __moddi3(long long a, long long b) {\n"
+    "  unsigned long long r;\n"
+    "  __udivmoddi4(a < 0 ? -a : a, b < 0 ? -b : b, &r);\n"
+    "  return a < 0 ? -r : r;\n"
+    "}\n" },
+  { "__ulltof",
+    "float __ulltof(unsigned long long a) {\n"
+    "  if ((long long) a >= 0) return (long long) a;\n"
+    "  return (float) (long long) (a >> 1 | (a & 1)) * 2;\n"
+    "}\n" },
+  { "__ulltod",
+    "double __ulltod(unsigned long long a) {\n"
+    "  if ((long long) a >= 0) return (long long) a;\n"
+    "  return (double) (long long) (a >> 1 | (a & 1)) * 2;\n"
+    "}\n" },
+  { "__ulltold",
+    "long double __ulltold(unsigned long long a) {\n"
+    "  if ((long long) a >= 0) return (long long) a;\n"
+    "  return (long double) (long long) (a >> 1) * 2 + (a & 1);\n"
+    "}\n" },
+  { "__fixunssfdi",
+    "unsigned long long __fixunssfdi(float a) {\n"
+    "  if (a < 9223372036854775808.0) return (long long) a;\n"
+    "  return (long long) (a - 9223372036854775808.0) ^ 0x8000000000000000ULL;\n"
+    "}\n" },
+  { "__fixunsdfdi",
+    "unsigned long long __fixunsdfdi(double a) {\n"
+    "  if (a < 9223372036854775808.0) return (long long) a;\n"
+    "  return (long long) (a - 9223372036854775808.0) ^ 0x8000000000000000ULL;\n"
+    "}\n" },
+  { "__fixunsxfdi",
+    "unsigned long long __fixunsxfdi(long double a) {\n"
+    "  if (a < 9223372036854775808.0L) return (long long) a;\n"
+    "  return (long long) (a - 9223372036854775808.0L) ^ 0x8000000000000000ULL;\n"
+    "}\n" },
+  { NULL, NULL }
+};
+
+// Add the runtime for Linux executables
 void tcc_add_runtime(TCCState *s1) {
-  char buf[1024];
+  int i, added, sym_index, ret;
+  int instrument_functions, profile_mcount;
+  Elf32_Sym *sym;
 
-  // Add libc
-  if (!s1->nostdlib) {
-    tcc_add_library(s1, "c");
-    snprintf(buf, sizeof(buf), "%s/%s", tcc_lib_path, "libtcc1.a");
-    tcc_add_file(s1, buf);
-  }
+  if (s1->nostdlib) return;
+  add_elf_sym(symtab_section, 0, 0, ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE), 0,
+              SHN_UNDEF, s1->start_symbol ? s1->start_symbol : "_start");
 
-  // Add crt end
-  if (!s1->nostdlib) {
-    tcc_add_file(s1, CONFIG_TCC_CRT_PREFIX "/crtn.o");
-  }
+  // The runtime itself is not instrumented
+  instrument_functions = s1->instrument_functions;
+  profile_mcount = s1->profile_mcount;
+  s1->instrument_functions = s1->profile_mcount = 0;
+
+  // Parts of the runtime can reference other parts
+  ret = 0;
+  do {
+    added = 0;
+    for (i = 0; elf_runtime[i].symbol && ret == 0; i++) {
+      sym_index = find_elf_sym(symtab_section, elf_runtime[i].symbol);
+      if (!sym_index) continue;
+      sym = (Elf32_Sym *) symtab_section->data + sym_index;
+      if (sym->st_shndx != SHN_UNDEF) continue;
+      ret = tcc_compile_string(s1, elf_runtime[i].source);
+      added = 1;
+    }
+  } while (added && ret == 0);
+
+  s1->instrument_functions = instrument_functions;
+  s1->profile_mcount = profile_mcount;
 }
 
 // Add various standard linker symbols (must be done after the
@@ -769,6 +1125,7 @@ void tcc_add_linker_symbols(TCCState *s1) {
   add_init_array_defines(s1, ".preinit_array");
   add_init_array_defines(s1, ".init_array");
   add_init_array_defines(s1, ".fini_array");
+  if (s1->profile_generate) add_init_array_defines(s1, ".prof");
   
   // Add start and stop symbols for sections whose name can be expressed in C
   for (i = 1; i < s1->nb_sections; i++) {
@@ -845,6 +1202,14 @@ int tcc_output_file(TCCState *s1, const char *filename) {
   s1->nb_errors = 0;
 
   if (file_type != TCC_OUTPUT_OBJ) {
+    // Thread local variables are reached through the Windows TLS array,
+    // which Linux does not set up
+    i = find_elf_sym(symtab_section, "_tls_index");
+    sym = (Elf32_Sym *) symtab_section->data + i;
+    if (i && sym->st_shndx == SHN_UNDEF) {
+      error_noabort("thread local variables cannot be used in Linux executables");
+      return -1;
+    }
     tcc_add_runtime(s1);
   }
 
@@ -1035,7 +1400,7 @@ int tcc_output_file(TCCState *s1, const char *filename) {
   // Allocate program segment headers
   phdr = tcc_mallocz(phnum * sizeof(Elf32_Phdr));
     
-  if (s1->output_format == TCC_OUTPUT_FORMAT_ELF) {
+  if (s1->output_format != TCC_OUTPUT_FORMAT_BINARY) {
     file_offset = sizeof(Elf32_Ehdr) + phnum * sizeof(Elf32_Phdr);
   } else {
     file_offset = 0;
@@ -1129,7 +1494,7 @@ int tcc_output_file(TCCState *s1, const char *filename) {
       ph->p_memsz = addr - ph->p_vaddr;
       ph++;
       if (j == 0) {
-        if (s1->output_format == TCC_OUTPUT_FORMAT_ELF) {
+        if (s1->output_format != TCC_OUTPUT_FORMAT_BINARY) {
           // If in the middle of a page, we duplicate the page in
           // memory so that one copy is RX and the other is RW
           if ((addr & (ELF_PAGE_SIZE - 1)) != 0) addr += ELF_PAGE_SIZE;
@@ -1259,7 +1624,7 @@ int tcc_output_file(TCCState *s1, const char *filename) {
 
     // Get entry point address
     if (file_type == TCC_OUTPUT_EXE) {
-      ehdr.e_entry = (unsigned long) tcc_get_symbol_err(s1, "_start");
+      ehdr.e_entry = (unsigned long) tcc_get_symbol_err(s1, s1->start_symbol ? s1->start_symbol : "_start");
     } else {
       ehdr.e_entry = text_section->sh_addr; // TODO: is it correct?
     }
@@ -1279,7 +1644,7 @@ int tcc_output_file(TCCState *s1, const char *filename) {
   f = fdopen(fd, "wb");
   if (verbose) printf("<- %s\n", filename);
 
-  if (s1->output_format == TCC_OUTPUT_FORMAT_ELF) {
+  if (s1->output_format != TCC_OUTPUT_FORMAT_BINARY) {
     sort_syms(s1, symtab_section);
     
     // Align to 4
@@ -1452,7 +1817,8 @@ int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset) {
     sh = &shdr[i];
     sh_name = strsec + sh->sh_name;
 
-    if (strcmp(sh_name, ".stab") == 0 || strcmp(sh_name, ".stabstr") == 0 || strcmp(sh_name, ".rel.stab") == 0) {
+    if (strcmp(sh_name, ".stab") == 0 || strcmp(sh_name, ".stabstr") == 0 || strcmp(sh_name, ".rel.stab") == 0 ||
+        strcmp(sh_name, ".lines") == 0 || strcmp(sh_name, ".rel.lines") == 0) {
       // Only include stabs if we generate debug info
       if (!do_debug) continue;
     } else {
@@ -1619,6 +1985,72 @@ int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset) {
   return ret;
 }
 
+// Start recording the section data added by an input file for the
+// linker map
+void map_input_start(TCCState *s1) {
+  int i;
+
+  if (!s1->mapfile) return;
+  if (s1->nb_map_offsets < s1->nb_sections) {
+    s1->map_offsets = tcc_realloc(s1->map_offsets, s1->nb_sections * sizeof(unsigned long));
+    s1->nb_map_offsets = s1->nb_sections;
+  }
+  for (i = 1; i < s1->nb_sections; i++) s1->map_offsets[i] = s1->sections[i]->data_offset;
+}
+
+// Attribute the section data added since map_input_start() to the input
+// file. Archive members are recorded when they are loaded, so the archive
+// itself adds nothing afterwards.
+void map_input_end(TCCState *s1, const char *filename, const char *member) {
+  MapEntry *me;
+  Section *s;
+  unsigned long start;
+  char *input;
+  int i, len;
+
+  if (!s1->mapfile) return;
+  len = strlen(filename) + (member ? strlen(member) + 2 : 0) + 1;
+  input = NULL;
+  for (i = 1; i < s1->nb_sections; i++) {
+    s = s1->sections[i];
+    start = i < s1->nb_map_offsets ? s1->map_offsets[i] : 0;
+    if (s->sh_type != SHT_PROGBITS && s->sh_type != SHT_NOBITS) continue;
+    if (s->data_offset <= start) continue;
+    if (!input) {
+      input = tcc_malloc(len);
+      if (member) {
+        snprintf(input, len, "%s(%s)", filename, member);
+      } else {
+        strcpy(input, filename);
+      }
+    } else {
+      input = tcc_strdup(input);
+    }
+    me = tcc_malloc(sizeof(MapEntry));
+    me->sh_num = i;
+    me->offset = start;
+    me->size = s->data_offset - start;
+    me->input = input;
+    dynarray_add((void ***) &s1->map_entries, &s1->nb_map_entries, me);
+  }
+  map_input_start(s1);
+}
+
+void map_free(TCCState *s1) {
+  int i;
+
+  for (i = 0; i < s1->nb_map_entries; i++) {
+    tcc_free(s1->map_entries[i]->input);
+    tcc_free(s1->map_entries[i]);
+  }
+  tcc_free(s1->map_entries);
+  tcc_free(s1->map_offsets);
+  s1->map_entries = NULL;
+  s1->nb_map_entries = 0;
+  s1->map_offsets = NULL;
+  s1->nb_map_offsets = 0;
+}
+
 typedef struct ArchiveHeader {
   char ar_name[16];               // Name of this member
   char ar_date[12];               // File mtime
@@ -1633,6 +2065,39 @@ static int get_be32(const uint8_t *b) {
   return b[3] | (b[2] << 8) | (b[1] << 16) | (b[0] << 24);
 }
 
+// Get the name of an archive member without padding and the trailing '/'
+static void get_ar_name(ArchiveHeader *hdr, char *name) {
+  int i;
+
+  memcpy(name, hdr->ar_name, sizeof(hdr->ar_name));
+  for (i = sizeof(hdr->ar_name) - 1; i >= 0; i--) {
+    if (name[i] != ' ') break;
+  }
+  name[i + 1] = '\0';
+  if (i > 0 && name[i] == '/') name[i] = '\0';
+}
+
+// Load the archive member at 'offset' and record it in the linker map
+static int load_ar_member(TCCState *s1, int fd, unsigned long offset, ArchiveHeader *hdr) {
+  ArchiveHeader h;
+  char name[17];
+  int ret;
+
+  if (s1->mapfile && !hdr) {
+    lseek(fd, offset - sizeof(ArchiveHeader), SEEK_SET);
+    if (read(fd, &h, sizeof(h)) != sizeof(h)) memset(&h, ' ', sizeof(h));
+    hdr = &h;
+  }
+  map_input_start(s1);
+  lseek(fd, offset, SEEK_SET);
+  ret = tcc_load_object_file(s1, fd, offset);
+  if (s1->mapfile) {
+    get_ar_name(hdr, name);
+    map_input_end(s1, file->filename, name);
+  }
+  return ret;
+}
+
 // Load only the objects which resolve undefined symbols
 int tcc_load_alacarte(TCCState *s1, int fd, int size) {
   int i, bound, nsyms, sym_index, off, ret;
@@ -1656,8 +2121,7 @@ int tcc_load_alacarte(TCCState *s1, int fd, int size) {
         if (sym->st_shndx == SHN_UNDEF) {
           off = get_be32(ar_index + i * 4) + sizeof(ArchiveHeader);
           ++bound;
-          lseek(fd, off, SEEK_SET);
-          if (tcc_load_object_file(s1, fd, off) < 0) {
+          if (load_ar_member(s1, fd, off, NULL) < 0) {
           fail:
             ret = -1;
             goto cleanup;
@@ -1711,7 +2175,7 @@ int tcc_load_archive(TCCState *s1, int fd) {
                !strcmp(ar_name, "ARFILENAMES/")) {
       // Skip symbol table or archive names
     } else {
-      if (tcc_load_object_file(s1, fd, file_offset) < 0) return -1;
+      if (load_ar_member(s1, fd, file_offset, &hdr) < 0) return -1;
     }
     lseek(fd, file_offset + size, SEEK_SET);
   }
@@ -1787,6 +2251,7 @@ int tcc_load_dll(TCCState *s1, int fd, const char *filename, int level) {
   // add the dll and its level
   dllref = tcc_malloc(sizeof(DLLReference) + strlen(soname));
   dllref->level = level;
+  dllref->handle = NULL;
   strcpy(dllref->name, soname);
   dynarray_add((void ***)&s1->loaded_dlls, &s1->nb_loaded_dlls, dllref);
 
@@ -262,6 +262,9 @@ typedef struct {
 #define SHF_WRITE       (1 << 0)        // Writable
 #define SHF_ALLOC       (1 << 1)        // Occupies memory during execution
 #define SHF_EXECINSTR   (1 << 2)        // Executable
+#define SHF_MERGE       (1 << 4)        // Might be merged
+#define SHF_STRINGS     (1 << 5)        // Contains nul-terminated strings
+#define SHF_TLS         (1 << 10)       // Section holds thread-local data
 #define SHF_MASKPROC    0xf0000000      // Processor-specific
 
 // Symbol table entry. 
@@ -687,6 +690,7 @@ typedef struct {
 #define R_386_RELATIVE  8               // Adjust by program base
 #define R_386_GOTOFF    9               // 32 bit offset to GOT
 #define R_386_GOTPC     10              // 32 bit PC relative offset to GOT
+#define R_386_TLS_LDO_32 32             // Offset relative to TLS block
 // Keep this the last entry
 #define R_386_NUM       11
 
@@ -20,9 +20,15 @@
 //
 
 #include "cc.h"
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
 
 #define PE_MERGE_DATA
 
+#define MAX_LINK_THREADS    16
+#define MIN_THREADED_RELOCS 4096
+
 // Definitions below are from winnt.h
 
 typedef unsigned char BYTE;
@@ -158,6 +164,15 @@ typedef struct _IMAGE_BASE_RELOCATION {
 
 #define IMAGE_SIZEOF_BASE_RELOCATION     8
 
+typedef struct _IMAGE_TLS_DIRECTORY {
+  DWORD   StartAddressOfRawData;
+  DWORD   EndAddressOfRawData;
+  DWORD   AddressOfIndex;
+  DWORD   AddressOfCallBacks;
+  DWORD   SizeOfZeroFill;
+  DWORD   Characteristics;
+} IMAGE_TLS_DIRECTORY;
+
 #define IMAGE_REL_BASED_ABSOLUTE         0
 #define IMAGE_REL_BASED_HIGH             1
 #define IMAGE_REL_BASED_LOW              2
@@ -304,6 +319,7 @@ enum {
   sec_text = 0,
   sec_data,
   sec_bss,
+  sec_rdata,
   sec_idata,
   sec_rsrc,
   sec_stab,
@@ -316,6 +332,7 @@ static DWORD pe_sec_flags[] = {
   0x60000020, // ".text"
   0xC0000040, // ".data"
   0xC0000080, // ".bss"
+  0x40000040, // ".rdata"
   0x40000040, // ".idata"
   0x40000040, // ".rsrc"
   0x42000802, // ".stab"
@@ -329,6 +346,7 @@ struct section_info {
   DWORD sh_addr;
   DWORD sh_size;
   DWORD sh_flags;
+  DWORD capacity;
   Section *first;
   Section *last;
   IMAGE_SECTION_HEADER ish;
@@ -346,6 +364,35 @@ struct pe_import_info {
   struct import_symbol **symbols;
 };
 
+// Link map from the previous incremental link, read from the .ilk file
+// written next to the image
+#define ILK_HASH_SIZE 1021
+
+struct ilk_section {
+  char name[32];
+  int cls;
+  DWORD addr;
+  DWORD capacity;
+};
+
+struct ilk_entry {
+  struct ilk_entry *next;
+  DWORD addr;
+  DWORD slot;
+  DWORD size;
+  unsigned long long hash;
+  int used;
+  char name[1];
+};
+
+struct pe_ilk {
+  DWORD sizeofheaders;
+  DWORD text_end;
+  int sec_count;
+  struct ilk_section *secs;
+  struct ilk_entry *table[ILK_HASH_SIZE];
+};
+
 struct pe_info {
   TCCState *s1;
   Section *reloc;
@@ -364,10 +411,12 @@ struct pe_info {
   DWORD iat_size;
   DWORD exp_offs;
   DWORD exp_size;
+  DWORD tls_offs;
   struct section_info *sec_info;
   int sec_count;
   struct pe_import_info **imp_info;
   int imp_count;
+  struct pe_ilk *ilk;
 };
 
 #define PE_NUL 0
@@ -454,16 +503,217 @@ static int pe_section_class(Section *s) {
       if (flags & SHF_WRITE) return sec_data;
       if (strcmp(name, ".rsrc") == 0) return sec_rsrc;
       if (strcmp(name, ".iedat") == 0) return sec_idata;
+      if (flags & SHF_STRINGS) return sec_rdata;
     } else if (type == SHT_NOBITS) {
       if (flags & SHF_WRITE) return sec_bss;
     }
   } else {
     if (strcmp(name, ".reloc") == 0) return sec_reloc;
     if (strncmp(name, ".stab", 5) == 0) return sec_stab; // .stab and .stabstr
+    if (strcmp(name, ".lines") == 0) return sec_stab;
   }
   return -1;
 }
 
+// Return the size reserved for a section in an incremental link, so the
+// section can grow in later links without moving the sections after it
+static DWORD pe_reserve(DWORD size) {
+  return size + size / 4;
+}
+
+static unsigned long long pe_section_hash(Section *s) {
+  unsigned long long h = 14695981039346656037ULL;
+  unsigned char *p, *end;
+
+  if (s->sh_type == SHT_NOBITS) return 0;
+  p = s->data;
+  end = p + s->data_offset;
+  while (p < end) h = (h ^ *p++) * 1099511628211ULL;
+  return h;
+}
+
+static struct ilk_entry *ilk_lookup(struct pe_ilk *ilk, const char *name) {
+  struct ilk_entry *e;
+
+  for (e = ilk->table[elf_hash((const unsigned char *) name) % ILK_HASH_SIZE]; e; e = e->next) {
+    if (strcmp(e->name, name) == 0) return e;
+  }
+  return NULL;
+}
+
+static void pe_free_ilk(struct pe_ilk *ilk) {
+  struct ilk_entry *e;
+  int i;
+
+  if (!ilk) return;
+  for (i = 0; i < ILK_HASH_SIZE; i++) {
+    while ((e = ilk->table[i]) != NULL) {
+      ilk->table[i] = e->next;
+      tcc_free(e);
+    }
+  }
+  tcc_free(ilk->secs);
+  tcc_free(ilk);
+}
+
+static void pe_ilk_filename(struct pe_info *pe, char *buf, int size) {
+  pstrcpy(buf, size, pe->filename);
+  pstrcat(buf, size, ".ilk");
+}
+
+// Get the time stamp and size of an image file
+static int pe_image_stamp(const char *filename, DWORD *stamp, DWORD *size) {
+  IMAGE_DOS_HEADER doshdr;
+  IMAGE_FILE_HEADER filehdr;
+  int fd, ok;
+
+  fd = open(filename, O_RDONLY | O_BINARY);
+  if (fd < 0) return -1;
+  ok = read(fd, &doshdr, sizeof doshdr) == sizeof doshdr &&
+       lseek(fd, doshdr.e_lfanew + sizeof pe_ntsig, SEEK_SET) >= 0 &&
+       read(fd, &filehdr, sizeof filehdr) == sizeof filehdr;
+  *stamp = filehdr.TimeDateStamp;
+  *size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+// Read the link map of the previous incremental link. The link map is
+// only used if the image is still the one written by that link.
+static struct pe_ilk *pe_load_ilk(struct pe_info *pe) {
+  char fname[1024], name[256];
+  FILE *f;
+  struct pe_ilk *ilk;
+  struct ilk_section *is;
+  struct ilk_entry *e;
+  DWORD stamp, size, imagebase, filealign, image_stamp, image_size;
+  DWORD addr, slot, hash_hi, hash_lo;
+  int i, h;
+
+  pe_ilk_filename(pe, fname, sizeof(fname));
+  f = fopen(fname, "r");
+  if (!f) return NULL;
+  ilk = tcc_mallocz(sizeof(struct pe_ilk));
+  if (fscanf(f, "ilk %lx %lx %lx %lx %lx %d", &stamp, &size, &imagebase, &filealign,
+             &ilk->sizeofheaders, &ilk->sec_count) != 6 ||
+      pe_image_stamp(pe->filename, &image_stamp, &image_size) < 0 ||
+      stamp != image_stamp || size != image_size ||
+      imagebase != pe->imagebase || filealign != pe->filealign ||
+      ilk->sec_count <= 0 || ilk->sec_count > 1000) {
+    fclose(f);
+    tcc_free(ilk);
+    return NULL;
+  }
+
+  ilk->secs = tcc_mallocz(ilk->sec_count * sizeof(struct ilk_section));
+  for (i = 0; i < ilk->sec_count; i++) {
+    is = ilk->secs + i;
+    if (fscanf(f, "%31s %d %lx %lx", is->name, &is->cls, &is->addr, &is->capacity) != 4) {
+      fclose(f);
+      pe_free_ilk(ilk);
+      return NULL;
+    }
+  }
+
+  while (fscanf(f, "%255s %lx %lx %lx %lx %lx", name, &addr, &slot, &size, &hash_hi, &hash_lo) == 6) {
+    e = tcc_mallocz(sizeof(struct ilk_entry) + strlen(name));
+    strcpy(e->name, name);
+    e->addr = addr;
+    e->slot = slot;
+    e->size = size;
+    e->hash = (unsigned long long) hash_hi << 32 | hash_lo;
+    h = elf_hash((unsigned char *) name) % ILK_HASH_SIZE;
+    e->next = ilk->table[h];
+    ilk->table[h] = e;
+
+    // New functions are placed after the last slot in the text section
+    is = ilk->secs;
+    if (is->cls == sec_text && addr >= is->addr && addr < is->addr + is->capacity) {
+      ilk->text_end = umax(ilk->text_end, addr + slot);
+    }
+  }
+  fclose(f);
+  return ilk;
+}
+
+// Write the link map used by the next incremental link
+static void pe_write_ilk(struct pe_info *pe) {
+  char fname[1024];
+  FILE *f;
+  struct section_info *si;
+  Section *s;
+  DWORD stamp, size, slot;
+  unsigned long long hash;
+  int i;
+
+  if (pe_image_stamp(pe->filename, &stamp, &size) < 0) return;
+  pe_ilk_filename(pe, fname, sizeof(fname));
+  f = fopen(fname, "w");
+  if (!f) {
+    warning("could not write '%s'", fname);
+    return;
+  }
+  fprintf(f, "ilk %lx %lx %lx %lx %lx %d\n", stamp, size, pe->imagebase, pe->filealign,
+          pe->sizeofheaders, pe->sec_count);
+  for (i = 0; i < pe->sec_count; ++i) {
+    si = pe->sec_info + i;
+    fprintf(f, "%s %d %lx %lx\n", si->name, si->cls, si->sh_addr, si->capacity);
+  }
+  for (i = 0; i < pe->sec_count; ++i) {
+    si = pe->sec_info + i;
+    for (s = si->first; s; s = s->next) {
+      hash = pe_section_hash(s);
+      slot = si->cls == sec_text ? s->sh_size : s->data_offset;
+      fprintf(f, "%s %lx %lx %lx %lx %lx\n", s->name, (DWORD) s->sh_addr, slot,
+              (DWORD) s->data_offset, (DWORD) (hash >> 32), (DWORD) (hash & 0xffffffff));
+    }
+  }
+  fclose(f);
+}
+
+// The image can be patched in place if all PE sections have the same
+// addresses and sizes as in the previous link
+static int pe_can_patch(struct pe_info *pe) {
+  struct pe_ilk *ilk = pe->ilk;
+  struct section_info *si;
+  struct ilk_section *is;
+  int i;
+
+  if (!ilk) return 0;
+  if (ilk->sec_count != pe->sec_count || ilk->sizeofheaders != pe->sizeofheaders) return 0;
+  for (i = 0; i < pe->sec_count; ++i) {
+    si = pe->sec_info + i;
+    is = ilk->secs + i;
+    if (strcmp(si->name, is->name) != 0 || si->cls != is->cls) return 0;
+    if (si->sh_addr != is->addr || si->capacity != is->capacity) return 0;
+  }
+  return 1;
+}
+
+// Write section 's' at file position 'pos' unless it is unchanged since
+// the previous link. Returns the number of bytes written.
+static DWORD pe_patch_section(struct pe_info *pe, FILE *op, Section *s, DWORD pos, DWORD end) {
+  struct ilk_entry *e;
+  DWORD size;
+
+  e = ilk_lookup(pe->ilk, s->name);
+  if (e && e->addr == s->sh_addr && e->size == s->data_offset) {
+    if (s->sh_type == SHT_NOBITS || e->hash == pe_section_hash(s)) return 0;
+  }
+
+  fseek(op, pos, SEEK_SET);
+  if (s->sh_type != SHT_NOBITS) {
+    fwrite(s->data, 1, s->data_offset, op);
+    return s->data_offset;
+  }
+
+  // Uninitialized data may now cover bytes from the previous image
+  size = s->data_offset;
+  if (pos + size > end) size = end > pos ? end - pos : 0;
+  pe_fpad(op, pos + size, 0);
+  return size;
+}
+
 static int pe_write(struct pe_info *pe) {
   int i;
   int fd;
@@ -471,8 +721,10 @@ static int pe_write(struct pe_info *pe) {
   FILE *stubfile;
   char *stub;
   int stub_size;
-  DWORD file_offset, r;
+  DWORD file_offset, r, patched;
   Section *s;
+  int incremental, patch;
+  char fname[1024];
 
   if (pe->stub) {
     stubfile = fopen(pe->stub, "rb");
@@ -501,13 +753,6 @@ static int pe_write(struct pe_info *pe) {
   }
   ((PIMAGE_DOS_HEADER) stub)->e_lfanew = stub_size;
 
-  fd = open(pe->filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0777);
-  if (fd < 0) {
-    error_noabort("could not write '%s': %s", pe->filename, strerror(errno));
-    return 1;
-  }
-  op = fdopen(fd, "wb");
-
   pe->sizeofheaders = 
     pe_file_align(pe,
       stub_size +
@@ -516,8 +761,28 @@ static int pe_write(struct pe_info *pe) {
       sizeof(IMAGE_OPTIONAL_HEADER) +
       pe->sec_count * sizeof (IMAGE_SECTION_HEADER));
 
+  // An incremental link patches the previous image in place if the layout
+  // still fits. The link map is removed until the image is consistent.
+  incremental = pe->s1->incremental;
+  patch = pe_can_patch(pe);
+  if (incremental) {
+    pe_ilk_filename(pe, fname, sizeof(fname));
+    unlink(fname);
+  }
+  if (patch) {
+    fd = open(pe->filename, O_RDWR | O_BINARY);
+  } else {
+    fd = open(pe->filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0777);
+  }
+  if (fd < 0) {
+    error_noabort("could not write '%s': %s", pe->filename, strerror(errno));
+    return 1;
+  }
+  op = fdopen(fd, patch ? "r+b" : "wb");
+
   file_offset = pe->sizeofheaders;
-  pe_fpad(op, file_offset, 0);
+  patched = 0;
+  if (!patch) pe_fpad(op, file_offset, 0);
 
   if (verbose == 2) {
     printf("------------------------------------\n  virt   file   size  ord section" "\n");
@@ -550,6 +815,10 @@ static int pe_write(struct pe_info *pe) {
         pe_opthdr.SizeOfUninitializedData += size;
         break;
 
+      case sec_rdata:
+        pe_opthdr.SizeOfInitializedData += size;
+        break;
+
       case sec_reloc:
         pe_set_datadir(IMAGE_DIRECTORY_ENTRY_BASERELOC, addr, size);
         break;
@@ -562,6 +831,10 @@ static int pe_write(struct pe_info *pe) {
         break;
     }
 
+    if (pe->tls_offs && data_section == pe->s1->sections[si->ord]) {
+      pe_set_datadir(IMAGE_DIRECTORY_ENTRY_TLS, pe->tls_offs + addr, sizeof(IMAGE_TLS_DIRECTORY));
+    }
+
     if (pe->thunk == pe->s1->sections[si->ord]) {
       if (pe->imp_size) {
         pe_set_datadir(IMAGE_DIRECTORY_ENTRY_IMPORT, pe->imp_offs + addr, pe->imp_size);
@@ -575,22 +848,31 @@ static int pe_write(struct pe_info *pe) {
     strcpy((char *) psh->Name, sh_name);
     psh->Characteristics = pe_sec_flags[si->cls];
     psh->VirtualAddress = addr;
-    psh->Misc.VirtualSize = size;
-    pe_opthdr.SizeOfImage = umax(pe_virtual_align(size + addr), pe_opthdr.SizeOfImage); 
+    psh->Misc.VirtualSize = incremental ? si->capacity : size;
+    pe_opthdr.SizeOfImage = umax(pe_virtual_align(psh->Misc.VirtualSize + addr), pe_opthdr.SizeOfImage); 
 
     if (si->sh_size) {
       psh->PointerToRawData = r = file_offset;
       for (s = si->first; s; s = s->next) {
-        if (s->sh_type != SHT_NOBITS) {
-          file_offset = align(file_offset, s->sh_addralign);
+        if (patch) {
+          patched += pe_patch_section(pe, op, s, r + s->sh_addr - si->sh_addr,
+                                      r + pe_file_align(pe, si->capacity));
+        } else if (s->sh_type != SHT_NOBITS) {
+          // Keep file offset in step with the address of merged sections
+          file_offset = r + s->sh_addr - si->sh_addr;
           pe_fpad(op, file_offset, si->cls == sec_text ? 0x90 : 0x00);
           fwrite(s->data, 1, s->data_offset, op);
           file_offset += s->data_offset;
         }
       }
-      file_offset = pe_file_align(pe, file_offset);
+      if (incremental) {
+        // Room to grow is kept in the file too, so file offsets stay fixed
+        file_offset = r + pe_file_align(pe, si->capacity);
+      } else {
+        file_offset = pe_file_align(pe, file_offset);
+      }
       psh->SizeOfRawData = file_offset - r;
-      pe_fpad(op, file_offset, 0);
+      if (!patch) pe_fpad(op, file_offset, 0);
     }
   }
 
@@ -622,9 +904,14 @@ static int pe_write(struct pe_info *pe) {
     printf("------------------------------------\n");
   }
   if (verbose) {
-    printf("<- %s (%lu bytes)\n", pe->filename, file_offset);
+    if (patch) {
+      printf("<- %s (%lu bytes, %lu bytes patched)\n", pe->filename, file_offset, patched);
+    } else {
+      printf("<- %s (%lu bytes)\n", pe->filename, file_offset);
+    }
   }
 
+  if (incremental) pe_write_ilk(pe);
   tcc_free(stub);
   return 0;
 }
@@ -824,6 +1111,55 @@ static void pe_build_exports(struct pe_info *pe) {
   if (op) fclose(op);
 }
 
+// Build the TLS directory for the thread local variables in the .tls
+// section. The loader makes a copy of the section for each thread and
+// stores its index in the TLS array in _tls_index.
+static void pe_build_tls(struct pe_info *pe) {
+  IMAGE_TLS_DIRECTORY *dir;
+  Elf32_Sym *sym;
+  DWORD index_offs, callback_offs;
+  int sym_index, tls_sym, data_sym;
+
+  if (tls_section->data_offset == 0) return;
+
+  // Index and empty callback list
+  pe_align_section(data_section, 4);
+  index_offs = data_section->data_offset;
+  callback_offs = index_offs + sizeof(DWORD);
+  section_ptr_add(data_section, 2 * sizeof(DWORD));
+
+  // Define the index unless the runtime library has done so
+  sym_index = find_elf_sym(symtab_section, "_tls_index");
+  if (sym_index == 0) {
+    put_elf_sym(symtab_section, index_offs, sizeof(DWORD),
+                ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT), 0,
+                data_section->sh_num, "_tls_index");
+  } else {
+    sym = (Elf32_Sym *) symtab_section->data + sym_index;
+    if (sym->st_shndx == SHN_UNDEF || sym->st_shndx == SHN_ABS) {
+      sym->st_value = index_offs;
+      sym->st_size = sizeof(DWORD);
+      sym->st_shndx = data_section->sh_num;
+    }
+  }
+
+  tls_sym = put_elf_sym(symtab_section, 0, 0, ELF32_ST_INFO(STB_LOCAL, STT_SECTION),
+                        0, tls_section->sh_num, NULL);
+  data_sym = put_elf_sym(symtab_section, 0, 0, ELF32_ST_INFO(STB_LOCAL, STT_SECTION),
+                         0, data_section->sh_num, NULL);
+
+  pe->tls_offs = data_section->data_offset;
+  dir = section_ptr_add(data_section, sizeof(IMAGE_TLS_DIRECTORY));
+  dir->StartAddressOfRawData = 0;
+  dir->EndAddressOfRawData = tls_section->data_offset;
+  dir->AddressOfIndex = index_offs;
+  dir->AddressOfCallBacks = callback_offs;
+  put_elf_reloc(symtab_section, data_section, pe->tls_offs, R_386_32, tls_sym);
+  put_elf_reloc(symtab_section, data_section, pe->tls_offs + 4, R_386_32, tls_sym);
+  put_elf_reloc(symtab_section, data_section, pe->tls_offs + 8, R_386_32, data_sym);
+  put_elf_reloc(symtab_section, data_section, pe->tls_offs + 12, R_386_32, data_sym);
+}
+
 static void pe_build_reloc(struct pe_info *pe) {
   DWORD offset, block_ptr, addr;
   int count, i;
@@ -885,9 +1221,162 @@ static void pe_build_reloc(struct pe_info *pe) {
   }
 }
 
+// Place the function sections for the most frequently called functions
+// first in the text segment, so hot code shares pages and cache lines.
+// Function sections are named after the function. Sections for functions
+// not in the profile keep their order after the hot functions.
+static void pe_order_hot_sections(struct pe_info *pe, int *section_order, int n) {
+  int i, j, k;
+  unsigned int *counts, c;
+  Section *s;
+
+  counts = tcc_malloc(n * sizeof(unsigned int));
+  for (i = 0; i < n; ++i) {
+    s = pe->s1->sections[section_order[i]];
+    counts[i] = 0;
+    if (pe_section_class(s) == sec_text && strncmp(s->name, ".text_", 6) == 0) {
+      counts[i] = prof_function_count(pe->s1, s->name + 6);
+    }
+  }
+
+  // Stable insertion sort of the text sections by call count
+  for (i = 1; i < n; ++i) {
+    if (pe_section_class(pe->s1->sections[section_order[i]]) != sec_text) break;
+    k = section_order[i];
+    c = counts[i];
+    j = i;
+    while (j > 0 && counts[j - 1] < c) j--;
+    if (j == i) continue;
+    memmove(section_order + j + 1, section_order + j, (i - j) * sizeof(int));
+    memmove(counts + j + 1, counts + j, (i - j) * sizeof(unsigned int));
+    section_order[j] = k;
+    counts[j] = c;
+  }
+  tcc_free(counts);
+}
+
+// Place the function sections for the functions listed in the symbol
+// ordering file first in the text segment in the order given, so the
+// functions used together are clustered on the same pages. The other
+// sections keep their order after them.
+static void pe_order_symbols(struct pe_info *pe, int *section_order, int n) {
+  TCCState *s1 = pe->s1;
+  char line[256], name[256];
+  Section *s;
+  FILE *f;
+  int i, k, placed;
+
+  f = fopen(s1->symbol_ordering_file, "r");
+  if (!f) {
+    error_noabort("could not open symbol ordering file '%s'", s1->symbol_ordering_file);
+    return;
+  }
+  placed = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%255s", name) != 1 || name[0] == '#') continue;
+    for (i = 0; i < n; ++i) {
+      s = s1->sections[section_order[i]];
+      if (pe_section_class(s) != sec_text) {
+        i = n;
+        break;
+      }
+      if (strncmp(s->name, ".text_", 6) == 0 && strcmp(s->name + 6, name) == 0) break;
+    }
+    if (i == n) {
+      warning("symbol ordering file: no function section for '%s'", name);
+      continue;
+    }
+    if (i < placed) continue;
+    k = section_order[i];
+    memmove(section_order + placed + 1, section_order + placed, (i - placed) * sizeof(int));
+    section_order[placed++] = k;
+  }
+  fclose(f);
+}
+
+static int section_addr_cmp(const void *va, const void *vb) {
+  Section *a = *(Section **) va;
+  Section *b = *(Section **) vb;
+  if (a->sh_addr != b->sh_addr) return a->sh_addr < b->sh_addr ? -1 : 1;
+  return 0;
+}
+
+// Place the function sections in the text section of an incremental
+// link. Each function gets a slot with room to grow, and functions keep
+// their slot from the previous link as long as they fit. New functions
+// and functions that have outgrown their slot are placed after the last
+// slot. The slot size is kept in sh_size.
+static void pe_place_text(struct pe_info *pe, struct section_info *si) {
+  Section **order, *s;
+  struct ilk_entry *e;
+  DWORD end;
+  int i, n;
+
+  n = 0;
+  for (s = si->first; s; s = s->next) n++;
+  order = tcc_malloc(n * sizeof(Section *));
+  n = 0;
+  for (s = si->first; s; s = s->next) order[n++] = s;
+
+  end = si->sh_addr;
+  if (pe->ilk) end = umax(end, pe->ilk->text_end);
+  for (i = 0; i < n; ++i) {
+    s = order[i];
+    s->sh_addr = 0;
+    e = pe->ilk ? ilk_lookup(pe->ilk, s->name) : NULL;
+    if (e && !e->used && s->data_offset <= e->slot && e->addr >= si->sh_addr &&
+        (e->addr & (s->sh_addralign - 1)) == 0) {
+      e->used = 1;
+      s->sh_addr = e->addr;
+      s->sh_size = e->slot;
+    }
+  }
+  for (i = 0; i < n; ++i) {
+    s = order[i];
+    if (s->sh_addr) continue;
+    s->sh_addr = end = align(end, s->sh_addralign);
+    s->sh_size = align(pe_reserve(s->data_offset), 16);
+    end += s->sh_size;
+  }
+
+  // Merged sections must be in address order
+  qsort(order, n, sizeof(Section *), section_addr_cmp);
+  for (i = 0; i < n - 1; ++i) order[i]->next = order[i + 1];
+  order[n - 1]->next = NULL;
+  si->first = order[0];
+  si->last = order[n - 1];
+  si->sh_size = end - si->sh_addr;
+  tcc_free(order);
+}
+
+// Return the address of the next PE section. An incremental link leaves
+// room after each section and keeps the addresses from the previous link
+// as long as the sections fit.
+static DWORD pe_section_start(struct pe_info *pe, DWORD addr) {
+  struct section_info *si;
+  struct ilk_section *is;
+  int i;
+
+  i = pe->sec_count - 1;
+  if (!pe->s1->incremental || i < 0) return pe_virtual_align(addr);
+  si = pe->sec_info + i;
+
+  // The capacity is computed again if .bss has been merged into .data
+  // after an empty section
+  if (si->cls == sec_text && !si->capacity) pe_place_text(pe, si);
+  si->capacity = pe_virtual_align(pe_reserve(si->sh_size));
+  if (pe->ilk && i < pe->ilk->sec_count) {
+    is = pe->ilk->secs + i;
+    if (is->addr == si->sh_addr && si->sh_size <= is->capacity && strcmp(is->name, si->name) == 0) {
+      si->capacity = is->capacity;
+    }
+  }
+  return si->sh_addr + si->capacity;
+}
+
 static int pe_assign_addresses(struct pe_info *pe) {
   int i, k, o, c;
-  DWORD addr;
+  DWORD addr, end;
   int *section_order;
   struct section_info *si;
   struct section_info *merged_text;
@@ -906,6 +1395,9 @@ static int pe_assign_addresses(struct pe_info *pe) {
     }
   }
 
+  if (pe->s1->profile_use) pe_order_hot_sections(pe, section_order, o);
+  if (pe->s1->symbol_ordering_file) pe_order_symbols(pe, section_order, o);
+
   pe->sec_info = tcc_mallocz(o * sizeof (struct section_info));
   addr = pe->imagebase + 1;
 
@@ -923,7 +1415,7 @@ static int pe_assign_addresses(struct pe_info *pe) {
     }
     if (c == sec_bss && merged_data != NULL) {
       // Append .bss to .data
-      s->sh_addr = addr = ((addr - 1) | 15) + 1;
+      s->sh_addr = addr = align(addr, umax(s->sh_addralign, 16));
       addr += s->data_offset;
       merged_data->sh_size = addr - merged_data->sh_addr;
       merged_data->last->next = s;
@@ -947,10 +1439,17 @@ static int pe_assign_addresses(struct pe_info *pe) {
       }
     }
 
-    strcpy(si->name, c == sec_text ? ".text" : s->name);
+    if (c == sec_text) {
+      strcpy(si->name, ".text");
+    } else if (c == sec_rdata) {
+      strcpy(si->name, ".rdata");
+    } else {
+      strcpy(si->name, s->name);
+    }
     si->cls = c;
     si->ord = k;
-    si->sh_addr = s->sh_addr = addr = pe_virtual_align(addr);
+    end = addr;
+    si->sh_addr = s->sh_addr = addr = pe_section_start(pe, addr);
     si->sh_flags = s->sh_flags;
     si->first = si->last = s;
 
@@ -971,8 +1470,12 @@ static int pe_assign_addresses(struct pe_info *pe) {
       si->sh_size = s->data_offset;
       addr += s->data_offset;
       pe->sec_count++;
+    } else if (pe->s1->incremental) {
+      // Keep .bss next to .data, so the reserved room is not used up
+      addr = end;
     }
   }
+  pe_section_start(pe, addr);
 
   tcc_free(section_order);
   return 0;
@@ -995,6 +1498,85 @@ static void pe_relocate_rva(struct pe_info *pe, Section *s) {
   }
 }
 
+// Relocation work queue shared by the relocation worker threads
+struct reloc_queue {
+  struct pe_info *pe;
+  Section **sections;
+  int nb_sections;
+  int next;
+  pthread_mutex_t lock;
+};
+
+static void pe_relocate(struct pe_info *pe, Section *s) {
+  relocate_section(pe->s1, s);
+  pe_relocate_rva(pe, s);
+}
+
+static void *pe_relocate_worker(void *arg) {
+  struct reloc_queue *q = arg;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&q->lock);
+    i = q->next++;
+    pthread_mutex_unlock(&q->lock);
+    if (i >= q->nb_sections) break;
+    pe_relocate(q->pe, q->sections[i]);
+  }
+  return NULL;
+}
+
+static int reloc_size_cmp(const void *va, const void *vb) {
+  Section *a = *(Section **) va;
+  Section *b = *(Section **) vb;
+  if (a->reloc->data_offset != b->reloc->data_offset) {
+    return a->reloc->data_offset < b->reloc->data_offset ? 1 : -1;
+  }
+  return a->sh_num - b->sh_num;
+}
+
+// Apply relocations to all sections. Once symbol addresses are fixed,
+// relocations only patch the data of their own section, so the sections
+// can be handed out to a pool of worker threads. The result is the same
+// as relocating the sections one at a time.
+static void pe_relocate_sections(struct pe_info *pe) {
+  TCCState *s1 = pe->s1;
+  struct reloc_queue q;
+  pthread_t threads[MAX_LINK_THREADS];
+  int i, nthreads, nrels;
+
+  memset(&q, 0, sizeof q);
+  q.pe = pe;
+  nrels = 0;
+  for (i = 1; i < s1->nb_sections; ++i) {
+    Section *s = s1->sections[i];
+    if (s->reloc) {
+      dynarray_add((void ***) &q.sections, &q.nb_sections, s);
+      nrels += s->reloc->data_offset / sizeof(Elf32_Rel);
+    }
+  }
+
+  nthreads = s1->link_threads;
+  if (nthreads > MAX_LINK_THREADS) nthreads = MAX_LINK_THREADS;
+  if (nthreads > q.nb_sections) nthreads = q.nb_sections;
+  if (nrels < MIN_THREADED_RELOCS) nthreads = 1;
+
+  if (nthreads <= 1) {
+    for (i = 0; i < q.nb_sections; i++) pe_relocate(pe, q.sections[i]);
+  } else {
+    // Hand out the sections with the most relocations first
+    qsort(q.sections, q.nb_sections, sizeof(Section *), reloc_size_cmp);
+    pthread_mutex_init(&q.lock, NULL);
+    for (i = 0; i < nthreads - 1; i++) {
+      if (pthread_create(&threads[i], NULL, pe_relocate_worker, &q) != 0) break;
+    }
+    pe_relocate_worker(&q);
+    while (--i >= 0) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&q.lock);
+  }
+  tcc_free(q.sections);
+}
+
 static int pe_check_symbols(struct pe_info *pe) {
   Elf32_Sym *sym;
   int sym_index, sym_end;
@@ -1171,111 +1753,456 @@ static void pe_eliminate_unused_sections(struct pe_info *pe) {
   }
 }
 
-static void pe_print_section(FILE * f, Section * s) {
-  BYTE *p, *e, b;
-  int i, n, l, m;
-  p = s->data;
-  e = s->data + s->data_offset;
-  l = e - p;
-
-  fprintf(f, "section  \"%s\"", s->name);
-  if (s->link) fprintf(f, "\nlink     \"%s\"", s->link->name);
-  if (s->reloc) fprintf(f, "\nreloc    \"%s\"", s->reloc->name);
-  fprintf(f, "\nv_addr   %08X", s->sh_addr);
-  fprintf(f, "\ncontents %08X", l);
-  fprintf(f, "\n\n");
-
-  if (s->sh_type == SHT_NOBITS) return;
-  if (l == 0) return;
-
-  if (s->sh_type == SHT_SYMTAB) {
-    m = sizeof(Elf32_Sym);
-  } else if (s->sh_type == SHT_REL) {
-    m = sizeof(Elf32_Rel);
-  } else {
-    m = 16;
+// String merging. Each string literal in a mergeable string section has
+// its own symbol, so identical strings and strings that are the tail of
+// another string can share storage by moving the symbols.
+
+struct merge_string {
+  int sym_index;
+  unsigned char *data;
+  unsigned long size;
+  unsigned long offset;
+};
+
+// Order strings by their reversed contents, so that a string always sorts
+// right before the strings it is a suffix of
+static int merge_string_cmp(const void *va, const void *vb) {
+  const struct merge_string *a = va;
+  const struct merge_string *b = vb;
+  const unsigned char *pa = a->data + a->size;
+  const unsigned char *pb = b->data + b->size;
+  unsigned long n = a->size < b->size ? a->size : b->size;
+
+  while (n-- > 0) {
+    --pa;
+    --pb;
+    if (*pa != *pb) return *pa < *pb ? -1 : 1;
   }
+  if (a->size != b->size) return a->size < b->size ? -1 : 1;
+  return a->sym_index - b->sym_index;
+}
 
-  fprintf(f, "%-8s", "offset");
-  for (i = 0; i < m; ++i) fprintf(f, " %02x", i);
-  n = 56;
+static void pe_merge_string_section(struct pe_info *pe, Section *s) {
+  TCCState *s1 = pe->s1;
+  struct merge_string *strings, *str, *last;
+  Section *sr;
+  Elf32_Sym *sym;
+  Elf32_Rel *rel, *rel_end;
+  unsigned char *data;
+  unsigned long size;
+  int i, n, sym_index, sym_end;
 
-  if (s->sh_type == SHT_SYMTAB || s->sh_type == SHT_REL) {
-    static const char *fields1[] = { "  name", "     value", "  size", "  bind", "  type", " other", " shndx", NULL };
-    static const char *fields2[] = { "  offs", "  type", "  symb", NULL };
-    const char **p;
+  // Only merge if all references go through the string symbols
+  if (s->reloc) return;
+  for (i = 1; i < s1->nb_sections; ++i) {
+    sr = s1->sections[i];
+    if (sr->sh_type != SHT_REL || sr->link != symtab_section) continue;
+    rel = (Elf32_Rel *) sr->data;
+    rel_end = (Elf32_Rel *) (sr->data + sr->data_offset);
+    for (; rel < rel_end; rel++) {
+      sym = (Elf32_Sym *) symtab_section->data + ELF32_R_SYM(rel->r_info);
+      if (sym->st_shndx == s->sh_num && ELF32_ST_TYPE(sym->st_info) == STT_SECTION) return;
+    }
+  }
 
-    if (s->sh_type == SHT_SYMTAB) {
-      p = fields1;
-      n = 110;
+  // Collect strings
+  sym_end = symtab_section->data_offset / sizeof(Elf32_Sym);
+  strings = tcc_malloc(sym_end * sizeof(struct merge_string));
+  n = 0;
+  for (sym_index = 1; sym_index < sym_end; sym_index++) {
+    sym = (Elf32_Sym *) symtab_section->data + sym_index;
+    if (sym->st_shndx != s->sh_num) continue;
+    if (sym->st_size == 0 || sym->st_value + sym->st_size > s->data_offset) {
+      tcc_free(strings);
+      return;
+    }
+    str = &strings[n++];
+    str->sym_index = sym_index;
+    str->data = s->data + sym->st_value;
+    str->size = sym->st_size;
+  }
+  qsort(strings, n, sizeof(struct merge_string), merge_string_cmp);
+
+  // Place the longest string of each suffix chain and share it with the
+  // strings that are identical to or a tail of it
+  data = tcc_malloc(s->data_offset);
+  size = 0;
+  last = NULL;
+  for (i = n - 1; i >= 0; i--) {
+    str = &strings[i];
+    if (last && str->size <= last->size && 
+        memcmp(last->data + last->size - str->size, str->data, str->size) == 0) {
+      str->offset = last->offset + last->size - str->size;
     } else {
-      p = fields2;
-      n = 58;
+      str->offset = size;
+      memcpy(data + size, str->data, str->size);
+      size += str->size;
+      last = str;
     }
-    
-    for (i = 0; p[i]; ++i) fprintf(f, "%s", p[i]);
-    fprintf(f, "  symbol");
   }
 
-  fprintf(f, "\n");
-  for (i = 0; i < n; ++i) fprintf(f, "-");
-  fprintf(f, "\n");
+  for (i = 0; i < n; i++) {
+    sym = (Elf32_Sym *) symtab_section->data + strings[i].sym_index;
+    sym->st_value = strings[i].offset;
+  }
+
+  if (verbose == 3 && size < s->data_offset) {
+    printf("%lu bytes of duplicate strings merged in %s\n", s->data_offset - size, s->name);
+  }
+
+  tcc_free(s->data);
+  s->data = data;
+  s->data_offset = size;
+  s->data_allocated = s->data_offset;
+  tcc_free(strings);
+}
+
+static void pe_merge_strings(struct pe_info *pe) {
+  Section *s;
+  int i;
+
+  for (i = 1; i < pe->s1->nb_sections; ++i) {
+    s = pe->s1->sections[i];
+    if ((s->sh_flags & (SHF_MERGE | SHF_STRINGS)) != (SHF_MERGE | SHF_STRINGS)) continue;
+    if (s->sh_type != SHT_PROGBITS || s->data_offset == 0) continue;
+    pe_merge_string_section(pe, s);
+  }
+}
+
+// Identical code folding. Function sections with the same code bytes and
+// the same relocation targets are merged, and all symbols in the folded
+// sections are redirected to the surviving copy.
+
+struct icf_entry {
+  Section *s;
+  unsigned long hash;
+};
+
+// Return the surviving section for a possibly folded section
+static int icf_find(int *rep, int sh_num) {
+  while (rep[sh_num] != sh_num) sh_num = rep[sh_num];
+  return sh_num;
+}
+
+// Return the section a symbol resolves to after folding, or zero for
+// symbols that are not defined in a regular section
+static int icf_target(int *rep, Elf32_Sym *sym) {
+  if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE) return 0;
+  return icf_find(rep, sym->st_shndx);
+}
+
+static unsigned long icf_hash(int *rep, Section *s) {
+  unsigned long h = 2166136261UL;
+  unsigned char *p, *end;
+  Elf32_Rel *rel, *rel_end;
+  Elf32_Sym *sym;
+  int target;
 
-  for (i = 0; i < l;) {
-    fprintf(f, "%08X", i);
-    for (n = 0; n < m; ++n) {
-      if (n + i < l) {
-        fprintf(f, " %02X", p[i + n]);
+  p = s->data;
+  end = p + s->data_offset;
+  while (p < end) h = (h ^ *p++) * 16777619UL;
+
+  if (s->reloc) {
+    rel = (Elf32_Rel *) s->reloc->data;
+    rel_end = (Elf32_Rel *) (s->reloc->data + s->reloc->data_offset);
+    for (; rel < rel_end; rel++) {
+      sym = (Elf32_Sym *) symtab_section->data + ELF32_R_SYM(rel->r_info);
+      target = icf_target(rep, sym);
+      h = (h ^ rel->r_offset) * 16777619UL;
+      h = (h ^ ELF32_R_TYPE(rel->r_info)) * 16777619UL;
+      if (target) {
+        h = (h ^ target) * 16777619UL;
+        h = (h ^ sym->st_value) * 16777619UL;
       } else {
-        fprintf(f, "   ");
+        h = (h ^ ELF32_R_SYM(rel->r_info)) * 16777619UL;
       }
     }
+  }
+  return h;
+}
 
-    if (s->sh_type == SHT_SYMTAB) {
-      Elf32_Sym *sym = (Elf32_Sym *) (p + i);
-      const char *name = s->link->data + sym->st_name;
-      fprintf(f, "  %04X  %08X  %04X   %02X    %02X    %02X   %04X  \"%s\"",
-              sym->st_name,
-              sym->st_value,
-              sym->st_size,
-              ELF32_ST_BIND(sym->st_info),
-              ELF32_ST_TYPE(sym->st_info),
-              sym->st_other, sym->st_shndx, name);
-    } else if (s->sh_type == SHT_REL) {
-      Elf32_Rel *rel = (Elf32_Rel *) (p + i);
-      Elf32_Sym *sym = (Elf32_Sym *) s->link->data + ELF32_R_SYM(rel->r_info);
-      const char *name = s->link->link->data + sym->st_name;
-      fprintf(f, "  %04X   %02X   %04X  \"%s\"",
-              rel->r_offset,
-              ELF32_R_TYPE(rel->r_info),
-              ELF32_R_SYM(rel->r_info), name);
-    } else {
-      fprintf(f, "   ");
-      for (n = 0; n < m; ++n) {
-        if (n + i < l) {
-          b = p[i + n];
-          if (b < 32 || b >= 127) b = '.';
-          fprintf(f, "%c", b);
-        }
+static int icf_equal(int *rep, Section *a, Section *b) {
+  Elf32_Rel *rela, *relb, *rel_end;
+  Elf32_Sym *syma, *symb;
+  int target;
+
+  if (a->data_offset != b->data_offset) return 0;
+  if (memcmp(a->data, b->data, a->data_offset) != 0) return 0;
+  if (!a->reloc || !b->reloc) return !a->reloc && !b->reloc;
+  if (a->reloc->data_offset != b->reloc->data_offset) return 0;
+
+  rela = (Elf32_Rel *) a->reloc->data;
+  relb = (Elf32_Rel *) b->reloc->data;
+  rel_end = (Elf32_Rel *) (a->reloc->data + a->reloc->data_offset);
+  for (; rela < rel_end; rela++, relb++) {
+    if (rela->r_offset != relb->r_offset) return 0;
+    if (ELF32_R_TYPE(rela->r_info) != ELF32_R_TYPE(relb->r_info)) return 0;
+    if (ELF32_R_SYM(rela->r_info) == ELF32_R_SYM(relb->r_info)) continue;
+    syma = (Elf32_Sym *) symtab_section->data + ELF32_R_SYM(rela->r_info);
+    symb = (Elf32_Sym *) symtab_section->data + ELF32_R_SYM(relb->r_info);
+    target = icf_target(rep, syma);
+    if (!target || target != icf_target(rep, symb)) return 0;
+    if (syma->st_value != symb->st_value) return 0;
+  }
+  return 1;
+}
+
+static int icf_cmp(const void *va, const void *vb) {
+  const struct icf_entry *a = va;
+  const struct icf_entry *b = vb;
+  if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+  return a->s->sh_num - b->s->sh_num;
+}
+
+static void pe_fold_identical_sections(struct pe_info *pe) {
+  TCCState *s1 = pe->s1;
+  struct icf_entry *entries;
+  Section *s, *t;
+  Elf32_Sym *sym;
+  int *rep;
+  int i, j, n, again, sym_index, sym_end;
+  int folded_bytes, folded_sections;
+
+  rep = tcc_malloc(s1->nb_sections * sizeof(int));
+  for (i = 0; i < s1->nb_sections; ++i) rep[i] = i;
+  entries = tcc_malloc(s1->nb_sections * sizeof(struct icf_entry));
+  folded_bytes = folded_sections = 0;
+
+  // Folding two sections can make sections calling them identical, so
+  // keep going until nothing more can be merged.
+  do {
+    again = 0;
+    n = 0;
+    for (i = 1; i < s1->nb_sections; ++i) {
+      s = s1->sections[i];
+      if (s->unused || rep[i] != i || s->data_offset == 0) continue;
+      if (s->sh_type != SHT_PROGBITS || !(s->sh_flags & SHF_EXECINSTR)) continue;
+      if (strcmp(s->name, ".text") == 0) continue;
+      entries[n].s = s;
+      entries[n].hash = icf_hash(rep, s);
+      n++;
+    }
+    qsort(entries, n, sizeof(struct icf_entry), icf_cmp);
+
+    for (i = 0; i < n; i = j) {
+      s = entries[i].s;
+      for (j = i + 1; j < n && entries[j].hash == entries[i].hash; j++) {
+        t = entries[j].s;
+        if (rep[t->sh_num] != t->sh_num || !icf_equal(rep, s, t)) continue;
+        rep[t->sh_num] = s->sh_num;
+        t->unused = 2;
+        if (t->sh_addralign > s->sh_addralign) s->sh_addralign = t->sh_addralign;
+        folded_bytes += t->data_offset;
+        folded_sections++;
+        again = 1;
+        if (verbose == 3) printf("section %s folded into %s\n", t->name, s->name);
       }
     }
-    i += m;
-    fprintf(f, "\n");
+  } while (again);
+
+  // Redirect symbols in folded sections to the surviving section
+  if (folded_sections) {
+    sym_end = symtab_section->data_offset / sizeof(Elf32_Sym);
+    for (sym_index = 1; sym_index < sym_end; sym_index++) {
+      sym = (Elf32_Sym *) symtab_section->data + sym_index;
+      if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE) continue;
+      sym->st_shndx = icf_find(rep, sym->st_shndx);
+    }
   }
-  fprintf(f, "\n\n");
+
+  if (verbose == 3 && folded_sections > 0) {
+    printf("%d bytes of identical code folded in %d sections\n", folded_bytes, folded_sections);
+  }
+
+  tcc_free(entries);
+  tcc_free(rep);
 }
 
-static void pe_print_sections(TCCState *s1, const char *fname) {
-  Section *s;
+// Linker map. Every byte of the image is attributed to the input section
+// and the object file or archive member it came from, with the symbols
+// defined in it. Alignment padding and room left for incremental linking
+// are shown as fill, and data made by the linker as <linker>.
+
+struct map_symbol {
+  DWORD addr;
+  DWORD size;
+  const char *name;
+};
+
+struct map_input {
+  const char *name;
+  DWORD size;
+};
+
+struct pe_map {
   FILE *f;
+  MapEntry **entries;
+  int *first_entry;
+  struct map_symbol *syms;
+  int nb_syms;
+  struct map_input *inputs;
+  int nb_inputs;
+};
+
+static int map_symbol_cmp(const void *va, const void *vb) {
+  const struct map_symbol *a = va;
+  const struct map_symbol *b = vb;
+  if (a->addr != b->addr) return a->addr < b->addr ? -1 : 1;
+  return strcmp(a->name, b->name);
+}
+
+static int map_input_cmp(const void *va, const void *vb) {
+  const struct map_input *a = va;
+  const struct map_input *b = vb;
+  if (a->size != b->size) return a->size > b->size ? -1 : 1;
+  return strcmp(a->name, b->name);
+}
+
+// Print a range of the image with the symbols in it
+static void pe_map_range(struct pe_map *m, DWORD addr, DWORD size, const char *name, const char *input) {
+  struct map_symbol *sym;
+  int lo, hi, mid;
+
+  if (size == 0) return;
+  fprintf(m->f, "%08lX %08lX    %-28s %s\n", addr, size, name, input);
+
+  lo = 0;
+  hi = m->nb_syms;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (m->syms[mid].addr < addr) lo = mid + 1; else hi = mid;
+  }
+  for (sym = m->syms + lo; sym < m->syms + m->nb_syms && sym->addr < addr + size; sym++) {
+    fprintf(m->f, "%08lX %08lX      %s\n", sym->addr, sym->size, sym->name);
+  }
+
+  for (lo = 0; lo < m->nb_inputs; lo++) {
+    if (!strcmp(m->inputs[lo].name, input)) break;
+  }
+  if (lo == m->nb_inputs) {
+    m->inputs[m->nb_inputs].name = input;
+    m->inputs[m->nb_inputs].size = 0;
+    m->nb_inputs++;
+  }
+  m->inputs[lo].size += size;
+}
+
+static void pe_map_section(struct pe_map *m, Section *s) {
+  MapEntry *e;
+  DWORD ofs, size, total;
   int i;
-  f = fopen(fname, "wt");
-  for (i = 1; i < s1->nb_sections; ++i) {
+
+  // Merged strings can no longer be attributed to input files
+  total = 0;
+  for (i = m->first_entry[s->sh_num]; i < m->first_entry[s->sh_num + 1]; i++) {
+    total += m->entries[i]->size;
+  }
+  if ((s->sh_flags & (SHF_MERGE | SHF_STRINGS)) == (SHF_MERGE | SHF_STRINGS) && total > s->data_offset) {
+    pe_map_range(m, s->sh_addr, s->data_offset, s->name, "<merged strings>");
+    return;
+  }
+
+  ofs = 0;
+  for (i = m->first_entry[s->sh_num]; i < m->first_entry[s->sh_num + 1]; i++) {
+    e = m->entries[i];
+    if (e->offset >= s->data_offset) break;
+    if (e->offset > ofs) pe_map_range(m, s->sh_addr + ofs, e->offset - ofs, "*fill*", "");
+    size = e->size;
+    if (e->offset + size > s->data_offset) size = s->data_offset - e->offset;
+    pe_map_range(m, s->sh_addr + e->offset, size, s->name, e->input);
+    ofs = e->offset + size;
+  }
+  if (ofs < s->data_offset) pe_map_range(m, s->sh_addr + ofs, s->data_offset - ofs, s->name, "<linker>");
+}
+
+static void pe_print_map(struct pe_info *pe, const char *fname) {
+  TCCState *s1 = pe->s1;
+  struct pe_map map;
+  struct section_info *si;
+  struct map_symbol *ms;
+  Elf32_Sym *sym;
+  Section *s;
+  const char *name;
+  DWORD pos, total;
+  int i, n, sym_end;
+
+  memset(&map, 0, sizeof(map));
+  map.f = fopen(fname, "wt");
+  if (!map.f) {
+    error_noabort("could not write map file '%s'", fname);
+    return;
+  }
+
+  // Group the input file contributions by section in load order
+  map.first_entry = tcc_mallocz((s1->nb_sections + 1) * sizeof(int));
+  map.entries = tcc_malloc((s1->nb_map_entries + 1) * sizeof(MapEntry *));
+  for (i = 0; i < s1->nb_map_entries; i++) map.first_entry[s1->map_entries[i]->sh_num + 1]++;
+  for (i = 1; i <= s1->nb_sections; i++) map.first_entry[i] += map.first_entry[i - 1];
+  for (i = 0; i < s1->nb_map_entries; i++) {
+    n = s1->map_entries[i]->sh_num;
+    map.entries[map.first_entry[n]++] = s1->map_entries[i];
+  }
+  for (i = s1->nb_sections; i > 0; i--) map.first_entry[i] = map.first_entry[i - 1];
+  map.first_entry[0] = 0;
+
+  // Collect the symbols in the image sorted by address
+  sym_end = symtab_section->data_offset / sizeof(Elf32_Sym);
+  map.syms = tcc_malloc(sym_end * sizeof(struct map_symbol));
+  for (i = 1; i < sym_end; i++) {
+    sym = (Elf32_Sym *) symtab_section->data + i;
+    if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= s1->nb_sections) continue;
+    if (s1->sections[sym->st_shndx]->unused) continue;
+    if (ELF32_ST_TYPE(sym->st_info) == STT_SECTION || ELF32_ST_TYPE(sym->st_info) == STT_FILE) continue;
+    name = (char *) symtab_section->link->data + sym->st_name;
+    if (!*name || (name[0] == 'L' && name[1] == '.')) continue;
+    ms = &map.syms[map.nb_syms++];
+    ms->addr = sym->st_value;
+    ms->size = sym->st_size;
+    ms->name = name;
+  }
+  qsort(map.syms, map.nb_syms, sizeof(struct map_symbol), map_symbol_cmp);
+  map.inputs = tcc_malloc((s1->nb_map_entries + 3) * sizeof(struct map_input));
+
+  fprintf(map.f, "Linker map for %s\n\n", pe->filename);
+  fprintf(map.f, "Address  Size         %-28s %s\n", "Section/Symbol", "Input");
+  for (i = 0; i < pe->sec_count; i++) {
+    si = pe->sec_info + i;
+    fprintf(map.f, "\n%08lX %08lX  %s\n", si->sh_addr, si->sh_size, si->name);
+    pos = si->sh_addr;
+    for (s = si->first; s; s = s == si->last ? NULL : s->next) {
+      if (s->sh_addr > pos) pe_map_range(&map, pos, s->sh_addr - pos, "*fill*", "");
+      pe_map_section(&map, s);
+      if (s->sh_addr + s->data_offset > pos) pos = s->sh_addr + s->data_offset;
+    }
+    if (si->sh_addr + si->sh_size > pos) {
+      pe_map_range(&map, pos, si->sh_addr + si->sh_size - pos, "*fill*", "");
+    }
+  }
+
+  fprintf(map.f, "\nDiscarded sections\n\n");
+  for (i = 1; i < s1->nb_sections; i++) {
     s = s1->sections[i];
-    pe_print_section(f, s);
+    if (!s->unused) continue;
+    n = map.first_entry[i];
+    fprintf(map.f, "         %08lX    %-28s %s (%s)\n", s->data_offset, s->name,
+            n < map.first_entry[i + 1] ? map.entries[n]->input : "<linker>",
+            s->unused == 2 ? "folded" : "unused");
   }
-  pe_print_section(f, s1->dynsymtab_section);
-  fclose(f);
+
+  fprintf(map.f, "\nSize by input\n\n");
+  qsort(map.inputs, map.nb_inputs, sizeof(struct map_input), map_input_cmp);
+  total = 0;
+  for (i = 0; i < map.nb_inputs; i++) {
+    fprintf(map.f, "%08lX  %s\n", map.inputs[i].size, *map.inputs[i].name ? map.inputs[i].name : "*fill*");
+    total += map.inputs[i].size;
+  }
+  fprintf(map.f, "%08lX  total\n", total);
+
+  fclose(map.f);
+  tcc_free(map.first_entry);
+  tcc_free(map.entries);
+  tcc_free(map.syms);
+  tcc_free(map.inputs);
 }
 
 // This is for compiled windows resources in 'coff' format
@@ -1364,6 +2291,7 @@ int pe_load_def_file(TCCState *s1, int fd) {
         dllref = tcc_malloc(sizeof(DLLReference) + strlen(dllname));
         strcpy(dllref->name, dllname);
         dllref->level = 0;
+        dllref->handle = NULL;
         dynarray_add((void ***) &s1->loaded_dlls, &s1->nb_loaded_dlls, dllref);
         ++state;
 
@@ -1436,8 +2364,9 @@ void pe_add_runtime(TCCState *s1) {
 int pe_output_file(TCCState *s1, const char *filename) {
   int ret;
   struct pe_info pe;
-  int i;
+  int phase;
 
+  phase = bench_phase(BENCH_LINK);
   memset(&pe, 0, sizeof pe);
   pe.filename = filename;
   pe.s1 = s1;
@@ -1450,35 +2379,142 @@ int pe_output_file(TCCState *s1, const char *filename) {
     pe.imagebase = s1->imagebase;
   }
 
+  if (s1->profile_generate && prof_add_runtime(s1, filename) < 0) {
+    bench_phase(phase);
+    return 1;
+  }
   pe_add_runtime_ex(s1, &pe);
   relocate_common_syms(); // Assign bss adresses
   tcc_add_linker_symbols(s1);
 
+  bench_phase(BENCH_GC);
   if (!s1->nofll) pe_eliminate_unused_sections(&pe);
+  pe_merge_strings(&pe);
+  if (!s1->nofll && s1->icf) pe_fold_identical_sections(&pe);
+  bench_phase(BENCH_LINK);
+
+  pe_build_tls(&pe);
 
   ret = pe_check_symbols(&pe);
-  if (ret != 0) return ret;
+  if (ret != 0) {
+    bench_phase(phase);
+    return ret;
+  }
   
+  if (s1->incremental) pe.ilk = pe_load_ilk(&pe);
   pe_assign_addresses(&pe);
   relocate_syms(s1, 0);
 
-  for (i = 1; i < s1->nb_sections; ++i) {
-    Section *s = s1->sections[i];
-    if (s->reloc) {
-      relocate_section(s1, s);
-      pe_relocate_rva(&pe, s);
-    }
-  }
+  bench_phase(BENCH_RELOCATE);
+  pe_relocate_sections(&pe);
 
+  bench_phase(BENCH_WRITE);
   if (s1->nb_errors) {
     ret = 1;
   } else {
     ret = pe_write(&pe);
   }
 
-  if (s1->mapfile) pe_print_sections(s1, s1->mapfile);
+  if (s1->mapfile) pe_print_map(&pe, s1->mapfile);
 
   tcc_free(pe.sec_info);
+  pe_free_ilk(pe.ilk);
+  bench_phase(phase);
   return ret;
 }
 
+
+// Find the address of a symbol imported from a DLL when running in memory.
+// Symbols not listed in any .def file are looked up in the loaded modules.
+void *resolve_sym(TCCState *s1, const char *symbol, int type) {
+  DLLReference *dllref;
+  Elf32_Sym *sym;
+  int sym_index;
+
+  sym_index = pe_find_import(s1, symbol);
+  if (sym_index == 0) return dlsym(RTLD_DEFAULT, symbol);
+  sym = (Elf32_Sym *) s1->dynsymtab_section->data + sym_index;
+  if (sym->st_value == 0) return NULL;
+
+  dllref = s1->loaded_dlls[sym->st_value - 1];
+  if (!dllref->handle) {
+    dllref->handle = dlopen(dllref->name, RTLD_NOW);
+    if (!dllref->handle) return NULL;
+  }
+  return dlsym(dllref->handle, (char *) s1->dynsymtab_section->link->data + sym->st_name);
+}
+
+// Link program into executable memory. The memory is never released,
+// because the program can leave atexit() handlers behind.
+int tcc_relocate(TCCState *s1) {
+  Section *s;
+  unsigned char *mem;
+  unsigned long size, align;
+  int i;
+
+  if (s1->profile_generate) {
+    error_noabort("-fprofile-generate cannot be used with -run");
+    return -1;
+  }
+  if (s1->nostdlib == 0) {
+    tcc_add_library(s1, "c");
+    tcc_add_library(s1, "os");
+  }
+  relocate_common_syms(); // Assign bss adresses
+  tcc_add_linker_symbols(s1);
+  if (tls_section->data_offset) {
+    error_noabort("thread local variables cannot be used with -run");
+    return -1;
+  }
+
+  // Assign offsets to the allocated sections
+  size = 0;
+  for (i = 1; i < s1->nb_sections; ++i) {
+    s = s1->sections[i];
+    if (!(s->sh_flags & SHF_ALLOC)) continue;
+    align = s->sh_addralign ? s->sh_addralign : 1;
+    size = (size + align - 1) & -align;
+    s->sh_addr = size;
+    size += s->data_offset;
+  }
+
+  // Memory is page aligned, so section alignment is preserved
+  mem = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    error_noabort("cannot allocate %lu bytes for program", size);
+    return -1;
+  }
+  for (i = 1; i < s1->nb_sections; ++i) {
+    s = s1->sections[i];
+    if (s->sh_flags & SHF_ALLOC) s->sh_addr += (unsigned long) mem;
+  }
+
+  relocate_syms(s1, 1);
+  if (s1->nb_errors) return -1;
+  for (i = 1; i < s1->nb_sections; ++i) {
+    s = s1->sections[i];
+    if (s->reloc) relocate_section(s1, s);
+  }
+
+  // Copy sections into place. The bss is already zero.
+  for (i = 1; i < s1->nb_sections; ++i) {
+    s = s1->sections[i];
+    if ((s->sh_flags & SHF_ALLOC) && s->sh_type != SHT_NOBITS && s->data_offset) {
+      memcpy((void *) s->sh_addr, s->data, s->data_offset);
+    }
+  }
+  return 0;
+}
+
+// Compile program into memory and call main() or the -entry symbol
+int tcc_run(TCCState *s1, int argc, char **argv) {
+  int (*prog_main)(int, char **);
+  int phase, ret;
+
+  phase = bench_phase(BENCH_LINK);
+  ret = tcc_relocate(s1);
+  bench_phase(phase);
+  if (ret < 0) return 1;
+  prog_main = tcc_get_symbol_err(s1, s1->start_symbol ? s1->start_symbol : "main");
+  return prog_main(argc, argv);
+}
@@ -2670,7 +2670,7 @@ void macro_subst(TokenString *tok_str, Sym **nested_list, const int *macro_str,
 }
 
 // Return next token with macro substitution
-void next(void) {
+static void next_token(void) {
   Sym *nested_list, *s;
   TokenString str;
   struct macro_level *ml;
@@ -2716,6 +2716,19 @@ void next(void) {
   }
 }
 
+void next(void) {
+  int phase;
+
+  if (do_bench) {
+    // Account time spent lexing and expanding macros separately
+    phase = bench_phase(BENCH_PREPROCESS);
+    next_token();
+    bench_phase(phase);
+  } else {
+    next_token();
+  }
+}
+
 // Push back current token and set current token to 'last_tok'. Only
 // identifier case handled for labels.
 void unget_tok(int last_tok) {
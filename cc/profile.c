@@ -0,0 +1,211 @@
+//
+//  profile.c - Tiny C Compiler for Sanos
+//
+//  Copyright (c) 2011-2012 Michael Ringgaard
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "cc.h"
+
+// Profile guided optimization.
+//
+// With -fprofile-generate every function gets a record in the .prof
+// section with a 64-bit counter for the function entry and for the taken
+// and fall-through edges of each conditional jump:
+//
+//   checksum, number of counters, name length, name, counters
+//
+// The instrumented main() registers a handler with atexit() that writes
+// the counters as text, one line per function:
+//
+//   name checksum n count0 count1 ... countn-1
+//
+// -fprofile-use=file reads this file back. The checksum is computed from
+// the conditional jumps in the function, so a stale profile for a function
+// that has changed is detected and ignored.
+
+#define PROF_HASH_SIZE 1021
+
+typedef struct ProfileEntry {
+  struct ProfileEntry *next;
+  unsigned int checksum;
+  int nb_counts;
+  unsigned int *counts;
+  char name[1];
+} ProfileEntry;
+
+static ProfileEntry *prof_table[PROF_HASH_SIZE];
+static int prof_loaded;
+
+// Section holding the profile counters and its section symbol
+Section *prof_section;
+int prof_sym;
+
+// Start a profile record for function 'name' with 'nb_counters' counters
+// and return the section offset of the first counter
+int prof_record(const char *name, unsigned int checksum, int nb_counters) {
+  int len;
+  unsigned int *p;
+
+  if (!prof_section) {
+    prof_section = new_section(tcc_state, ".prof", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE);
+    prof_section->sh_addralign = 4;
+    prof_sym = put_elf_sym(symtab_section, 0, 0, ELF32_ST_INFO(STB_LOCAL, STT_SECTION), 0, prof_section->sh_num, NULL);
+  }
+
+  len = (strlen(name) + 4) & ~3;
+  p = section_ptr_add(prof_section, 12 + len + nb_counters * 8);
+  p[0] = checksum;
+  p[1] = nb_counters;
+  p[2] = len;
+  strcpy((char *) (p + 3), name);
+  return prof_section->data_offset - nb_counters * 8;
+}
+
+// Read profile from file given by -fprofile-use
+static void prof_load(TCCState *s1) {
+  FILE *f;
+  char name[256];
+  unsigned int checksum;
+  int i, n, h;
+  ProfileEntry *pe;
+
+  prof_loaded = 1;
+  f = fopen(s1->profile_use, "r");
+  if (!f) error("could not open profile '%s'", s1->profile_use);
+  while (fscanf(f, "%255s %u %d", name, &checksum, &n) == 3) {
+    if (n < 0) break;
+    pe = tcc_malloc(sizeof(ProfileEntry) + strlen(name));
+    strcpy(pe->name, name);
+    pe->checksum = checksum;
+    pe->nb_counts = n;
+    pe->counts = tcc_malloc(n * sizeof(unsigned int));
+    for (i = 0; i < n; i++) {
+      if (fscanf(f, "%u", &pe->counts[i]) != 1) pe->counts[i] = 0;
+    }
+    h = elf_hash((unsigned char *) name) % PROF_HASH_SIZE;
+    pe->next = prof_table[h];
+    prof_table[h] = pe;
+  }
+  fclose(f);
+}
+
+// Find the counters for function 'name'. Returns NULL if the function is
+// not in the profile or the profile does not match the function.
+unsigned int *prof_lookup(TCCState *s1, const char *name, unsigned int checksum, int nb_counters) {
+  ProfileEntry *pe;
+  int found;
+
+  if (!prof_loaded) prof_load(s1);
+  found = 0;
+  for (pe = prof_table[elf_hash((const unsigned char *) name) % PROF_HASH_SIZE]; pe; pe = pe->next) {
+    if (strcmp(pe->name, name) != 0) continue;
+    if (pe->checksum == checksum && pe->nb_counts == nb_counters) return pe->counts;
+    found = 1;
+  }
+  if (found) warning("profile for '%s' does not match function", name);
+  return NULL;
+}
+
+// Return the number of calls to function 'name'
+unsigned int prof_function_count(TCCState *s1, const char *name) {
+  ProfileEntry *pe;
+  unsigned int count;
+
+  if (!prof_loaded) prof_load(s1);
+  count = 0;
+  for (pe = prof_table[elf_hash((const unsigned char *) name) % PROF_HASH_SIZE]; pe; pe = pe->next) {
+    if (strcmp(pe->name, name) == 0 && pe->nb_counts > 0) count += pe->counts[0];
+  }
+  return count;
+}
+
+void prof_free(void) {
+  int i;
+  ProfileEntry *pe;
+
+  for (i = 0; i < PROF_HASH_SIZE; i++) {
+    while ((pe = prof_table[i]) != NULL) {
+      prof_table[i] = pe->next;
+      tcc_free(pe->counts);
+      tcc_free(pe);
+    }
+  }
+  prof_loaded = 0;
+  prof_section = NULL;
+}
+
+// Runtime support for writing the profile when the program exits. The
+// linker defines __prof_start and __prof_end around the .prof section.
+static const char prof_runtime[] =
+  "extern unsigned int __prof_start[], __prof_end[];\n"
+  "void *fopen(const char *filename, const char *mode);\n"
+  "int fprintf(void *stream, const char *fmt, ...);\n"
+  "int fclose(void *stream);\n"
+  "int atexit(void (*func)(void));\n"
+  "static void __prof_dump(void) {\n"
+  "  unsigned int *p, *c;\n"
+  "  int i, n;\n"
+  "  void *f = fopen(__prof_file, \"w\");\n"
+  "  if (!f) return;\n"
+  "  for (p = __prof_start; p < __prof_end; p = c + 2 * n) {\n"
+  "    n = p[1];\n"
+  "    c = p + 3 + p[2] / 4;\n"
+  "    fprintf(f, \"%s %u %d\", (char *) (p + 3), p[0], n);\n"
+  "    for (i = 0; i < n; i++) fprintf(f, \" %u\", c[2 * i + 1] ? 0xffffffff : c[2 * i]);\n"
+  "    fprintf(f, \"\\n\");\n"
+  "  }\n"
+  "  fclose(f);\n"
+  "}\n"
+  "void __prof_init(void) {\n"
+  "  atexit(__prof_dump);\n"
+  "}\n";
+
+// Compile the profile runtime into the output if instrumented code calls
+// it. The profile is written to 'filename' with the extension replaced
+// by .prof unless a file name was given with -fprofile-generate=file.
+int prof_add_runtime(TCCState *s1, const char *filename) {
+  CString src;
+  char buf[1024];
+  const char *p;
+  int ret;
+
+  if (!find_elf_sym(symtab_section, "__prof_init")) return 0;
+  if (s1->profile_file) {
+    pstrcpy(buf, sizeof(buf), s1->profile_file);
+  } else {
+    pstrcpy(buf, sizeof(buf), filename);
+    *tcc_fileextension(buf) = 0;
+    pstrcat(buf, sizeof(buf), ".prof");
+  }
+
+  cstr_new(&src);
+  cstr_cat(&src, "static const char __prof_file[] = \"");
+  for (p = buf; *p; p++) {
+    if (*p == '\\' || *p == '"') cstr_ccat(&src, '\\');
+    cstr_ccat(&src, *p);
+  }
+  cstr_cat(&src, "\";\n");
+  cstr_cat(&src, prof_runtime);
+  cstr_ccat(&src, 0);
+
+  // The runtime itself is not instrumented
+  s1->profile_generate = 0;
+  ret = tcc_compile_string(s1, src.data);
+  s1->profile_generate = 1;
+  cstr_free(&src);
+  return ret;
+}
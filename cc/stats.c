@@ -0,0 +1,187 @@
+//
+//  stats.c - Tiny C Compiler for Sanos
+//
+//  Copyright (c) 2011-2012 Michael Ringgaard
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "cc.h"
+
+// Code generation statistics (-fstats, -fstats=json).
+//
+// The code generator fills in a record for every function it emits: code
+// size, prolog and epilog size, frame size, callee-saved registers, spills,
+// long and short jumps after relaxation, jumps removed by the jump
+// optimizer and calls to runtime helpers. The records are reported when
+// compilation is done, in text sorted by size or as JSON.
+
+// Statistics for the function being generated, or NULL
+FuncStats *cur_stats;
+
+static const char *stats_reg_names[8] = {
+  "eax", "ecx", "edx", "ebx", "st0", "", "esi", "edi"
+};
+
+// Start statistics for function 'name'
+void stats_begin(TCCState *s1, const char *name) {
+  FuncStats *fs;
+
+  fs = tcc_mallocz(sizeof(FuncStats) + strlen(name));
+  strcpy(fs->name, name);
+  fs->filename = tcc_strdup(file ? file->filename : "");
+  fs->next = s1->func_stats;
+  s1->func_stats = fs;
+  cur_stats = fs;
+}
+
+// Count call to runtime helper 'tok'
+void stats_helper(int tok) {
+  FuncStats *fs = cur_stats;
+  int i;
+
+  if (!fs) return;
+  for (i = 0; i < fs->nb_helpers; i++) {
+    if (fs->helper_tok[i] == tok) break;
+  }
+  if (i == fs->nb_helpers) {
+    if (i == STATS_HELPERS) return;
+    fs->helper_tok[i] = tok;
+    fs->nb_helpers++;
+  }
+  fs->helper_calls[i]++;
+}
+
+static void print_json_str(const char *str) {
+  putchar('"');
+  while (*str) {
+    if (*str == '"' || *str == '\\') putchar('\\');
+    putchar(*str++);
+  }
+  putchar('"');
+}
+
+// Larger functions first
+static int stats_cmp(const void *a, const void *b) {
+  const FuncStats *x = *(const FuncStats **) a;
+  const FuncStats *y = *(const FuncStats **) b;
+
+  if (x->size != y->size) return y->size - x->size;
+  return strcmp(x->name, y->name);
+}
+
+static void print_text(FuncStats **funcs, int n) {
+  FuncStats *fs, total;
+  char regs[16];
+  int i, r, j;
+
+  memset(&total, 0, sizeof(FuncStats));
+  qsort(funcs, n, sizeof(FuncStats *), stats_cmp);
+  printf("%-24s %6s %6s %6s %6s %6s %5s %5s %7s  %-11s %s\n", "function", "size", "prolog",
+         "epilog", "frame", "spills", "long", "short", "removed", "saved", "helpers");
+  for (i = 0; i < n; i++) {
+    fs = funcs[i];
+    regs[0] = 0;
+    for (r = 0; r < 8; r++) {
+      if (!(fs->saved_regs & (1 << r))) continue;
+      if (regs[0]) pstrcat(regs, sizeof(regs), ",");
+      pstrcat(regs, sizeof(regs), stats_reg_names[r]);
+    }
+    printf("%-24s %6d %6d %6d %6d %6d %5d %5d %7d  %-11s", fs->name, fs->size, fs->prolog_size,
+           fs->epilog_size, fs->frame_size, fs->spills, fs->long_jumps, fs->short_jumps,
+           fs->removed_jumps, regs[0] ? regs : "-");
+    for (j = 0; j < fs->nb_helpers; j++) {
+      printf(" %s", get_tok_str(fs->helper_tok[j], NULL));
+      if (fs->helper_calls[j] > 1) printf("*%d", fs->helper_calls[j]);
+    }
+    printf("\n");
+
+    total.size += fs->size;
+    total.prolog_size += fs->prolog_size;
+    total.epilog_size += fs->epilog_size;
+    total.frame_size += fs->frame_size;
+    total.spills += fs->spills;
+    total.long_jumps += fs->long_jumps;
+    total.short_jumps += fs->short_jumps;
+    total.removed_jumps += fs->removed_jumps;
+    for (j = 0; j < fs->nb_helpers; j++) total.nb_helpers += fs->helper_calls[j];
+  }
+  printf("%-24s %6d %6d %6d %6d %6d %5d %5d %7d  %-11s %d\n", "total", total.size, total.prolog_size,
+         total.epilog_size, total.frame_size, total.spills, total.long_jumps, total.short_jumps,
+         total.removed_jumps, "", total.nb_helpers);
+}
+
+static void print_json(FuncStats **funcs, int n) {
+  FuncStats *fs;
+  int i, r, j, first;
+
+  printf("{\n");
+  printf("  \"functions\": [\n");
+  for (i = 0; i < n; i++) {
+    fs = funcs[i];
+    printf("    {\"name\": ");
+    print_json_str(fs->name);
+    printf(", \"file\": ");
+    print_json_str(fs->filename);
+    printf(", \"size\": %d, \"prolog\": %d, \"epilog\": %d, \"frame\": %d",
+           fs->size, fs->prolog_size, fs->epilog_size, fs->frame_size);
+    printf(", \"saved_regs\": [");
+    first = 1;
+    for (r = 0; r < 8; r++) {
+      if (!(fs->saved_regs & (1 << r))) continue;
+      printf("%s\"%s\"", first ? "" : ", ", stats_reg_names[r]);
+      first = 0;
+    }
+    printf("], \"spills\": %d, \"long_jumps\": %d, \"short_jumps\": %d, \"removed_jumps\": %d",
+           fs->spills, fs->long_jumps, fs->short_jumps, fs->removed_jumps);
+    printf(", \"helpers\": {");
+    for (j = 0; j < fs->nb_helpers; j++) {
+      printf("%s\"%s\": %d", j ? ", " : "", get_tok_str(fs->helper_tok[j], NULL), fs->helper_calls[j]);
+    }
+    printf("}}%s\n", i < n - 1 ? "," : "");
+  }
+  printf("  ]\n");
+  printf("}\n");
+}
+
+// Report statistics for all functions
+void stats_report(TCCState *s1) {
+  FuncStats *fs, **funcs;
+  int n;
+
+  n = 0;
+  for (fs = s1->func_stats; fs; fs = fs->next) n++;
+  funcs = tcc_malloc((n + 1) * sizeof(FuncStats *));
+  for (fs = s1->func_stats; fs; fs = fs->next) funcs[--n] = fs;
+  for (fs = s1->func_stats; fs; fs = fs->next) n++;
+
+  if (s1->stats == 2) {
+    print_json(funcs, n);
+  } else {
+    print_text(funcs, n);
+  }
+  tcc_free(funcs);
+}
+
+void stats_free(TCCState *s1) {
+  FuncStats *fs;
+
+  while ((fs = s1->func_stats) != NULL) {
+    s1->func_stats = fs->next;
+    tcc_free((char *) fs->filename);
+    tcc_free(fs);
+  }
+  cur_stats = NULL;
+}
@@ -24,8 +24,11 @@
 #define SYM_POOL_NB (8192 / sizeof(Sym))
 
 Section *stab_section, *stabstr_section;
+Section *lines_section;
 Section *symtab_section, *strtab_section;
 Section *text_section, *data_section, *bss_section;
+Section *string_section;
+Section *tls_section;
 Section *cur_text_section;
 Section *last_text_section;
 
@@ -344,6 +347,7 @@ Sym *external_sym(int v, CType *type, int r) {
     if (!are_compatible_types(&s->type, type)) {
       error("incompatible types for redefinition of '%s'", get_tok_str(v, NULL));
     }
+    if ((type->t & VT_BTYPE) == VT_FUNC) gfunc_regparm_redecl(s, type);
   }
   return s;
 }
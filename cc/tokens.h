@@ -84,6 +84,8 @@ DEF(TOK_ASM2, "__asm")
 DEF(TOK_ASM3, "__asm__")
 
 DEF(TOK_INT64, "__int64")
+DEF(TOK_THREAD1, "__thread")
+DEF(TOK_THREAD2, "_Thread_local")
 DEF(TOK_DECLSPEC, "__declspec")
 DEF(TOK_DLLIMPORT, "dllimport")
 DEF(TOK_NAKED, "naked")
@@ -132,6 +134,8 @@ DEF(TOK_PACKED1, "packed")
 DEF(TOK_PACKED2, "__packed__")
 DEF(TOK_UNUSED1, "unused")
 DEF(TOK_UNUSED2, "__unused__")
+DEF(TOK_VECTOR_SIZE1, "vector_size")
+DEF(TOK_VECTOR_SIZE2, "__vector_size__")
 DEF(TOK_CDECL1, "cdecl")
 DEF(TOK_CDECL2, "__cdecl")
 DEF(TOK_CDECL3, "__cdecl__")
@@ -142,10 +146,73 @@ DEF(TOK_FASTCALL1, "fastcall")
 DEF(TOK_FASTCALL2, "__fastcall")
 DEF(TOK_FASTCALL3, "__fastcall__")
 DEF(TOK_DLLEXPORT, "dllexport")
+DEF(TOK_THREAD3, "thread")
 DEF(TOK_NORETURN1, "noreturn")
 DEF(TOK_NORETURN2, "__noreturn__")
+DEF(TOK_NO_INSTRUMENT_FUNCTION1, "no_instrument_function")
+DEF(TOK_NO_INSTRUMENT_FUNCTION2, "__no_instrument_function__")
 DEF(TOK_builtin_types_compatible_p, "__builtin_types_compatible_p")
 DEF(TOK_builtin_constant_p, "__builtin_constant_p")
+
+// Bit manipulation builtins. Each bit counting operation is followed by its
+// long and long long variants, and the bit counting operations must be kept
+// in order before the byte swaps.
+DEF(TOK_builtin_clz, "__builtin_clz")
+DEF(TOK_builtin_clzl, "__builtin_clzl")
+DEF(TOK_builtin_clzll, "__builtin_clzll")
+DEF(TOK_builtin_ctz, "__builtin_ctz")
+DEF(TOK_builtin_ctzl, "__builtin_ctzl")
+DEF(TOK_builtin_ctzll, "__builtin_ctzll")
+DEF(TOK_builtin_ffs, "__builtin_ffs")
+DEF(TOK_builtin_ffsl, "__builtin_ffsl")
+DEF(TOK_builtin_ffsll, "__builtin_ffsll")
+DEF(TOK_builtin_popcount, "__builtin_popcount")
+DEF(TOK_builtin_popcountl, "__builtin_popcountl")
+DEF(TOK_builtin_popcountll, "__builtin_popcountll")
+DEF(TOK_builtin_bswap16, "__builtin_bswap16")
+DEF(TOK_builtin_bswap32, "__builtin_bswap32")
+DEF(TOK_builtin_bswap64, "__builtin_bswap64")
+DEF(TOK_builtin_prefetch, "__builtin_prefetch")
+DEF(TOK_builtin_unreachable, "__builtin_unreachable")
+DEF(TOK_builtin_assume_aligned, "__builtin_assume_aligned")
+
+// Atomic builtins. The read-modify-write operations must be kept in order.
+DEF(TOK_sync_fetch_and_add, "__sync_fetch_and_add")
+DEF(TOK_sync_fetch_and_sub, "__sync_fetch_and_sub")
+DEF(TOK_sync_fetch_and_or, "__sync_fetch_and_or")
+DEF(TOK_sync_fetch_and_and, "__sync_fetch_and_and")
+DEF(TOK_sync_fetch_and_xor, "__sync_fetch_and_xor")
+DEF(TOK_sync_fetch_and_nand, "__sync_fetch_and_nand")
+DEF(TOK_sync_add_and_fetch, "__sync_add_and_fetch")
+DEF(TOK_sync_sub_and_fetch, "__sync_sub_and_fetch")
+DEF(TOK_sync_or_and_fetch, "__sync_or_and_fetch")
+DEF(TOK_sync_and_and_fetch, "__sync_and_and_fetch")
+DEF(TOK_sync_xor_and_fetch, "__sync_xor_and_fetch")
+DEF(TOK_sync_nand_and_fetch, "__sync_nand_and_fetch")
+DEF(TOK_atomic_fetch_add, "__atomic_fetch_add")
+DEF(TOK_atomic_fetch_sub, "__atomic_fetch_sub")
+DEF(TOK_atomic_fetch_or, "__atomic_fetch_or")
+DEF(TOK_atomic_fetch_and, "__atomic_fetch_and")
+DEF(TOK_atomic_fetch_xor, "__atomic_fetch_xor")
+DEF(TOK_atomic_fetch_nand, "__atomic_fetch_nand")
+DEF(TOK_atomic_add_fetch, "__atomic_add_fetch")
+DEF(TOK_atomic_sub_fetch, "__atomic_sub_fetch")
+DEF(TOK_atomic_or_fetch, "__atomic_or_fetch")
+DEF(TOK_atomic_and_fetch, "__atomic_and_fetch")
+DEF(TOK_atomic_xor_fetch, "__atomic_xor_fetch")
+DEF(TOK_atomic_nand_fetch, "__atomic_nand_fetch")
+DEF(TOK_sync_bool_compare_and_swap, "__sync_bool_compare_and_swap")
+DEF(TOK_sync_val_compare_and_swap, "__sync_val_compare_and_swap")
+DEF(TOK_sync_lock_test_and_set, "__sync_lock_test_and_set")
+DEF(TOK_sync_lock_release, "__sync_lock_release")
+DEF(TOK_sync_synchronize, "__sync_synchronize")
+DEF(TOK_atomic_load_n, "__atomic_load_n")
+DEF(TOK_atomic_store_n, "__atomic_store_n")
+DEF(TOK_atomic_exchange_n, "__atomic_exchange_n")
+DEF(TOK_atomic_compare_exchange_n, "__atomic_compare_exchange_n")
+DEF(TOK_atomic_thread_fence, "__atomic_thread_fence")
+DEF(TOK_atomic_signal_fence, "__atomic_signal_fence")
+
 DEF(TOK_REGPARM1, "regparm")
 DEF(TOK_REGPARM2, "__regparm__")
 
@@ -177,6 +244,11 @@ DEF(TOK___fixunssfdi, "__fixunssfdi")
 DEF(TOK___fixunsdfdi, "__fixunsdfdi")
 DEF(TOK___fixunsxfdi, "__fixunsxfdi")
 DEF(TOK___chkstk, "__chkstk")
+DEF(TOK__tls_index, "_tls_index")
+DEF(TOK___prof_init, "__prof_init")
+DEF(TOK___cyg_profile_func_enter, "__cyg_profile_func_enter")
+DEF(TOK___cyg_profile_func_exit, "__cyg_profile_func_exit")
+DEF(TOK_mcount, "mcount")
 
 //
 // Tiny Assembler
@@ -22,7 +22,7 @@
 #include "cc.h"
 
 // Some predefined types
-CType char_pointer_type, func_old_type, int_type;
+CType char_pointer_type, func_old_type, func_void_type, int_type;
 
 // Returns true if float/double/long double type
 int is_float(int t) {
@@ -59,6 +59,25 @@ void mk_pointer(CType *type) {
   type->ref = s;
 }
 
+// Modify type so that it is a vector of 'size' bytes of its elements
+void mk_vector(CType *type, int size) {
+  Sym *s;
+  int bt, esize, align;
+  CType etype;
+
+  etype = *type;
+  etype.t &= ~(VT_STORAGE | VT_CONSTANT | VT_VOLATILE);
+  bt = etype.t & VT_BTYPE;
+  if ((etype.t & VT_ARRAY) || (!is_integer_btype(bt) && bt != VT_FLOAT && bt != VT_DOUBLE)) {
+    error("invalid vector type");
+  }
+  esize = type_size(&etype, &align);
+  if (size <= 0 || (size & (size - 1)) || size < esize) error("invalid vector size");
+  s = sym_push(SYM_FIELD, &etype, 0, size / esize);
+  type->t = VT_VECTOR | (type->t & (VT_STORAGE | VT_CONSTANT | VT_VOLATILE));
+  type->ref = s;
+}
+
 // Return the pointed type of t
 CType *pointed_type(CType *type) {
   return &type->ref->type;
@@ -171,6 +190,9 @@ int compare_types(CType *type1, CType *type2, int unqualified) {
     return are_compatible_types(type1, type2);
   } else if (bt1 == VT_STRUCT) {
     return (type1->ref == type2->ref);
+  } else if (bt1 == VT_VECTOR) {
+    if (type1->ref->c != type2->ref->c) return 0;
+    return compare_types(&type1->ref->type, &type2->ref->type, unqualified);
   } else if (bt1 == VT_FUNC) {
     return are_compatible_funcs(type1, type2);
   } else {
@@ -207,6 +229,11 @@ int type_size(CType *type, int *a) {
       *a = PTR_SIZE;
       return PTR_SIZE;
     }
+  } else if (bt == VT_VECTOR) {
+    // Vectors are aligned to their size
+    s = type->ref;
+    *a = type_size(&s->type, a) * s->c;
+    return *a;
   } else if (bt == VT_LDOUBLE) {
     *a = LDOUBLE_ALIGN;
     return LDOUBLE_SIZE;
@@ -294,6 +321,12 @@ void type_to_str(char *buf, int buf_size, CType *type, const char *varstr) {
         pstrcat(buf, buf_size, get_tok_str(v, NULL));
       }
       break;
+    case VT_VECTOR:
+      s = type->ref;
+      type_to_str(buf, buf_size, &s->type, NULL);
+      snprintf(buf1, sizeof(buf1), " __attribute__((vector_size(%d)))", pointed_size(type) * s->c);
+      pstrcat(buf, buf_size, buf1);
+      break;
     case VT_FUNC:
       s = type->ref;
       type_to_str(buf, buf_size, &s->type, varstr);
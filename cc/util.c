@@ -24,20 +24,21 @@
 // True if isid(c) || isnum(c)
 static unsigned char isidnum_table[256];
 
-// Memory management
-#ifdef MEM_DEBUG
+// Memory management. Heap use is only tracked when benchmarking.
 int mem_cur_size;
 int mem_max_size;
-#endif
+int mem_allocs;
+int mem_frees;
 
 void *tcc_malloc(unsigned long size) {
   void *ptr;
   ptr = malloc(size);
   if (!ptr && size) error("memory full");
-#ifdef MEM_DEBUG
-  mem_cur_size += malloc_usable_size(ptr);
-  if (mem_cur_size > mem_max_size) mem_max_size = mem_cur_size;
-#endif
+  if (do_bench && ptr) {
+    mem_allocs++;
+    mem_cur_size += malloc_usable_size(ptr);
+    if (mem_cur_size > mem_max_size) mem_max_size = mem_cur_size;
+  }
   return ptr;
 }
 
@@ -50,15 +51,19 @@ void *tcc_mallocz(unsigned long size) {
 
 void *tcc_realloc(void *ptr, unsigned long size) {
   void *newptr;
-#ifdef MEM_DEBUG
-  mem_cur_size -= malloc_usable_size(ptr);
-#endif
+  if (do_bench) {
+    if (ptr) {
+      mem_cur_size -= malloc_usable_size(ptr);
+    } else {
+      mem_allocs++;
+    }
+  }
   newptr = realloc(ptr, size);
-#ifdef MEM_DEBUG
-  // NOTE: count not correct if alloc error, but not critical
-  mem_cur_size += malloc_usable_size(newptr);
-  if (mem_cur_size > mem_max_size) cmem_max_size = mem_cur_size;
-#endif
+  if (do_bench && newptr) {
+    // NOTE: count not correct if alloc error, but not critical
+    mem_cur_size += malloc_usable_size(newptr);
+    if (mem_cur_size > mem_max_size) mem_max_size = mem_cur_size;
+  }
   return newptr;
 }
 
@@ -70,9 +75,10 @@ char *tcc_strdup(const char *str) {
 }
 
 void tcc_free(void *ptr) {
-#ifdef MEM_DEBUG
-  mem_cur_size -= malloc_usable_size(ptr);
-#endif
+  if (do_bench && ptr) {
+    mem_frees++;
+    mem_cur_size -= malloc_usable_size(ptr);
+  }
   free(ptr);
 }
 
@@ -282,6 +288,16 @@ void add_char(CString *cstr, int c)
   }
 }
 
+// Print error or warning message
+void print_diagnostic(TCCState *s1, const char *msg) {
+  if (!s1->error_func) {
+    // Default case: stderr
+    fprintf(stderr, "%s\n", msg);
+  } else {
+    s1->error_func(s1->error_opaque, msg);
+  }
+}
+
 void error_ex(TCCState *s1, int is_warning, const char *fmt, va_list ap)
 {
   char buf[2048];
@@ -305,12 +321,12 @@ void error_ex(TCCState *s1, int is_warning, const char *fmt, va_list ap)
   }
   strcat_vprintf(buf, sizeof(buf), fmt, ap);
 
-  if (!s1->error_func) {
-    // Default case: stderr
-    fprintf(stderr, "%s\n", buf);
-  } else {
-    s1->error_func(s1->error_opaque, buf);
+  if (s1->cache_log) {
+    // Keep diagnostics for the object file cache
+    cstr_cat(&s1->cache_diag, buf);
+    cstr_ccat(&s1->cache_diag, '\0');
   }
+  if (s1->cache_log != CACHE_LOG_QUIET) print_diagnostic(s1, buf);
   if (!is_warning || s1->warn_error) s1->nb_errors++;
 }
 
@@ -42,6 +42,32 @@
 extern "C" {
 #endif
 
+#ifdef __TINYC__
+
+// The compiler generates locked instructions for the atomic builtins
+
+__inline int atomic_add(int *dest, int value) {
+  return __sync_add_and_fetch(dest, value);
+}
+
+__inline int atomic_increment(int *dest) {
+  return __sync_add_and_fetch(dest, 1);
+}
+
+__inline int atomic_decrement(int *dest) {
+  return __sync_sub_and_fetch(dest, 1);
+}
+
+__inline int atomic_exchange(int *dest, int value) {
+  return __sync_lock_test_and_set(dest, value);
+}
+
+__inline int atomic_compare_and_exchange(int *dest, int exchange, int comperand) {
+  return __sync_val_compare_and_swap(dest, comperand, exchange);
+}
+
+#else
+
 // On uniprocessors, the 'lock' prefixes are not necessary (and expensive). 
 // Since sanos does not (yet) support SMP the 'lock' prefix is disabled for now.
 
@@ -94,6 +120,8 @@ __inline int atomic_compare_and_exchange(int *dest, int exchange, int comperand)
 
 #pragma warning(default: 4035)
 
+#endif
+
 #ifdef  __cplusplus
 }
 #endif
@@ -38,6 +38,30 @@
 extern "C" {
 #endif
 
+#ifdef __TINYC__
+
+__inline void set_bit(void *bitmap, int pos) {
+  ((unsigned int *) bitmap)[pos >> 5] |= 1 << (pos & 31);
+}
+
+__inline void clear_bit(void *bitmap, int pos) {
+  ((unsigned int *) bitmap)[pos >> 5] &= ~(1 << (pos & 31));
+}
+
+__inline int test_bit(void *bitmap, int pos) {
+  return -(int) ((((unsigned int *) bitmap)[pos >> 5] >> (pos & 31)) & 1);
+}
+
+static __inline int find_lowest_bit(unsigned mask) {
+  return __builtin_ctz(mask);
+}
+
+static __inline int find_highest_bit(unsigned mask) {
+  return mask ? 31 - __builtin_clz(mask) : 0;
+}
+
+#else
+
 __inline void set_bit(void *bitmap, int pos) {
   __asm { 
     mov eax, pos
@@ -103,6 +127,8 @@ static __inline int find_highest_bit(unsigned mask) {
 }
 #endif
 
+#endif
+
 __inline void set_bits(void *bitmap, int pos, int len) {
   while (len-- > 0) set_bit(bitmap, pos++);
 }
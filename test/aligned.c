@@ -0,0 +1,66 @@
+// Over-aligned variables and types
+
+#include "test.h"
+
+char gc1 = 1;
+int g64 __attribute__((aligned(64))) = 5;
+char gc2;
+char gpage[16] __attribute__((aligned(4096)));
+static int gs32 __attribute__((aligned(32)));
+
+struct __attribute__((aligned(32))) line { int a; };
+struct pad { char c; int x __attribute__((aligned(64))); };
+struct tail { int a; } __attribute__((aligned(16)));
+
+static void test_global() {
+    expect(0, (int) &g64 & 63);
+    expect(5, g64);
+    expect(0, (int) gpage & 4095);
+    expect(0, (int) &gs32 & 31);
+}
+
+static void test_struct() {
+    expect(32, sizeof(struct line));
+    expect(32, __alignof__(struct line));
+    expect(64, (int) &((struct pad *) 0)->x);
+    expect(128, sizeof(struct pad));
+    expect(16, sizeof(struct tail));
+    expect(64, sizeof(struct line[2]));
+}
+
+static int deep(int a, int b, int c, int depth) {
+    int x __attribute__((aligned(64)));
+    struct line l;
+    char buf[5000] __attribute__((aligned(16)));
+
+    x = a + b;
+    l.a = c;
+    buf[4999] = depth;
+    expect(0, (int) &x & 63);
+    expect(0, (int) &l & 31);
+    expect(0, (int) buf & 15);
+    if (depth > 0) expect(a + b + c, deep(a, b, c, depth - 1));
+    expect(depth, buf[4999]);
+    return x + l.a;
+}
+
+static int regs(int a, int b) {
+    int x __attribute__((aligned(128))) = a;
+    expect(0, (int) &x & 127);
+    return x * b;
+}
+
+static void test_local() {
+    char c = 1;
+    expect(6, deep(1, 2, 3, 0));
+    expect(6, deep(1, 2, 3, 3));
+    expect(42, regs(6, 7));
+    expect(1, c);
+}
+
+void testmain() {
+    print("aligned attribute");
+    test_global();
+    test_struct();
+    test_local();
+}
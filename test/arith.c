@@ -88,6 +88,43 @@ static void test_comma() {
     expectf(7.0, (1, 3, 5, 7.0));
 }
 
+static void test_llong() {
+    long long a = 0x123456789abcdefLL, n = -0x123456789abcdefLL;
+    unsigned long long u = 0xfedcba9876543210ULL;
+    long long x = 1000000007, y = 1000;
+    int i;
+
+    // Variable shifts on both sides of 32
+    i = 4;
+    expect(1, (a << i) == 0x123456789abcdef0LL);
+    expect(1, (a >> i) == 0x123456789abcdeLL);
+    expect(1, (n >> i) == -0x123456789abcdfLL);
+    expect(1, (u >> i) == 0xfedcba987654321ULL);
+    i = 32;
+    expect(1, (a << i) == 0x89abcdef00000000LL);
+    expect(1, (u >> i) == 0xfedcba98ULL);
+    expect(1, (n >> i) == -0x1234568LL);
+    i = 40;
+    expect(1, (a << i) == 0xabcdef0000000000LL);
+    expect(1, (a >> i) == 0x12345LL);
+    expect(1, (n >> i) == -0x12346LL);
+    expect(1, (u >> i) == 0xfedcbaULL);
+    i = 0;
+    expect(1, (a << i) == a);
+    expect(1, (n >> i) == n);
+
+    // Division with and without high words
+    expect(1, x / y == 1000000);
+    expect(1, x % y == 7);
+    expect(1, a / y == 81985529216486LL);
+    expect(1, a % y == 895);
+    expect(1, n / y == -81985529216486LL);
+    expect(1, n % y == -895);
+    expect(1, u / 16 == 0xfedcba987654321ULL);
+    expect(1, u % x == 0xfedcba9876543210ULL % 1000000007);
+    expect(1, (unsigned long long) x / y == 1000000);
+}
+
 void testmain() {
     print("basic arithmetic");
     test_basic();
@@ -97,4 +134,5 @@ void testmain() {
     test_unary();
     test_ternary();
     test_comma();
+    test_llong();
 }
\ No newline at end of file
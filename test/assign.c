@@ -2,6 +2,40 @@
 
 #include "test.h"
 
+static void set(int *p, int v) {
+    *p = v;
+}
+
+static void test_reload() {
+    int a = 1, b, c;
+    int *p = &a;
+    union { int i; char c; } u;
+
+    // Values kept in registers must be reloaded after stores through pointers
+    b = a;
+    *p = 2;
+    expect(2, a);
+    expect(1, b);
+    set(&b, 7);
+    expect(7, b);
+    expect(9, a + b);
+
+    // Overlapping stores
+    u.i = 0x1234;
+    c = u.i;
+    u.c = 0x56;
+    expect(0x1256, u.i);
+    expect(0x1234, c);
+
+    // Narrow loads of the same slot
+    c = 0x1ff;
+    expect(-1, (char) c);
+    expect(255, (unsigned char) c);
+    expect(0x1ff, c);
+    c = c + 1;
+    expect(0x200, c);
+}
+
 void testmain() {
     print("compound assignment");
 
@@ -52,4 +86,6 @@ void testmain() {
     expect(52, b);
     b >>= 2;
     expect(13, b);
+
+    test_reload();
 }
@@ -0,0 +1,112 @@
+// Atomic operations
+
+#include <atomic.h>
+#include "test.h"
+
+static int gi = 3;
+
+static void test_fetch() {
+    int i = 10;
+    char c = 5;
+    short s = -3;
+    unsigned char uc = 250;
+
+    expect(10, __sync_fetch_and_add(&i, 5));
+    expect(15, i);
+    expect(12, __sync_add_and_fetch(&i, -3));
+    expect(12, __sync_fetch_and_sub(&i, 2));
+    expect(8, __sync_sub_and_fetch(&i, 2));
+    expect(8, __sync_fetch_and_or(&i, 3));
+    expect(11, i);
+    expect(3, __sync_and_and_fetch(&i, 7));
+    expect(3, __sync_fetch_and_xor(&i, 1));
+    expect(2, i);
+    expect(-3, __sync_nand_and_fetch(&i, 6));
+    expect(7, __sync_add_and_fetch(&c, 2));
+    expect(-3, __sync_fetch_and_add(&s, 1));
+    expect(-2, s);
+    expect(250, __sync_fetch_and_add(&uc, 10));
+    expect(4, uc);
+    expect(4, __sync_or_and_fetch(&uc, 0));
+    expect(10, __sync_add_and_fetch(&gi, 7));
+    expect(10, __atomic_fetch_add(&gi, 1, __ATOMIC_SEQ_CST));
+    expect(0, __atomic_and_fetch(&gi, 16, __ATOMIC_RELAXED));
+}
+
+static void test_cas() {
+    int i = 1, e = 1;
+    char c = 'a';
+    int *p = &i;
+
+    expect(1, __sync_bool_compare_and_swap(&i, 1, 2));
+    expect(0, __sync_bool_compare_and_swap(&i, 1, 3));
+    expect(2, __sync_val_compare_and_swap(&i, 2, 4));
+    expect(4, __sync_val_compare_and_swap(p, 9, 5));
+    expect('a', __sync_val_compare_and_swap(&c, 'a', 'b'));
+    expect('b', c);
+    expect(0, __atomic_compare_exchange_n(&i, &e, 6, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    expect(4, e);
+    expect(1, __atomic_compare_exchange_n(&i, &e, 6, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    expect(6, i);
+    if (__sync_bool_compare_and_swap(&i, 6, 7)) i++;
+    expect(8, i);
+}
+
+static void test_exchange() {
+    int i = 3;
+    int *p = 0, *q = &i;
+
+    expect(3, __sync_lock_test_and_set(&i, 1));
+    __sync_lock_release(&i);
+    expect(0, i);
+    expect(0, __atomic_exchange_n(&i, 9, __ATOMIC_ACQ_REL));
+    expect(9, __atomic_load_n(&i, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&i, 11, __ATOMIC_SEQ_CST);
+    expect(11, i);
+    __atomic_store_n(&i, 12, __ATOMIC_RELEASE);
+    expect(12, i);
+    expect(0, (int) __sync_lock_test_and_set(&p, q));
+    expect(1, p == q);
+    __sync_synchronize();
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static void test_llong() {
+    long long l = 0x100000000LL, e = 5;
+
+    expect(1, __sync_fetch_and_add(&l, 0xffffffffLL) == 0x100000000LL);
+    expect(1, l == 0x1ffffffffLL);
+    expect(1, __sync_sub_and_fetch(&l, 0xffffffffLL) == 0x100000000LL);
+    expect(1, __sync_or_and_fetch(&l, 3) == 0x100000003LL);
+    expect(1, __sync_bool_compare_and_swap(&l, 0x100000003LL, -1LL));
+    expect(1, __sync_val_compare_and_swap(&l, 0, 1) == -1LL);
+    expect(1, __sync_lock_test_and_set(&l, 42) == -1LL);
+    expect(1, __atomic_load_n(&l, __ATOMIC_SEQ_CST) == 42);
+    __atomic_store_n(&l, 0x700000000LL, __ATOMIC_RELAXED);
+    expect(0, __atomic_compare_exchange_n(&l, &e, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    expect(1, e == 0x700000000LL);
+    expect(1, __atomic_compare_exchange_n(&l, &e, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    expect(1, l == 1);
+}
+
+static void test_wrappers() {
+    int n = 5;
+
+    expect(6, atomic_increment(&n));
+    expect(5, atomic_decrement(&n));
+    expect(9, atomic_add(&n, 4));
+    expect(9, atomic_exchange(&n, 1));
+    expect(1, atomic_compare_and_exchange(&n, 2, 1));
+    expect(2, atomic_compare_and_exchange(&n, 3, 1));
+    expect(2, n);
+}
+
+void testmain() {
+    print("atomic builtins");
+    test_fetch();
+    test_cas();
+    test_exchange();
+    test_llong();
+    test_wrappers();
+}
@@ -28,7 +28,75 @@ static void test_return_address() {
 static void test_return_address() {}
 #endif
 
+static int id(int x) { return x; }
+static long long idll(long long x) { return x; }
+
+static void test_bitcount() {
+    expect(31, __builtin_clz(1));
+    expect(0, __builtin_clz(0x80000000));
+    expect(24, __builtin_clz(id(0xff)));
+    expect(0, __builtin_clz(id(-1)));
+    expect(63, __builtin_clzll(1));
+    expect(32, __builtin_clzll(idll(0xffffffff)));
+    expect(3, __builtin_clzll(idll(0x1000000000000000LL)));
+    expect(4, __builtin_ctz(16));
+    expect(31, __builtin_ctz(id(0x80000000)));
+    expect(0, __builtin_ctzl(id(7)));
+    expect(40, __builtin_ctzll(idll(0x30000000000LL)));
+    expect(2, __builtin_ctzll(idll(0x30000000004LL)));
+    expect(0, __builtin_ffs(0));
+    expect(0, __builtin_ffs(id(0)));
+    expect(5, __builtin_ffs(id(0x30)));
+    expect(0, __builtin_ffsll(idll(0)));
+    expect(1, __builtin_ffsll(idll(1)));
+    expect(33, __builtin_ffsll(idll(0x100000000LL)));
+    expect(8, __builtin_popcount(0xff));
+    expect(32, __builtin_popcount(id(-1)));
+    expect(0, __builtin_popcount(id(0)));
+    expect(13, __builtin_popcount(id(0x12345678)));
+    expect(64, __builtin_popcountll(idll(-1)));
+    expect(26, __builtin_popcountll(idll(0x1234567812345678LL)));
+    expect(4, sizeof(__builtin_popcountll(idll(1))));
+}
+
+static void test_bswap() {
+    expect(0x3412, __builtin_bswap16(0x1234));
+    expect(0x3412, __builtin_bswap16(id(0xff1234)));
+    expect(0x78563412, __builtin_bswap32(0x12345678));
+    expect(0x78563412, __builtin_bswap32(id(0x12345678)));
+    expect(0x08070605, (int)(__builtin_bswap64(idll(0x0102030405060708LL)) >> 32));
+    expect(0x04030201, (int)__builtin_bswap64(idll(0x0102030405060708LL)));
+    expect(0x01020304, (int)__builtin_bswap64(0x0403020100000000LL));
+    expect(2, sizeof(__builtin_bswap16(1)));
+    expect(8, sizeof(__builtin_bswap64(1)));
+}
+
+static int hint(int *p, int n) {
+    int *q = __builtin_assume_aligned(p, 16);
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        __builtin_prefetch(q + i + 8);
+        __builtin_prefetch(&q[i + 16], 0, 0);
+        __builtin_prefetch(q, 1, 2);
+        s += q[i];
+    }
+    if (n < 0) __builtin_unreachable();
+    return s;
+}
+
+static void test_hints() {
+    static int a[4] = { 1, 2, 3, 4 };
+    int b[4] = { 5, 6, 7, 8 };
+    __builtin_prefetch(a);
+    __builtin_prefetch(b, 0, 1);
+    expect(10, hint(a, 4));
+    expect(26, hint(b, 4));
+}
+
 void testmain() {
     print("builtin");
     test_return_address();
+    test_bitcount();
+    test_bswap();
+    test_hints();
 }
@@ -30,10 +30,60 @@ static void test_for() {
 	}
 }
 
+static int count(int n) {
+	int i = 0;
+	while (i < n) i++;
+	return i;
+}
+
+static void test_rotated() {
+	int i, j, n;
+
+	// loop test repeated at the bottom of the loop
+	expect(0, count(0));
+	expect(7, count(7));
+
+	// continue and break in rotated loops
+	n = 0;
+	for (i = 0; i < 10; i++) {
+		if (i & 1) continue;
+		if (i == 8) break;
+		n += i;
+	}
+	expect(12, n);
+	expect(8, i);
 
+	n = 0;
+	i = 0;
+	while (i++ < 10) {
+		if (i == 3) continue;
+		if (i == 6) break;
+		n += i;
+	}
+	expect(12, n);
+
+	// conditions with && and ||
+	n = 0;
+	for (i = 0, j = 10; i < 10 && j > 3; i++, j--) n++;
+	expect(7, n);
+	n = 0;
+	i = 0;
+	while (i < 3 || n < 5) {
+		n++;
+		i++;
+	}
+	expect(5, n);
+
+	// loops that never run
+	n = 0;
+	for (i = 5; i < 5; i++) n++;
+	while (0) n++;
+	expect(0, n);
+}
 
 void testmain() {
     print("for () embedded declaration tests");
     test_for();
+    test_rotated();
 
 }
\ No newline at end of file
@@ -36,6 +36,59 @@ static void mixed(float v01, int v02, float v03, int v04, float v05, int v06, fl
     expectf(37.0, v37); expect(38, v38); expectf(39.0, v39); expect(40, v40);
 }
 
+static int sub3(int a, char b, short c);
+static int sub2(char *p, int i);
+
+static int call_early() {
+    return sub3(10, 3, 2) + sub2("abc", 1);
+}
+
+static int sub3(int a, char b, short c) {
+    return a - b - c;
+}
+
+int sub2(char *p, int i) {
+    return p[i];
+}
+
+static int big_frame(int a, int b) {
+    char buf[10000];
+    buf[0] = a;
+    buf[9999] = b;
+    return buf[0] * buf[9999];
+}
+
+static int knr(int a, char *p);
+
+static int call_knr() {
+    return knr(7, "xyz");
+}
+
+static int knr(a, p)
+    int a;
+    char *p;
+{
+    return a + p[1];
+}
+
+static int (*pick(int i))(int, char, short) {
+    return i ? sub3 : 0;
+}
+
+static void reg_args() {
+    int (*f)(int, char, short) = sub3;
+
+    // Direct calls and calls through the address of the function
+    expect(103, call_early());
+    expect(5, sub3(10, 3, 2));
+    expect(5, f(10, 3, 2));
+    expect(5, pick(1)(10, 3, 2));
+    expect(98, sub2("abc", 1));
+    expect(-10, sub3(sub3(1, 2, 3), sub3(4, 3, 2), sub3(9, 1, 1)));
+    expect(42, big_frame(6, 7));
+    expect(128, call_knr());
+}
+
 void testmain() {
     print("function argument");
 
@@ -49,4 +102,6 @@ void testmain() {
           11.0, 12, 13.0, 14, 15.0, 16, 17.0, 18, 19.0, 20,
           21.0, 22, 23.0, 24, 25.0, 26, 27.0, 28, 29.0, 30,
           31.0, 32, 33.0, 34, 35.0, 36, 37.0, 38, 39.0, 40);
+
+    reg_args();
 }
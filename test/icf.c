@@ -0,0 +1,69 @@
+// Identical code folding
+//
+// The Makefile builds this file with --icf. Functions with the same code
+// and relocations share one copy, and calls and addresses of the folded
+// functions resolve to it.
+
+#include "test.h"
+
+int icf_x = 1;
+int icf_y = 2;
+
+int add_a(int a, int b) {
+    return a + b;
+}
+
+int add_b(int a, int b) {
+    return a + b;
+}
+
+int sub_a(int a, int b) {
+    return a - b;
+}
+
+// Identical once add_a and add_b are folded
+int twice_a(int a) {
+    return add_a(a, a);
+}
+
+int twice_b(int a) {
+    return add_b(a, a);
+}
+
+// Same code, but different variables
+int get_x(void) {
+    return icf_x;
+}
+
+int get_y(void) {
+    return icf_y;
+}
+
+static int (*add_ptrs[])(int, int) = { add_a, add_b, sub_a };
+static int (*twice_ptrs[])(int) = { twice_a, twice_b };
+static int (*get_ptrs[])(void) = { get_x, get_y };
+
+static void test_fold() {
+    expect(1, add_ptrs[0] == add_ptrs[1]);
+    expect(1, twice_ptrs[0] == twice_ptrs[1]);
+    expect(0, add_ptrs[0] == add_ptrs[2]);
+    expect(0, get_ptrs[0] == get_ptrs[1]);
+}
+
+static void test_calls() {
+    expect(5, add_a(2, 3));
+    expect(5, add_b(2, 3));
+    expect(-1, sub_a(2, 3));
+    expect(14, twice_a(7));
+    expect(14, twice_b(7));
+    expect(9, add_ptrs[1](4, 5));
+    expect(1, get_x());
+    expect(2, get_y());
+    expect(2, get_ptrs[1]());
+}
+
+void testmain() {
+    print("identical code folding");
+    test_fold();
+    test_calls();
+}
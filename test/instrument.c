@@ -0,0 +1,105 @@
+// Function instrumentation hooks
+//
+// The Makefile builds this file with -finstrument-functions -pg
+// -fauto-regparm. The hooks clobber eax, ecx and edx, which carry the
+// parameters of directly called static functions and the return value.
+
+#include "test.h"
+
+static int enters, exits, mcounts;
+static void *last_fn;
+
+__attribute__((no_instrument_function))
+static void clobber(void) {
+    __asm__ __volatile__("mov $-1, %%eax\n"
+                         "mov $-1, %%ecx\n"
+                         "mov $-1, %%edx\n" : : : "eax", "ecx", "edx");
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_enter(void *fn, void *call_site) {
+    enters++;
+    last_fn = fn;
+    clobber();
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_exit(void *fn, void *call_site) {
+    exits++;
+    clobber();
+}
+
+__attribute__((no_instrument_function))
+void mcount(void) {
+    mcounts++;
+    clobber();
+}
+
+static int add3(int a, int b, int c) {
+    return a * 100 + b * 10 + c;
+}
+
+static int sub2(int a, int b) {
+    return a - b;
+}
+
+static char *second(char *p, int n) {
+    return p + n;
+}
+
+static long long wide(int a) {
+    return (long long)a << 33 | 5;
+}
+
+static double half(int a) {
+    return a / 2.0;
+}
+
+__attribute__((no_instrument_function))
+static int plain(int a) {
+    return a + 1;
+}
+
+static void test_regparm() {
+    expect(123, add3(1, 2, 3));
+    expect(-7, sub2(3, 10));
+    expect('c', *second("abc", 2));
+    expectl(5, wide(1) & 0xffffffff);
+    expectl(2, wide(1) >> 32);
+    expectd(3.5, half(7));
+}
+
+static void test_hooks() {
+    int e, x, m, r;
+    void *fn;
+
+    // Read the counters before expect(), which is instrumented too
+    e = enters;
+    x = exits;
+    m = mcounts;
+    r = add3(1, 2, 4);
+    e = enters - e;
+    x = exits - x;
+    m = mcounts - m;
+    fn = last_fn;
+    expect(124, r);
+    expect(1, e);
+    expect(1, x);
+    expect(1, m);
+    expect(1, fn == (void *)add3);
+
+    e = enters;
+    m = mcounts;
+    r = plain(4);
+    e = enters - e;
+    m = mcounts - m;
+    expect(5, r);
+    expect(0, e);
+    expect(0, m);
+}
+
+void testmain() {
+    print("function instrumentation");
+    test_regparm();
+    test_hooks();
+}
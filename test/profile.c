@@ -0,0 +1,87 @@
+// Profile-guided optimization
+//
+// The Makefile builds this file with -fprofile-generate, runs it to write
+// a profile, rebuilds it with -fprofile-use and runs it again. Rarely and
+// never executed blocks are moved out of line in the second build.
+
+#include "test.h"
+
+// The error branch is never taken
+static int checked_div(int a, int b) {
+    int r;
+    if (b == 0) {
+        printf("division by zero\n");
+        r = -1;
+    } else {
+        r = a / b;
+    }
+    return r;
+}
+
+// The negative branch is taken once in 64 calls
+static int rare(int x) {
+    int r;
+    if (x % 64 == 0) {
+        r = -x;
+    } else {
+        r = x * 2;
+    }
+    return r;
+}
+
+// 64-bit compares keep the flags live between conditional jumps
+static int compare64(long long a, long long b) {
+    if (a < b)
+        return -1;
+    if (a > b)
+        return 1;
+    return 0;
+}
+
+// Loop with a cold exit in the middle
+static int find(int *p, int n, int v) {
+    int i;
+    for (i = 0; i < n; i++) {
+        if (p[i] == v)
+            break;
+    }
+    return i;
+}
+
+static void test_cold() {
+    int i, sum;
+    sum = 0;
+    for (i = 1; i <= 1000; i++)
+        sum += checked_div(i * 7, 7);
+    expect(500500, sum);
+    sum = 0;
+    for (i = 0; i < 640; i++)
+        sum += rare(i);
+    expect(400320, sum);
+}
+
+static void test_flags() {
+    long long big = 1LL << 40;
+    int i, sum;
+    sum = 0;
+    for (i = 0; i < 100; i++)
+        sum += compare64(big + i, big + 50);
+    expect(-1, sum);
+    expect(1, compare64(big, 1));
+    expect(0, compare64(big, big));
+}
+
+static void test_loop() {
+    int a[100], i;
+    for (i = 0; i < 100; i++)
+        a[i] = i * i;
+    expect(100, find(a, 100, 3));
+    expect(9, find(a, 100, 81));
+}
+
+void testmain() {
+    print("profile-guided optimization");
+    test_cold();
+    test_flags();
+    test_loop();
+}
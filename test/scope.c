@@ -2,6 +2,42 @@
 
 #include "test.h"
 
+static int sum(int *p, int n) {
+    int s = 0;
+    for (int i = 0; i < n; i++) s += p[i];
+    return s;
+}
+
+static void test_slots() {
+    int a = 1, r = 0;
+
+    // Sibling scopes share stack slots
+    for (int k = 0; k < 2; k++) {
+        if (k) {
+            int x[4] = { 1, 2, 3, 4 };
+            r += sum(x, 4);
+        } else {
+            int y[4] = { 10, 20, 30, 40 };
+            r += sum(y, 4);
+        }
+    }
+    expect(110, r);
+    {
+        int b = 5;
+        expect(6, a + b);
+    }
+    {
+        int c;
+        c = 7;
+        expect(8, a + c);
+    }
+    expect(1, a);
+
+    // Statement expressions keep their slots until the value is used
+    r = a + ({ int t = 3; { int u = 4; t += u; } t; }) + ({ int v = 10; v; });
+    expect(18, r);
+}
+
 void testmain() {
     print("scope");
 
@@ -12,4 +48,5 @@ void testmain() {
         int a = 64;
         expect(64, a);
     }
+    test_slots();
 }
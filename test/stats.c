@@ -0,0 +1,62 @@
+// Runtime helper counts reported by -fstats
+//
+// The Makefile compiles this file with -fstats into bin/stats.txt before
+// running it, and the test checks that the helper calls made for structure
+// copies and zero-fills were reported.
+
+#include "test.h"
+#include "string.h"
+
+typedef struct {
+    int a[16];
+} Big;
+
+static void copy_big(Big *p, Big *q) {
+    *p = *q;
+}
+
+static int clear_big(int i) {
+    Big b = { 0 };
+    return b.a[i];
+}
+
+// Return the -fstats line for function 'name', or NULL
+static char *stats_line(FILE *f, char *name, char *line, int size) {
+    int len = strlen(name);
+    rewind(f);
+    while (fgets(line, size, f)) {
+        if (!strncmp(line, name, len) && line[len] == ' ')
+            return line;
+    }
+    return NULL;
+}
+
+static void test_helpers() {
+    char line[256];
+    FILE *f = fopen("bin/stats.txt", "r");
+    if (!f)
+        fail("no bin/stats.txt");
+    if (!stats_line(f, "copy_big", line, sizeof(line)))
+        fail("copy_big missing from -fstats output");
+    expect(1, strstr(line, " memcpy") != NULL);
+    if (!stats_line(f, "clear_big", line, sizeof(line)))
+        fail("clear_big missing from -fstats output");
+    expect(1, strstr(line, " memset") != NULL);
+    fclose(f);
+}
+
+static void test_code() {
+    Big x, y;
+    int i;
+    for (i = 0; i < 16; i++)
+        y.a[i] = i * 3;
+    copy_big(&x, &y);
+    expect(45, x.a[15]);
+    expect(0, clear_big(7));
+}
+
+void testmain() {
+    print("-fstats");
+    test_code();
+    test_helpers();
+}
@@ -0,0 +1,56 @@
+// String literal merging
+
+#include "test.h"
+#include "string.h"
+
+static char *hello() {
+    return "hello, world";
+}
+
+static char *world() {
+    return "world";
+}
+
+static char *empty() {
+    return "";
+}
+
+static void test_identical() {
+    expect_string("hello, world", hello());
+    expect(0, strcmp(hello(), "hello, world"));
+    expect(12, strlen(hello()));
+}
+
+static void test_tail() {
+    expect_string("world", world());
+    expect(5, strlen(world()));
+    expect_string("hello, world", hello());
+    expect(0, *empty());
+}
+
+static void test_embedded_nul() {
+    char *p = "ab\0cd";
+    char *q = "cd";
+    expect(6, sizeof("ab\0cd"));
+    expect('a', p[0]);
+    expect(0, p[2]);
+    expect('c', p[3]);
+    expect_string("cd", q);
+}
+
+static void test_array_init() {
+    char a[] = "world";
+    char b[] = "world";
+    a[0] = 'W';
+    expect_string("World", a);
+    expect_string("world", b);
+    expect_string("world", world());
+}
+
+void testmain() {
+    print("string merging");
+    test_identical();
+    test_tail();
+    test_embedded_nul();
+    test_array_init();
+}
@@ -0,0 +1,54 @@
+// Thread local storage
+
+#include "test.h"
+
+__thread int counter = 5;
+static __thread char buf[16];
+__declspec(thread) long long big;
+_Thread_local struct { int a, b; } pair;
+extern __thread int late;
+
+static int next_id(void) {
+    static __thread int id = 100;
+    return id++;
+}
+
+static void test_access() {
+    expect(5, counter);
+    counter++;
+    counter += 10;
+    expect(16, counter);
+    buf[3] = 'x';
+    expect('x', buf[3]);
+    expect(0, buf[2]);
+    pair.b = 7;
+    expect(7, pair.a + pair.b);
+    big = 1;
+    big += 0x100000000LL;
+    expect(1, big == 0x100000001LL);
+    expect(100, next_id());
+    expect(101, next_id());
+    expect(4, sizeof(counter));
+    expect(16, sizeof(buf));
+    late = 3;
+    expect(3, late);
+}
+
+static void test_address() {
+    int *p = &counter;
+    char *q = buf;
+
+    *p = 42;
+    expect(42, counter);
+    expect(1, p == &counter);
+    expect(1, q + 3 == &buf[3]);
+    expect(1, (char *) &pair.b - (char *) &pair == 4);
+}
+
+__thread int late;
+
+void testmain() {
+    print("thread local storage");
+    test_access();
+    test_address();
+}
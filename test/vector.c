@@ -0,0 +1,165 @@
+// Vector types
+
+#include "test.h"
+
+typedef int int32x4 __attribute__((vector_size(16)));
+typedef unsigned int uint32x4 __attribute__((vector_size(16)));
+typedef float float32x4 __attribute__((vector_size(16)));
+typedef double float64x2 __attribute__((vector_size(16)));
+typedef short int16x8 __attribute__((vector_size(16)));
+typedef unsigned char uint8x16 __attribute__((vector_size(16)));
+typedef __attribute__((vector_size(8))) int int32x2;
+
+int32x4 gv = { 1, 2, 3, 4 };
+float32x4 gf;
+char gc;
+uint8x16 gb;
+
+static int32x4 add(int32x4 a, int32x4 b) {
+    return a + b;
+}
+
+static int sum(int32x4 *p, int n) {
+    int32x4 s = { 0 };
+    for (int i = 0; i < n; i++) s += p[i];
+    return s[0] + s[1] + s[2] + s[3];
+}
+
+static void test_type() {
+    int32x4 v;
+    expect(16, sizeof(int32x4));
+    expect(16, __alignof__(float32x4));
+    expect(8, sizeof(int32x2));
+    expect(0, (int) &gv & 15);
+    expect(0, (int) &gb & 15);
+    expect(0, (int) &v & 15);
+    expect(4, sizeof(gv[0]));
+    expect(1, sizeof(gb[0]));
+    expect(1, __builtin_types_compatible_p(int32x4, int __attribute__((vector_size(16)))));
+    expect(0, __builtin_types_compatible_p(int32x4, uint32x4));
+}
+
+static void test_int() {
+    int32x4 a = { 1, 2, 3, 4 };
+    int32x4 b = { 10, 20, 30, 40 };
+    int32x4 c;
+
+    c = a + b;
+    expect(11, c[0]); expect(22, c[1]); expect(33, c[2]); expect(44, c[3]);
+    c = b - a;
+    expect(9, c[0]); expect(36, c[3]);
+    c = a * b;
+    expect(10, c[0]); expect(160, c[3]);
+    c = b / a;
+    expect(10, c[0]); expect(10, c[3]);
+    c = b % 7;
+    expect(3, c[0]); expect(5, c[3]);
+    c = (a | 8) & 13;
+    expect(9, c[0]); expect(12, c[3]);
+    c = a ^ b;
+    expect(11, c[0]); expect(44, c[3]);
+    c = a << 2;
+    expect(4, c[0]); expect(16, c[3]);
+    c = -a;
+    expect(-1, c[0]); expect(-4, c[3]);
+    c = ~a;
+    expect(-2, c[0]);
+    c = 100 - a;
+    expect(99, c[0]); expect(96, c[3]);
+    c += a;
+    expect(100, c[0]); expect(100, c[3]);
+    c[2] = 7;
+    expect(7, c[2]);
+    expect(22, add(a, a * 10)[1]);
+    expect(20, sum(&a, 1) * 2);
+}
+
+static void test_compare() {
+    int32x4 a = { 1, 5, 3, -4 };
+    int32x4 b = { 2, 5, 1, 4 };
+    uint32x4 ua = { 1, 5, 3, -4 };
+    uint32x4 ub = { 2, 5, 1, 4 };
+    float32x4 fa = { 1, 5, 3, -4 };
+    float32x4 fb = { 2, 5, 1, 4 };
+    int32x4 c;
+
+    c = a == b;
+    expect(0, c[0]); expect(-1, c[1]); expect(0, c[2]);
+    c = a != b;
+    expect(-1, c[0]); expect(0, c[1]);
+    c = a < b;
+    expect(-1, c[0]); expect(0, c[1]); expect(0, c[2]); expect(-1, c[3]);
+    c = a <= b;
+    expect(-1, c[0]); expect(-1, c[1]); expect(0, c[2]);
+    c = a > b;
+    expect(0, c[0]); expect(0, c[1]); expect(-1, c[2]); expect(0, c[3]);
+    c = a >= b;
+    expect(0, c[0]); expect(-1, c[1]); expect(-1, c[2]);
+    c = ua < ub;
+    expect(-1, c[0]); expect(0, c[3]);
+    c = fa < fb;
+    expect(-1, c[0]); expect(0, c[1]); expect(0, c[2]); expect(-1, c[3]);
+    c = fa >= fb;
+    expect(0, c[0]); expect(-1, c[1]); expect(-1, c[2]);
+    c = fa != fb;
+    expect(-1, c[0]); expect(0, c[1]);
+}
+
+static void test_float() {
+    float32x4 a = { 1, 2, 3, 4 };
+    float32x4 b;
+    float64x2 d = { 1.5, 2.5 };
+
+    gf[0] = 0.5; gf[1] = 1.5; gf[2] = 2.5;
+    b = a * 2 + gf;
+    expectf(2.5, b[0]); expectf(5.5, b[1]); expectf(8.5, b[2]); expectf(8, b[3]);
+    b = b / a - 1;
+    expectf(1.5, b[0]); expectf(1, b[3]);
+    d = d * d;
+    expectd(2.25, d[0]); expectd(6.25, d[1]);
+}
+
+static void test_small() {
+    uint8x16 a, b;
+    int16x8 s = { 1, -2, 3, -4, 5, -6, 7, -8 };
+    int32x2 p = { 3, 4 };
+
+    for (int i = 0; i < 16; i++) a[i] = i * 20;
+    b = a + a;
+    expect(40, b[1]); expect(88, b[15]);
+    b = a > 100;
+    expect(0, b[5]); expect(255, b[6]);
+    gb = a - 1;
+    expect(255, gb[0]); expect(39, gb[2]);
+    s = s * s;
+    expect(1, s[0]); expect(64, s[7]);
+    s = s > 10;
+    expect(0, s[2]); expect(-1, s[4]);
+    p = p * p + 1;
+    expect(10, p[0]); expect(17, p[1]);
+}
+
+static void test_cast() {
+    int32x4 a = { 1, 2, 3, 4 };
+    uint8x16 b;
+    float32x4 f = { 1.0 };
+
+    b = (uint8x16) a;
+    expect(1, b[0]); expect(0, b[1]); expect(2, b[4]);
+    a = (int32x4) f;
+    expect(0x3f800000, a[0]);
+    a = gc ? a : (int32x4) f;
+    expect(0x3f800000, a[0]);
+    a = 1 ? gv : a;
+    expect(4, a[3]);
+}
+
+void testmain() {
+    print("vector");
+    test_type();
+    test_int();
+    test_compare();
+    test_float();
+    test_small();
+    test_cast();
+}